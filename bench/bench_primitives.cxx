@@ -0,0 +1,154 @@
+//Headless throughput benchmark for gl::Primitives. It creates a hidden GLFW window so it also runs on Mesa llvmpipe (e.g. under xvfb-run with LIBGL_ALWAYS_SOFTWARE=1)
+//Every primitive is timed over a few runs and its result is checked against a cpu reference. Returns non zero if any result is wrong
+//usage: bench_primitives [nr_elements] [nr_runs]
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Primitives.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//runs the function a few times and returns the average time in ms. glFinish makes sure we time the gpu work and not only the submission
+static double time_ms(const std::function<void()>& func, const int nr_runs){
+    func(); //warm up so the kernels get compiled and the scratch buffers allocated
+    glFinish();
+    auto start=std::chrono::high_resolution_clock::now();
+    for(int i=0; i<nr_runs; i++){
+        func();
+    }
+    glFinish();
+    auto end=std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end-start).count()/nr_runs;
+}
+
+static void report(const std::string& name, const double ms, const int nr_elements, const bool correct){
+    double melems_per_sec= nr_elements/(ms*1e-3)/1e6;
+    std::cout << name << ": " << ms << " ms, " << melems_per_sec << " Melements/s " << (correct? "OK" : "WRONG") << std::endl;
+}
+
+static std::vector<unsigned int> download_uints(gl::Buf& buf, const int nr_elements){
+    std::vector<unsigned int> vals(nr_elements);
+    buf.download(vals.data(), nr_elements*sizeof(unsigned int));
+    return vals;
+}
+
+
+int main(int argc, char* argv[]){
+    int nr_elements= argc>1? std::atoi(argv[1]) : 1<<20;
+    int nr_runs= argc>2? std::atoi(argv[2]) : 10;
+
+    if(!glfwInit()){
+        std::cerr << "Failed to initialize GLFW" << std::endl;
+        return 1;
+    }
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    GLFWwindow* window=glfwCreateWindow(64, 64, "bench_primitives", nullptr, nullptr);
+    if(!window){
+        std::cerr << "Failed to create a GL 4.3 context" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)){
+        std::cerr << "Failed to load the GL functions" << std::endl;
+        return 1;
+    }
+    std::cout << "Renderer: " << glGetString(GL_RENDERER) << std::endl;
+    std::cout << "Elements: " << nr_elements << " runs: " << nr_runs << std::endl;
+
+    bool all_correct=true;
+    {
+        std::mt19937 gen(0);
+        std::uniform_int_distribution<unsigned int> small_dist(0, 15);
+        std::uniform_int_distribution<unsigned int> key_dist;
+        std::vector<unsigned int> vals(nr_elements), flags(nr_elements), keys(nr_elements);
+        for(int i=0; i<nr_elements; i++){
+            vals[i]=small_dist(gen);
+            flags[i]= small_dist(gen)%3; //0, 1 or 2 so that compact sees non zero flags other than 1
+            keys[i]=key_dist(gen);
+        }
+        GLsizei bytes=nr_elements*sizeof(unsigned int);
+
+        gl::Primitives prims("bench");
+        gl::Buf in_buf("in"), out_buf("out"), flags_buf("flags"), count_buf("count"), keys_buf("keys");
+        in_buf.upload_data(GL_SHADER_STORAGE_BUFFER, bytes, vals.data(), GL_DYNAMIC_COPY);
+        out_buf.upload_data(GL_SHADER_STORAGE_BUFFER, bytes, NULL, GL_DYNAMIC_COPY);
+        flags_buf.upload_data(GL_SHADER_STORAGE_BUFFER, bytes, flags.data(), GL_DYNAMIC_COPY);
+        count_buf.upload_data(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int), NULL, GL_DYNAMIC_COPY);
+        keys_buf.upload_data(GL_SHADER_STORAGE_BUFFER, bytes, keys.data(), GL_DYNAMIC_COPY);
+
+        //exclusive scan
+        {
+            double ms=time_ms([&](){ prims.exclusive_scan(in_buf, out_buf, nr_elements); }, nr_runs);
+            std::vector<unsigned int> ref(nr_elements);
+            unsigned int sum=0;
+            for(int i=0; i<nr_elements; i++){
+                ref[i]=sum;
+                sum+=vals[i];
+            }
+            bool correct= download_uints(out_buf, nr_elements)==ref;
+            report("exclusive_scan", ms, nr_elements, correct);
+            all_correct&=correct;
+        }
+
+        //reduce
+        {
+            double ms=time_ms([&](){ prims.reduce(in_buf, nr_elements, gl::ReduceOp::Sum, gl::ReduceType::UInt, count_buf); }, nr_runs);
+            unsigned int ref=0;
+            for(int i=0; i<nr_elements; i++){
+                ref+=vals[i];
+            }
+            bool correct= download_uints(count_buf, 1)[0]==ref;
+            report("reduce_sum", ms, nr_elements, correct);
+            all_correct&=correct;
+        }
+
+        //compact
+        {
+            double ms=time_ms([&](){ prims.compact(in_buf, flags_buf, nr_elements, sizeof(unsigned int), out_buf, count_buf); }, nr_runs);
+            std::vector<unsigned int> ref;
+            for(int i=0; i<nr_elements; i++){
+                if(flags[i]!=0) ref.push_back(vals[i]);
+            }
+            unsigned int count=download_uints(count_buf, 1)[0];
+            bool correct= count==ref.size() && download_uints(out_buf, count)==ref;
+            report("compact", ms, nr_elements, correct);
+            all_correct&=correct;
+        }
+
+        //sort. It's in place so every run sorts fresh keys
+        {
+            double ms=time_ms([&](){
+                keys_buf.upload_sub_data(0, bytes, keys.data());
+                prims.sort(keys_buf, nr_elements);
+            }, nr_runs);
+            std::vector<unsigned int> ref=keys;
+            std::sort(ref.begin(), ref.end());
+            bool correct= download_uints(keys_buf, nr_elements)==ref;
+            report("sort", ms, nr_elements, correct);
+            all_correct&=correct;
+        }
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+
+    return all_correct? 0 : 1;
+}
@@ -19,6 +19,8 @@ message("EasyGL_ROOT" ${EasyGL_ROOT})
 
 
 ####   GLOBAL OPTIONS   ###https://stackoverflow.com/questions/15201064/cmake-conditional-preprocessor-define-on-code
+option(EASYGL_BUILD_BENCHMARKS "Build the headless benchmarks of the compute primitives" OFF)
+option(EASYGL_BUILD_TESTS "Build the tests that don't need a GL context and register them with ctest" OFF)
 
 
 ######   PACKAGES   ############################################################
@@ -58,12 +60,26 @@ endif()
 
 ###   SOURCES   #################################################################
 set(MY_SRC
+    ${EasyGL_ROOT}/src/BlockCompression.cxx
     ${EasyGL_ROOT}/src/Buf.cxx
+    ${EasyGL_ROOT}/src/BufArena.cxx
     ${EasyGL_ROOT}/src/CubeMap.cxx
+    ${EasyGL_ROOT}/src/GatherScatter.cxx
     ${EasyGL_ROOT}/src/GBuffer.cxx
+    ${EasyGL_ROOT}/src/MeshFile.cxx
+    ${EasyGL_ROOT}/src/PixelConversion.cxx
+    ${EasyGL_ROOT}/src/Primitives.cxx
+    ${EasyGL_ROOT}/src/ResourcePool.cxx
     ${EasyGL_ROOT}/src/Shader.cxx
+    ${EasyGL_ROOT}/src/StreamBuf.cxx
     ${EasyGL_ROOT}/src/Texture2D.cxx
+    ${EasyGL_ROOT}/src/TextureContainer.cxx
+    ${EasyGL_ROOT}/src/TextureStreamer.cxx
+    ${EasyGL_ROOT}/src/TextureView.cxx
+    ${EasyGL_ROOT}/src/TransientTexturePool.cxx
     ${EasyGL_ROOT}/src/VertexArrayObject.cxx
+    ${EasyGL_ROOT}/src/VertexPacking.cxx
+    ${EasyGL_ROOT}/src/VirtualTexture.cxx
 )
 
 
@@ -99,6 +115,16 @@ endif()
 
 ###   EXECUTABLE   #######################################
 # add_executable(run_easypbr ${PROJECT_SOURCE_DIR}/src/main.cxx  )
+#times scan, reduce, compact and sort and checks them against a cpu reference. Runs headless, also on llvmpipe
+if(EASYGL_BUILD_BENCHMARKS)
+    add_executable(bench_primitives ${EasyGL_ROOT}/bench/bench_primitives.cxx ${CMAKE_SOURCE_DIR}/deps/loguru/loguru.cpp )
+endif()
+#checks that the simd paths of the pixel conversion give the same results as the scalar ones
+if(EASYGL_BUILD_TESTS)
+    enable_testing()
+    add_executable(test_pixel_conversion ${EasyGL_ROOT}/tests/test_pixel_conversion.cxx ${CMAKE_SOURCE_DIR}/deps/loguru/loguru.cpp )
+    add_test(NAME test_pixel_conversion COMMAND test_pixel_conversion)
+endif()
 
 
 
@@ -137,6 +163,12 @@ set(LIBS ${LIBS} Eigen3::Eigen ${GLFW_LIBRARIES} ${OpenCV_LIBS}  )
 
 
 target_link_libraries(easygl_cpp PUBLIC ${LIBS} )
+if(EASYGL_BUILD_BENCHMARKS)
+    target_link_libraries(bench_primitives PRIVATE easygl_cpp )
+endif()
+if(EASYGL_BUILD_TESTS)
+    target_link_libraries(test_pixel_conversion PRIVATE easygl_cpp )
+endif()
 
 
 
@@ -0,0 +1,34 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+#include "opencv2/opencv.hpp"
+
+
+namespace gl{
+
+    //block compressed formats that compress_bc() can encode. All of them use blocks of 4x4 pixels
+    enum class BlockFormat{
+        BC1, //RGB in 8 bytes per block (S3TC DXT1). 8:1 compared to RGBA8
+        BC3, //RGBA in 16 bytes per block (S3TC DXT5). Alpha is stored like a BC4 block
+        BC4, //one channel in 8 bytes per block (RGTC1). Good for masks, roughness, height
+        BC5, //two channels in 16 bytes per block (RGTC2). Good for normal maps
+        BC7 //RGBA in 16 bytes per block (BPTC). Much better quality than BC1 and BC3. Our encoder only uses mode 6
+    };
+
+    GLenum block_format_gl_internal_format(const BlockFormat format, const bool srgb=false);
+    int block_format_block_size_bytes(const BlockFormat format);
+
+    //Encodes an 8 bit image with 1, 3 or 4 channels in opencv order (BGR). The blocks are split between nr_threads threads, 0 uses all the cores
+    //BC4 takes the first channel for gray images and the red one otherwise, BC5 takes red and green
+    //The encoders are fast range fits meant to run at load time, not offline quality compressors
+    std::vector<unsigned char> compress_bc(const cv::Mat& cv_mat, const BlockFormat format, const int nr_threads=0);
+    //same as above but from tightly packed RGBA8 pixels
+    std::vector<unsigned char> compress_bc_rgba(const unsigned char* rgba, const int width, const int height, const BlockFormat format, const int nr_threads=0);
+    //same as compress_bc() but the result is stored in cache_dir keyed by a hash of the pixels and the format, so next time the encoding is skipped
+    std::vector<unsigned char> compress_bc_cached(const cv::Mat& cv_mat, const BlockFormat format, const std::string& cache_dir, const int nr_threads=0);
+
+}
@@ -11,6 +11,7 @@
 
 #include <iostream>
 #include <vector>
+#include <memory>
 #include <cstring> //memcpy
 
 //forward declare
@@ -33,6 +34,36 @@ namespace c10{
 #define EGL_INVALID 2147483647
 
 namespace gl{
+    class BufDownload;
+
+    //how Buf::update() writes the data into the buffer
+    enum class BufUpdateStrategy{
+        Auto, //picked at every update from how the buffer was allocated and how it has been updated so far
+        SubData, //glBufferSubData, the driver does the syncronization and usually an extra copy
+        Orphan, //the whole buffer is rewritten so we orphan it and write into the fresh storage through glMapBufferRange with GL_MAP_INVALIDATE_BUFFER_BIT
+        SynchronizedMap, //glMapBufferRange with GL_MAP_INVALIDATE_RANGE_BIT, the driver waits for the gpu to finish with the buffer. For inmutable storage without GL_DYNAMIC_STORAGE_BIT when mark_gpu_use() is not called
+        UnsynchronizedMap, //glMapBufferRange with GL_MAP_UNSYNCHRONIZED_BIT after waiting for the fence of mark_gpu_use(). Without mark_gpu_use() it falls back to SynchronizedMap
+        Persistent //inmutable storage with GL_MAP_PERSISTENT_BIT which is mapped once and written with memcpy after waiting for the fence of mark_gpu_use(), so it needs mark_gpu_use() to be called
+    };
+
+    struct BufUpdateStats{
+        int nr_updates=0;
+        long long bytes_updated=0;
+        int nr_sub_data=0;
+        int nr_orphan=0;
+        int nr_synchronized_map=0;
+        int nr_unsynchronized_map=0;
+        int nr_persistent=0;
+        int nr_stalls=0; //times we had to wait for the gpu to finish with the buffer before writing. Only counted for the waits we do ourselves, not the ones of the driver
+        BufUpdateStrategy last_strategy=BufUpdateStrategy::Auto;
+    };
+
+    struct BufCopyRegion{
+        GLintptr src_offset=0;
+        GLintptr dst_offset=0;
+        GLsizeiptr size_bytes=0;
+    };
+
     class Buf{
     public:
         Buf();
@@ -42,9 +73,9 @@ namespace gl{
         //rule of five (make the class non copyable)
         Buf(const Buf& other) = delete; // copy ctor
         Buf& operator=(const Buf& other) = delete; // assignment op
-        // Use default move ctors.  You have to declare these, otherwise the class will not have automatically generated move ctors.
-        Buf (Buf && other) = default; //move ctor
-        Buf & operator=(Buf &&) = default; //move assignment
+        //the move ctors cannot be default because the buffer, the fence and the persistent mapping would end up being released twice
+        Buf (Buf && other); //move ctor
+        Buf & operator=(Buf && other); //move assignment
 
 
         void set_name(const std::string name);
@@ -71,20 +102,42 @@ namespace gl{
         void upload_data(const GLsizei size_bytes, const void* data_ptr, const GLenum usage_hints );
         //same as above but without specifying the target nor the usage hints
         void upload_data(const GLsizei size_bytes, const void* data_ptr );
+        //the upload_data functions only reallocate when the data doesn't fit in the capacity. Reserve lets you allocate the capacity upfront and keeps the contents like std::vector::reserve
+        void reserve(const GLsizei capacity_bytes);
+        void shrink_to_fit();
         void upload_sub_data(const GLenum target, const GLintptr offset, const GLsizei size_bytes, const void* data_ptr);
         //same without target
         void upload_sub_data(const GLintptr offset, const GLsizei size_bytes, const void* data_ptr);
         //same without target and with offset zero
         void upload_sub_data( const GLsizei size_bytes, const void* data_ptr);
+        //writes a range of the buffer choosing the cheapest way to do it (see BufUpdateStrategy). The buffer needs to have storage already and the range has to fit in it
+        void update(const GLintptr offset, const GLsizei size_bytes, const void* data_ptr);
+        //inserts a fence after the commands that read the buffer, for example after the draws of this frame. Once it signals update() can write without syncronization
+        void mark_gpu_use();
+        //by default the strategy is Auto. Forcing one that doesn't fit the storage (e.g. Persistent on a mutable buffer) is a fatal error at the next update
+        void set_update_strategy(const BufUpdateStrategy strategy);
+        BufUpdateStrategy update_strategy() const;
+        BufUpdateStats update_stats() const;
+        void reset_update_stats();
         void bind_for_modify(const GLint uniform_location);
         //allocate inmutable texture storage
         void allocate_inmutable( const GLenum target,  const GLsizei size_bytes, const void* data_ptr, const GLbitfield flags);
         //allocate inmutable texture storage (ASSUMES TARGET WAS SET BEFORE )
         void allocate_inmutable(const GLsizei size_bytes, const void* data_ptr, const GLbitfield flags);
 
+        //copies bytes from another buffer (or from another part of this one) without going through the cpu
+        void copy_from(const Buf& src, const GLintptr src_offset, const GLintptr dst_offset, const GLsizeiptr size_bytes);
+        //many copies from the same source, done in the given order. Consecutive regions that are contiguous in both buffers get merged into one copy
+        void copy_regions(const Buf& src, const std::vector<BufCopyRegion>& regions);
+
         //clear the dat assuming the buffer is composed of floats and only 1 per element
         void clear_to_float(const float val);
 
+        //maps a range of the buffer and returns a cpu pointer into it. For persistent mappings the storage has to be allocated with allocate_inmutable and the GL_MAP_PERSISTENT_BIT
+        //Until unmap() the buffer cannot be mapped again, so download(), map_range() and the update() strategies that map it are an error
+        void* map_range(const GLintptr offset, const GLsizeiptr size_bytes, const GLbitfield access);
+        void unmap();
+
 
         // #ifdef EASYPBR_WITH_TORCH
         void from_tensor(at::Tensor& tensor);
@@ -98,8 +151,10 @@ namespace gl{
         void unbind() const;
         GLenum type() const;
         GLenum target() const;
+        GLenum usage_hints() const;
         int buf_id() const;
         bool storage_initialized () const;
+        bool is_inmutable() const;
         void set_cpu_dirty(const bool dirty);
         void set_gpu_dirty(const bool dirty);
         bool is_cpu_dirty();
@@ -110,9 +165,14 @@ namespace gl{
         int width() const;
         int height() const;
         int depth() const;
-        int size_bytes();
+        int size_bytes() const;
+        int capacity_bytes() const; //bytes of storage actually allocated which can be more than size_bytes()
         //download from gpu to cpu
         void download(void* destination_data_ptr, const int bytes_to_copy);
+        //copies the bytes into an internal readback buffer and fences the copy without waiting for it. Check the returned handle with ready() a frame or two later to get the data without stalling the pipeline
+        BufDownload download_async(const GLintptr offset, const GLsizeiptr bytes) const;
+        //same as above but reuses the readback buffer of a previous download if it's big enough so we don't allocate a new one each time
+        void download_async(BufDownload& download, const GLintptr offset, const GLsizeiptr bytes) const;
 
 
     private:
@@ -133,6 +193,17 @@ namespace gl{
         GLenum m_target;
         GLenum m_usage_hints;
         GLsizei m_size_bytes;
+        GLsizei m_capacity_bytes; //allocated storage, at least m_size_bytes. It grows geometrically so that uploads which change size slightly don't reallocate each time
+        GLbitfield m_inmutable_flags; //flags given to glBufferStorage
+
+        //state for update()
+        BufUpdateStrategy m_update_strategy;
+        BufUpdateStats m_update_stats;
+        int m_nr_consecutive_full_updates;
+        GLsync m_gpu_use_fence; //fenced by mark_gpu_use()
+        bool m_gpu_use_tracked; //true if the user calls mark_gpu_use() so we know when the gpu is done with the buffer
+        void* m_persistent_ptr; //mapping of the whole storage for the Persistent strategy
+        bool m_is_mapped_by_caller; //mapped with map_range() by the user of the buffer, for example a StreamBuf, so nobody else can map it until unmap()
 
         //usefult for when you run algorithms on the buffer and we need to sometimes syncronize using sync()
         bool m_is_cpu_dirty; //the data changed on the gpu buffer, we need to do a download
@@ -143,7 +214,60 @@ namespace gl{
         bool m_cuda_transfer_enabled;
         struct cudaGraphicsResource *m_cuda_resource=nullptr;
 
+        void check_not_mapped_by_caller() const;
+        void release_persistent_mapping();
+        void move_from(Buf& other);
+        void upload_data_with_growth(const GLenum target, const GLsizei size_bytes, const void* data_ptr, const GLenum usage_hints);
+        void reallocate_keeping_contents(const GLsizei new_capacity_bytes, const GLenum usage_hints);
+        BufUpdateStrategy choose_update_strategy(const GLintptr offset, const GLsizei size_bytes);
+        bool is_gpu_done_with_buffer(); //checks the fence from mark_gpu_use() without waiting
+        void wait_for_gpu_use(); //waits for the fence from mark_gpu_use() and counts a stall if it wasn't signaled yet
+        void delete_gpu_use_fence();
+
+
+    };
+
+
+    //a sub range of a buffer. Used to bind only part of a buffer with glBindBufferRange or as the base offset for vertex attributes, for example for the allocations of a BufArena
+    struct BufRange{
+        const Buf* buf=nullptr;
+        GLintptr offset=0;
+        GLsizeiptr size_bytes=0;
+    };
+
+
+    //handle for the result of Buf::download_async(). It owns the readback buffer which is persistently mapped so once the fence is signaled the data can be read directly without any more copies
+    class BufDownload{
+    public:
+        BufDownload();
+        ~BufDownload();
+
+        //rule of five (make the class non copyable)
+        BufDownload(const BufDownload& other) = delete; // copy ctor
+        BufDownload& operator=(const BufDownload& other) = delete; // assignment op
+        //the move ctors cannot be default because the fence would end up being deleted twice
+        BufDownload (BufDownload && other); //move ctor
+        BufDownload & operator=(BufDownload && other); //move assignment
+
+        //returns true if the GPU finished the copy. Never blocks
+        bool ready();
+        //blocks until the GPU finished the copy
+        void wait();
+        //waits if needed and returns a pointer to the downloaded bytes. The pointer stays valid until the next download_async into this handle
+        const void* data();
+        GLsizeiptr size_bytes() const;
+        //true if a download was started into this handle
+        bool has_download() const;
+
+
+    private:
+        friend class Buf;
 
+        std::unique_ptr<Buf> m_readback_buf;
+        void* m_mapped_ptr;
+        GLsizeiptr m_size_bytes;
+        GLsync m_fence;
 
+        void delete_fence();
     };
 }
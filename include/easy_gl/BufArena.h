@@ -0,0 +1,89 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+
+#include "easy_gl/Buf.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    //Sub allocates many small ranges out of a few big buffers so that thousands of small meshes don't each need their own buffer object.
+    //allocate() returns an id which stays valid until free(). The actual BufRange for an id can change after defragment() so resolve it with range() before binding.
+    //Free space is tracked per block both by offset (for merging neighbouring free ranges) and by size (for a best fit search in log time).
+    class BufArena{
+    public:
+        BufArena();
+        BufArena(std::string name);
+        ~BufArena();
+
+        //rule of five (make the class non copyable)
+        BufArena(const BufArena& other) = delete; // copy ctor
+        BufArena& operator=(const BufArena& other) = delete; // assignment op
+        // Use default move ctors.  You have to declare these, otherwise the class will not have automatically generated move ctors.
+        BufArena (BufArena && other) = default; //move ctor
+        BufArena & operator=(BufArena &&) = default; //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+
+        //sets the target and the size of the blocks. Allocations bigger than a block get a block of their own
+        void init(const GLenum target, const GLsizeiptr block_size_bytes, const GLenum usage_hints=GL_STATIC_DRAW);
+        int allocate(const GLsizeiptr size_bytes);
+        void free(const int alloc_id);
+        BufRange range(const int alloc_id) const;
+        //uploads into the range of the allocation
+        void upload(const int alloc_id, const void* data_ptr, const GLsizeiptr size_bytes, const GLintptr offset_in_alloc=0);
+        //packs the allocations at the beginning of their blocks and releases the blocks that end up empty. Returns the nr of allocations that were moved.
+        //The blocks get recreated so any VAO or binding pointing into the arena has to be set again using range()
+        int defragment();
+
+        int nr_blocks() const;
+        int nr_allocations() const;
+        GLsizeiptr block_size_bytes() const;
+        GLsizeiptr allocated_bytes() const;
+        GLsizeiptr free_bytes() const;
+        Buf& block(const int block_idx);
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        struct Allocation{
+            int block_idx=-1;
+            GLintptr offset=0;
+            GLsizeiptr size_bytes=0; //already rounded up to the alignment
+            bool in_use=false;
+        };
+
+        struct Block{
+            std::unique_ptr<Buf> buf;
+            GLsizeiptr size_bytes=0;
+            std::map<GLintptr, GLsizeiptr> free_by_offset; //offset -> size of each free range
+            std::set< std::pair<GLsizeiptr, GLintptr> > free_by_size; //(size, offset) of each free range so we can do best fit with a lower_bound
+        };
+
+        GLenum m_target;
+        GLenum m_usage_hints;
+        GLsizeiptr m_block_size_bytes;
+        GLsizeiptr m_alignment;
+        std::vector<Block> m_blocks;
+        std::vector<Allocation> m_allocations;
+        std::vector<int> m_free_alloc_ids; //ids of allocations that were freed and can be reused
+
+        int create_block(const GLsizeiptr size_bytes);
+        void insert_free_range(Block& block, GLintptr offset, GLsizeiptr size_bytes); //also merges with the neighbours
+        void erase_free_range(Block& block, const GLintptr offset);
+        GLsizeiptr align(const GLsizeiptr size_bytes) const;
+
+    };
+}
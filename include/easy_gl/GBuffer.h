@@ -48,6 +48,8 @@ namespace gl{
         bool is_initialized();
         int attachment_nr(const std::string tex_name) const;
         Texture2D& tex_with_name(const std::string name);
+        //builds the hierarchical depth pyramid of the depth texture into hiz, see Texture2D::generate_hiz_from_depth()
+        void build_hiz(Texture2D& hiz, const TexMipOp op=TexMipOp::Max);
 
         bool has_tex_with_name(const std::string name);
 
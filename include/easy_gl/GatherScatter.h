@@ -0,0 +1,49 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <memory>
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Shader.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    //Reorders elements between buffers with a compute shader driven by a buffer of uint32 indices, so compacting or permuting point data never goes through the cpu.
+    //The buffers can have any target, they get bound as shader storage buffers. Elements are moved as whole words so their size has to be a multiple of 4 bytes. Indices that fall outside of the buffers are skipped.
+    class GatherScatter{
+    public:
+        GatherScatter();
+        GatherScatter(std::string name);
+        ~GatherScatter();
+
+        //rule of five (make the class non copyable)
+        GatherScatter(const GatherScatter& other) = delete; // copy ctor
+        GatherScatter& operator=(const GatherScatter& other) = delete; // assignment op
+        // Use default move ctors.  You have to declare these, otherwise the class will not have automatically generated move ctors.
+        GatherScatter (GatherScatter && other) = default; //move ctor
+        GatherScatter & operator=(GatherScatter &&) = default; //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+
+        //dst[i]=src[indices[i]]. With nr_indices=-1 the whole index buffer is used
+        void gather(const Buf& src, const Buf& indices, Buf& dst, const int element_size_bytes, const int nr_indices=-1);
+        //dst[indices[i]]=src[i]. If two indices are the same it is undefined which element ends up there
+        void scatter(const Buf& src, const Buf& indices, Buf& dst, const int element_size_bytes, const int nr_indices=-1);
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        std::unique_ptr<Shader> m_shader; //compiled the first time it's needed
+
+        void run(const Buf& src, const Buf& indices, Buf& dst, const int element_size_bytes, const int nr_indices, const bool is_scatter);
+    };
+}
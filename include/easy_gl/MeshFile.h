@@ -0,0 +1,123 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Shader.h"
+#include "easy_gl/VertexArrayObject.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    //On disk layout (little endian, as written by the machine):
+    //  MeshFileHeader
+    //  MeshFileAttribute * nr_attributes
+    //  the blob of each attribute and of the indices, each starting at a multiple of EGL_MESH_FILE_ALIGNMENT
+    //The blobs are exactly what the gpu wants in the buffer so they can be given to glBufferStorage straight from the mapped file.
+    #define EGL_MESH_FILE_MAGIC "EGLMESH"
+    #define EGL_MESH_FILE_VERSION 1
+    #define EGL_MESH_FILE_ALIGNMENT 64
+
+    struct MeshFileHeader{
+        char magic[8];
+        uint32_t version;
+        uint32_t nr_attributes;
+        uint64_t nr_vertices;
+        uint32_t index_gl_type; //GL_UNSIGNED_INT, GL_UNSIGNED_SHORT, GL_UNSIGNED_BYTE or 0 if there are no indices
+        uint32_t padding;
+        uint64_t index_offset;
+        uint64_t index_size_bytes;
+    };
+    static_assert(sizeof(MeshFileHeader)==48, "MeshFileHeader should have no padding so it's the same on all compilers");
+
+    struct MeshFileAttribute{
+        char name[48]; //name of the attribute in the shader, null terminated
+        uint32_t gl_type;
+        uint32_t nr_components;
+        uint32_t normalized;
+        uint32_t is_integer;
+        uint64_t offset; //from the start of the file
+        uint64_t size_bytes;
+    };
+    static_assert(sizeof(MeshFileAttribute)==80, "MeshFileAttribute should have no padding so it's the same on all compilers");
+
+
+    //Reads and writes meshes in a binary layout that needs no parsing. open() mmaps the file and upload() gives the mapped blobs directly to glBufferStorage so the only copy is the one the driver does into gpu memory.
+    //Writing: add_attribute() and set_indices() keep pointers to the data of the caller which has to stay alive until write().
+    class MeshFile{
+    public:
+        MeshFile();
+        MeshFile(std::string name);
+        ~MeshFile();
+
+        //rule of five (make the class non copyable)
+        MeshFile(const MeshFile& other) = delete; // copy ctor
+        MeshFile& operator=(const MeshFile& other) = delete; // assignment op
+        //the move ctors cannot be default because the file would end up being unmapped twice
+        MeshFile (MeshFile && other); //move ctor
+        MeshFile & operator=(MeshFile && other); //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+
+        //writing
+        void add_attribute(const std::string& attrib_name, const GLenum gl_type, const int nr_components, const void* data_ptr, const size_t size_bytes, const bool normalized=false, const bool is_integer=false);
+        void set_indices(const GLenum gl_type, const void* data_ptr, const size_t size_bytes);
+        void write(const std::string& path) const;
+
+        //reading
+        void open(const std::string& path);
+        //releases the mapping. The buffers created by upload() and the descriptions of the attributes stay valid
+        void close();
+        bool is_open() const;
+        int nr_attributes() const;
+        const MeshFileAttribute& attribute(const int idx) const;
+        int attribute_idx(const std::string& attrib_name) const; //-1 if the file doesn't have it
+        const void* attribute_data(const int idx) const; //only while the file is open
+        size_t nr_vertices() const;
+        bool has_indices() const;
+        GLenum index_type() const;
+        size_t nr_indices() const;
+        const void* index_data() const;
+
+        //creates one inmutable buffer per attribute (and one for the indices) straight from the mapped file. Pass GL_DYNAMIC_STORAGE_BIT or map flags if the buffers need to be modified later
+        //Empty attributes get a buffer without storage and empty indices get no index buffer
+        void upload(const GLbitfield storage_flags=0);
+        //sets up all the attributes of the file that the shader uses, with the type and nr of components stored in the header, and binds the indices
+        void setup_vao(const gl::Shader& prog, gl::VertexArrayObject& vao) const;
+        Buf& buf(const std::string& attrib_name);
+        Buf& index_buf();
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        //for writing
+        struct PendingBlob{
+            MeshFileAttribute desc;
+            const void* data_ptr=nullptr;
+        };
+        std::vector<PendingBlob> m_pending_attributes;
+        PendingBlob m_pending_indices;
+
+        //for reading
+        unsigned char* m_mapped_ptr;
+        size_t m_mapped_size_bytes;
+        //copies of the header so they are still there after close()
+        MeshFileHeader m_header;
+        std::vector<MeshFileAttribute> m_attributes;
+        std::vector< std::unique_ptr<Buf> > m_bufs; //one per attribute, filled by upload()
+        std::unique_ptr<Buf> m_index_buf;
+
+        void check_blob(const uint64_t offset, const uint64_t size_bytes, const std::string& what) const;
+    };
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+
+
+namespace gl{
+
+    //depth of one channel of a pixel in client memory
+    enum class PixelDepth{
+        U8, //GL_UNSIGNED_BYTE, read and written as normalized to [0,1]
+        F16, //GL_HALF_FLOAT, only as destination
+        F32 //GL_FLOAT
+    };
+
+    GLenum pixel_depth_gl_type(const PixelDepth depth);
+    int pixel_depth_size_bytes(const PixelDepth depth);
+
+    //Converts an image in a single pass, for example from a cv::Mat straight into a mapped pbo, so the driver doesn't have to do it on its slow paths
+    //  - the channels stay the same or 3 get padded to 4 with an alpha of 1 (255 for U8). Drivers store RGB textures as RGBA anyway
+    //  - swap_red_blue swaps the first and third channel, for the BGR order of opencv
+    //  - the values are multiplied by scale in float. U8 sources are first divided by 255 and U8 destinations are multiplied by 255, clamped and rounded
+    //The rows get split between a small pool of threads for big images. Uses SSSE3, AVX2 and F16C on x86 or NEON on arm when the cpu has them
+    //src and dst can be the same memory if both have the same layout and depth
+    void convert_pixels(const void* src, const size_t src_row_stride_bytes, const int src_channels, const PixelDepth src_depth,
+                        void* dst, const size_t dst_row_stride_bytes, const int dst_channels, const PixelDepth dst_depth,
+                        const int width, const int height, const bool swap_red_blue, const float scale=1.0f);
+
+    //threads used by convert_pixels, including the calling one. By default all the cores. 1 does everything in the calling thread
+    //Call it at startup, not while other threads are converting
+    void set_pixel_conversion_nr_threads(const int nr_threads);
+    int pixel_conversion_nr_threads();
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Shader.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    enum class ReduceOp{
+        Sum,
+        Min,
+        Max
+    };
+
+    enum class ReduceType{
+        UInt,
+        Int,
+        Float
+    };
+
+    //Parallel building blocks that run as compute shaders over the contents of Bufs so the results never need to come back to the cpu.
+    //The kernels only use shared memory and barriers (no subgroup operations) and the copies between buffers go through glCopyBufferSubData, so they run on any GL 4.3 implementation, including Mesa llvmpipe.
+    //All of them take the nr of elements to process from the start of the buffers. The buffers can have any target, they are bound as shader storage buffers.
+    //Scratch buffers and the compiled kernels are kept inside the object and reused between calls so keep one around instead of creating it every frame.
+    class Primitives{
+    public:
+        Primitives();
+        Primitives(std::string name);
+        ~Primitives();
+
+        //rule of five (make the class non copyable)
+        Primitives(const Primitives& other) = delete; // copy ctor
+        Primitives& operator=(const Primitives& other) = delete; // assignment op
+        // Use default move ctors.  You have to declare these, otherwise the class will not have automatically generated move ctors.
+        Primitives (Primitives && other) = default; //move ctor
+        Primitives & operator=(Primitives &&) = default; //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+
+        //prefix sum over uint32 values. in and out can be the same buffer
+        void exclusive_scan(const Buf& in, Buf& out, const int nr_elements);
+        void inclusive_scan(const Buf& in, Buf& out, const int nr_elements);
+        //reduces the values of in and writes the single result into out at out_offset (in bytes)
+        void reduce(const Buf& in, const int nr_elements, const ReduceOp op, const ReduceType type, Buf& out, const GLintptr out_offset=0);
+        //copies the elements of in whose uint32 flag is not zero to the beginning of out, keeping their order. The nr of elements written goes as a uint32 into count at count_offset (in bytes)
+        void compact(const Buf& in, const Buf& flags, const int nr_elements, const int element_size_bytes, Buf& out, Buf& count, const GLintptr count_offset=0);
+        //stable LSD radix sort of uint32 keys in place. If the keys only use the lower bits, nr_key_bits can be lowered to save passes
+        //Floats can be sorted by first mapping them to uint with the usual trick of flipping all the bits of negatives and only the sign bit of positives
+        void sort(Buf& keys, const int nr_elements, const int nr_key_bits=32);
+        //same as above but the uint32 values get reordered together with their keys
+        void sort_by_key(Buf& keys, Buf& values, const int nr_elements, const int nr_key_bits=32);
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        std::map<std::string, std::unique_ptr<Shader> > m_kernels; //compiled the first time they are needed. Keyed by name and defines
+        std::vector< std::unique_ptr<Buf> > m_scan_block_sums; //one per level of the recursive scan
+        std::unique_ptr<Buf> m_reduce_partials[2];
+        std::unique_ptr<Buf> m_compact_positions;
+        std::unique_ptr<Buf> m_sort_keys;
+        std::unique_ptr<Buf> m_sort_values;
+        std::unique_ptr<Buf> m_sort_block_hist;
+
+        Shader& kernel(const std::string& kernel_name, const char* src, const std::string& defines="");
+        Buf& scratch(std::unique_ptr<Buf>& buf, const GLsizei size_bytes, const std::string& scratch_name);
+        void scan(const Buf& in, Buf& out, const int nr_elements, const bool inclusive, const int level);
+        void radix_sort(Buf& keys, Buf* values, const int nr_elements, const int nr_key_bits);
+    };
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <memory>
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Texture2D.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    struct ResourcePoolStats{
+        int buf_hits=0;
+        int buf_misses=0;
+        int tex_hits=0;
+        int tex_misses=0;
+        int nr_pooled_bufs=0; //objects currently sitting in the pool waiting to be reused
+        int nr_pooled_textures=0;
+        long long pooled_bytes=0;
+    };
+
+    //Recycles temporary buffers and textures so that processing steps which create and destroy them every frame don't pay each time for the glGen*, the storage allocation and for textures also the pbos and fbo.
+    //Released objects go into buckets keyed by (target, size, usage) for buffers and (internal_format, format, type, width, height, mips) for textures. Buffers sizes are rounded to powers of two so that similar sizes can share a bucket, except the ones above 1GB which only get reused for the exact same size.
+    //Objects come back with the contents and the parameters (wrap mode, filtering etc) from their previous user.
+    class ResourcePool{
+    public:
+        ResourcePool();
+        ResourcePool(std::string name);
+        ~ResourcePool();
+
+        //rule of five (make the class non copyable)
+        ResourcePool(const ResourcePool& other) = delete; // copy ctor
+        ResourcePool& operator=(const ResourcePool& other) = delete; // assignment op
+        // Use default move ctors.  You have to declare these, otherwise the class will not have automatically generated move ctors.
+        ResourcePool (ResourcePool && other) = default; //move ctor
+        ResourcePool & operator=(ResourcePool &&) = default; //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+        //how many objects we keep in each bucket, the ones released above that are destroyed
+        void set_max_pooled_per_bucket(const int max_pooled);
+
+        //returns a buffer with size_bytes() equal to the requested size and a capacity of at least that
+        std::unique_ptr<Buf> acquire_buf(const GLenum target, const GLsizei size_bytes, const GLenum usage_hints);
+        void release_buf(std::unique_ptr<Buf> buf);
+        std::unique_ptr<Texture2D> acquire_texture(const GLint internal_format, const GLenum format, const GLenum type, const int width, const int height, const int nr_mips=1);
+        void release_texture(std::unique_ptr<Texture2D> tex);
+
+        //destroys all the pooled objects
+        void clear();
+        ResourcePoolStats stats() const;
+        void reset_stats();
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        typedef std::tuple<GLenum, GLsizei, GLenum> BufKey; //target, size, usage
+        typedef std::tuple<GLint, GLenum, GLenum, int, int, int> TexKey; //internal_format, format, type, width, height, nr_mips
+
+        std::map<BufKey, std::vector< std::unique_ptr<Buf> > > m_buf_buckets;
+        std::map<TexKey, std::vector< std::unique_ptr<Texture2D> > > m_tex_buckets;
+        int m_max_pooled_per_bucket;
+        ResourcePoolStats m_stats;
+
+        long long texture_bytes(Texture2D& tex) const;
+
+    };
+}
@@ -13,6 +13,7 @@
 #include "easy_gl/Buf.h"
 #include "easy_gl/GBuffer.h"
 #include "easy_gl/CubeMap.h"
+#include "easy_gl/TextureView.h"
 
 #include <iostream>
 
@@ -40,6 +41,9 @@ namespace gl{
         void compile(const std::string &compute_shader_filename);
         void compile(const std::string &vertex_shader_filename, const std::string &fragment_shader_filename);
         void compile(const std::string &vertex_shader_filename, const std::string &fragment_shader_filename, const std::string &geom_shader_filename);
+        //same as above but from the source code instead of a file. Useful for shaders that are part of the library
+        void compile_from_source(const std::string &compute_shader_src);
+        void compile_from_source(const std::string &vertex_shader_src, const std::string &fragment_shader_src);
 
 
         void use() const;
@@ -47,7 +51,9 @@ namespace gl{
         template <class T>
         void bind_texture(const T& tex, const std::string& uniform_name);
         //bind with a certain access mode a 2D image
-        void bind_image(const gl::Texture2D& tex, const GLenum access, const std::string& uniform_name);
+        void bind_image(const gl::Texture2D& tex, const GLenum access, const std::string& uniform_name, const int lvl=0);
+        //bind the first mip of the view, which can be any mip of the original texture
+        void bind_image(const gl::TextureView& view, const GLenum access, const std::string& uniform_name);
         //bind all layers of the Texture Array
         // void bind_image(const gl::Texture2DArray& tex,  const GLenum access, const std::string& uniform_name);
         // //binding a Texture array but binds a specific layer
@@ -56,6 +62,10 @@ namespace gl{
         // void bind_image(const gl::Texture3D& tex,  const GLenum access, const std::string& uniform_name);
         //bind a buffer
         void bind_buffer(const gl::Buf& buf, const std::string& uniform_name);
+        //bind to a different target than the one of the buffer, for example a vertex buffer as GL_SHADER_STORAGE_BUFFER for a compute shader
+        void bind_buffer(const gl::Buf& buf, const GLenum target, const std::string& uniform_name);
+        //bind only a range of a buffer with glBindBufferRange, for example an allocation of a BufArena. Target is GL_SHADER_STORAGE_BUFFER or GL_UNIFORM_BUFFER
+        void bind_buffer(const gl::BufRange& range, const GLenum target, const std::string& uniform_name);
 
         GLint get_attrib_location(const std::string attrib_name) const;
 
@@ -95,13 +105,19 @@ namespace gl{
         bool m_is_compute_shader;
         int m_nr_texture_units_used;
         int m_nr_image_units_used;
+        int m_nr_buffer_binding_points_used;
         int m_max_allowed_texture_units;
         int m_max_allowed_image_units;
+        int m_max_allowed_buffer_binding_points;
 
         std::unordered_map<std::string, int > tex_sampler2texture_units;
         std::unordered_map<std::string, int > image2image_units;
+        std::unordered_map<std::string, int > buffer2binding_points; //the block of each name is pointed to its binding point only once
 
         std::string named(const std::string msg) const;
+        //gets the binding point for a buffer block and points the block in the shader towards it
+        int buffer_binding_point(const std::string& block_name);
+        void bind_buffer_used_bytes(const GLenum target, const int binding_point, const gl::Buf& buf) const;
 
 
         //for compute shaders
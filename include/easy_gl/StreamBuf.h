@@ -0,0 +1,78 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+
+#include "easy_gl/Buf.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    //chunk of a StreamBuf handed out by reserve(). Write directly into cpu_ptr and use gpu_offset as the offset for glVertexAttribPointer, glBindBufferRange, glDrawElements etc.
+    struct StreamBufRange{
+        void* cpu_ptr=nullptr;
+        GLintptr gpu_offset=0;
+        GLsizeiptr size_bytes=0;
+    };
+
+    //Streaming ring buffer for data that changes every frame. The storage is allocated once as inmutable, persistent and coherent and is split into nr_regions regions.
+    //Each frame writes into one region and once all the draws that read from it are issued you call advance_region() which fences it and moves on to the next one. We only wait if the GPU is still reading the region we want to reuse.
+    //More info in https://www.khronos.org/opengl/wiki/Buffer_Object_Streaming#Persistent_mapping
+    class StreamBuf{
+    public:
+        StreamBuf();
+        StreamBuf(std::string name);
+        ~StreamBuf();
+
+        //rule of five (make the class non copyable)
+        StreamBuf(const StreamBuf& other) = delete; // copy ctor
+        StreamBuf& operator=(const StreamBuf& other) = delete; // assignment op
+        // Use default move ctors.  You have to declare these, otherwise the class will not have automatically generated move ctors.
+        StreamBuf (StreamBuf && other) = default; //move ctor
+        StreamBuf & operator=(StreamBuf &&) = default; //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+
+        //allocates nr_regions*region_size_bytes of persistently mapped storage. Can only be called once because the storage is inmutable
+        void allocate(const GLenum target, const GLsizeiptr region_size_bytes, const int nr_regions=3);
+        //returns a chunk of at least bytes from the current region, aligned to the offset alignment required by the target
+        StreamBufRange reserve(const GLsizeiptr bytes);
+        //same as reserve but also copies the data into the chunk
+        StreamBufRange push(const void* data_ptr, const GLsizeiptr bytes);
+        //fences the current region and moves to the next one. Call it once per frame after issuing all the draws that read from the current region
+        void advance_region();
+
+        void bind() const;
+        const Buf& buf() const;
+        Buf& buf();
+        bool storage_initialized() const;
+        int nr_regions() const;
+        GLsizeiptr region_size_bytes() const;
+        GLsizeiptr region_used_bytes() const;
+        int cur_region_idx() const;
+        int nr_stalls() const; //how many times advance_region() had to wait for the GPU to finish reading a region
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        Buf m_buf;
+        unsigned char* m_mapped_ptr;
+        GLsizeiptr m_region_size_bytes;
+        GLsizeiptr m_alignment;
+        GLsizeiptr m_head; //offset inside the current region of the next free byte
+        int m_cur_region_idx;
+        int m_nr_stalls;
+        std::vector<GLsync> m_region_fences; //one fence for each region, set when we are finished writing to it and the GPU starts reading
+
+        void wait_for_region(const int region_idx);
+
+    };
+}
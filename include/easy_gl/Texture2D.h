@@ -9,11 +9,16 @@
 // #endif
 
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 
 #include "opencv2/opencv.hpp"
 
 // #include "easy_gl/UtilsGL.h"
 #include "easy_gl/Buf.h"
+#include "easy_gl/PixelConversion.h"
+#include "easy_gl/TextureView.h"
 
 //forward declare
 struct cudaGraphicsResource;
@@ -32,6 +37,50 @@ namespace at{
 #define EGL_INVALID 2147483647
 
 namespace gl{
+
+    class Shader;
+    class Primitives;
+
+    //reductions over one channel of a texture done on the gpu by Texture2D::reduce()
+    enum class TexReduceOp{
+        Min,
+        Max,
+        Sum,
+        Mean
+    };
+
+    //how Texture2D::generate_mipmap_compute() combines the texels of a level into one texel of the next one
+    enum class TexMipOp{
+        Average,
+        Min,
+        Max
+    };
+
+    struct TexMipReduction{
+        TexMipOp ops[4]={TexMipOp::Average, TexMipOp::Average, TexMipOp::Average, TexMipOp::Average}; //one per channel
+        //if not empty it replaces ops. Glsl source of "vec4 mip_reduce(vec4 a, vec4 b)" which has to be associative and commutative, for example max(abs(a),abs(b))
+        std::string custom_glsl;
+    };
+
+    //what Texture2D::download_into() does on the gpu before the pixels are copied back
+    struct TexDownloadConversion{
+        int lvl=0;
+        int width=0; //size of the result. 0 keeps the size of the level, anything else is resampled with bilinear filtering
+        int height=0;
+        bool flip_y=false; //the last row of the texture becomes the first one, the way images are stored on the cpu
+        int nr_channels=4; //of the result
+        int channels[4]={0,1,2,3}; //channel of the texture that goes into each channel of the result. -1 writes 0 and -2 writes 1, so {2,1,0,-2} gives BGRA with an opaque alpha
+        PixelDepth depth=PixelDepth::U8; //U8 clamps to [0,1] and writes [0,255]
+        float scale=1.0f; //multiplies the values before they are written
+    };
+
+    //shared with the worker of TextureStreamer so it can tell if the storage of level 0 went away or got reallocated after an upload was scheduled. The worker holds the mutex during the transfer so neither can happen in the middle of it
+    struct TextureStorageGuard{
+        std::mutex mutex;
+        bool alive=true; //false once the texture is destroyed
+        int generation=0; //incremented every time the storage of level 0 gets reallocated
+    };
+
     class Texture2D{
     public:
         Texture2D();
@@ -42,8 +91,9 @@ namespace gl{
         Texture2D(const Texture2D& other) = delete; // copy ctor
         Texture2D& operator=(const Texture2D& other) = delete; // assignment op
         // Use default move ctors.  You have to declare these, otherwise the class will not have automatically generated move ctors.
-        Texture2D (Texture2D && other) = default; //move ctor
-        Texture2D & operator=(Texture2D &&) = default; //move assignment
+        //They are defaulted in the cxx because the kernels are only forward declared here
+        Texture2D (Texture2D && other); //move ctor
+        Texture2D & operator=(Texture2D &&); //move assignment
 
 
 
@@ -64,9 +114,27 @@ namespace gl{
         void upload_data(GLint internal_format, GLenum format, GLenum type, GLsizei width, GLsizei height,  const void* data_ptr, int size_bytes);
 
 
+        //uploads only the rects of src that changed. src is the full image in the format and type of the texture with rows of src_row_stride_bytes. The rects get packed one after another into a single pbo so the bandwidth depends only on the area that changed
+        void upload_regions(const std::vector<cv::Rect>& rects, const void* src, const int src_row_stride_bytes);
+
+        //uploads data that is already block compressed (BC1-BC7), for example from compress_bc(). The width and height are the ones of level 0
+        //The first call allocates inmutable storage with nr_levels mips, the other levels can then be uploaded with more calls
+        void upload_compressed(GLenum internal_format, GLsizei width, GLsizei height, const void* data_ptr, int size_bytes, const int lvl=0, const int nr_levels=1);
+
+        //uploads one mip level of an already allocated storage, for example mips that were precomputed offline. The data is in the format and type of the texture with tightly packed rows
+        void upload_level(const int lvl, const void* data_ptr, int size_bytes);
+
+        //zero copy upload. Returns a pointer into a persistently mapped pbo where the caller writes width*height pixels with tightly packed rows (no row alignment), for example directly from a decoder
+        //commit_upload_slot() then transfers the pbo into the texture. The pbos go around the same ring as upload_data() so the GPU has nr_pbos_upload() uploads worth of time to read one before we write it again
+        void* map_upload_slot(GLint internal_format, GLenum format, GLenum type, GLsizei width, GLsizei height);
+        void commit_upload_slot();
+
         //easy way to just get a cv mat there, does internally an upload to pbo and schedules a dma
         //by default the values will get transfered to the gpu and get normalized to [0,1] therefore an rgb texture of unsigned bytes will be read as floats from the shader with sampler2D. However sometimes we might want to use directly the integers stored there, for example when we have a semantic texture and the nr range from [0,nr_classes]. Then we set normalize to false and in the shader we acces the texture with usampler2D
         void upload_from_cv_mat(const cv::Mat& cv_mat, const bool flip_red_blue=true, const bool store_as_normalized_vals=true);
+        //uploads into a texture of the given internal format converting on the cpu while copying into the pbo, so 8 bit images can go into R*16F or R*32F textures and float ones into R*8 or R*16F
+        //The internal format needs the same nr of channels as the mat
+        void upload_from_cv_mat_to_format(const cv::Mat& cv_mat, const GLint internal_format, const bool flip_red_blue=true);
 
 
         // void upload_without_pbo(GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* data_ptr){
@@ -88,7 +156,16 @@ namespace gl{
 
 
         //allocate inmutable texture storage
-        void allocate_storage_inmutable(GLenum internal_format, GLenum format, GLenum type, GLsizei width, GLsizei height);
+        //nr_levels is the nr of mip levels to allocate. Use mipmap_nr_lvls_for_size() for the full chain
+        void allocate_storage_inmutable(GLenum internal_format, GLenum format, GLenum type, GLsizei width, GLsizei height, const int nr_levels=1);
+
+        //progressive upload of big images. Allocates the full mip chain as inmutable storage and uploads the smallest mips right away so the texture can be used inmediatelly
+        //Every call to upload_next_progressive_level() then uploads the next finer level and moves GL_TEXTURE_BASE_LEVEL to it so the sampling never reads a level that is not uploaded yet
+        void begin_progressive_upload(const cv::Mat& cv_mat, const bool flip_red_blue=true, const bool store_as_normalized_vals=true, const int max_initial_level_size=64);
+        //returns true while there are levels left to upload
+        bool upload_next_progressive_level();
+        bool progressive_upload_done() const;
+        int finest_resident_lvl() const; //the current GL_TEXTURE_BASE_LEVEL
 
         void allocate_or_resize(GLenum internal_format, GLenum format, GLenum type, GLsizei width, GLsizei height);
 
@@ -173,10 +250,19 @@ namespace gl{
         //transfers data from the texture into a pbo. Useful for later reading the pbo with download_from_oldest_pbo() and transfering to cpu without stalling the pipeline
         void download_to_pbo();
 
+        //copies the oldest pbo into data_out. If the GPU didn't finish writing it yet it waits for it
         void download_from_oldest_pbo(void* data_out);
+        //same as above but never waits. Returns false if the oldest pbo has no new data or the GPU is still writing it. Each transfer done by download_to_pbo() is returned only once
+        bool try_download_from_oldest_pbo(void* data_out);
 
         Buf& cur_pbo_download();
 
+        //nr of pbos in the rings used by upload_data() and download_to_pbo(). More pbos give the GPU more frames to finish a transfer before we need the pbo again, at the cost of more latency and memory. Changing it drops the pbos and any download still in them
+        void set_nr_pbos_upload(const int nr_pbos);
+        void set_nr_pbos_download(const int nr_pbos);
+        int nr_pbos_upload() const;
+        int nr_pbos_download() const;
+
 
 
         //clears the texture to zero
@@ -200,20 +286,52 @@ namespace gl{
 
         void copy_from_tex(Texture2D& other_tex, const int level=0); //following https://stackoverflow.com/a/23994979 seems that glCopyTexSubImage2D is one of the fastest ways to copy
 
+        //reduces one channel of a mip level on the gpu and writes the result as a float into out at out_offset (in bytes). Nothing comes back to the cpu so it can be used directly by other shaders, for example the max depth or the mean luminance for exposure
+        //Works for float and normalized formats and for depth textures, not for integer ones
+        void reduce(const TexReduceOp op, const int channel, Buf& out, const GLintptr out_offset=0, const int lvl=0);
+        //same as above but the result goes into a small internal buffer which is downloaded asynchronously. Once download.ready() read it with *(const float*)download.data()
+        BufDownload reduce_async(const TexReduceOp op, const int channel, const int lvl=0);
+        //same as above but reuses the readback buffer of a previous download
+        void reduce_async(BufDownload& download, const TexReduceOp op, const int channel, const int lvl=0);
+
+        //converts a mip level on the gpu with a compute pass (scale, flip, swizzle, resize and change of depth) and writes it into out with rows of download_row_stride_bytes(). Nothing comes back to the cpu
+        void convert_for_download(Buf& out, const TexDownloadConversion& conversion=TexDownloadConversion());
+        //rows of the converted pixels are padded to 4 bytes
+        int download_row_stride_bytes(const TexDownloadConversion& conversion=TexDownloadConversion()) const;
+        //converts and starts the readback into download without waiting for it
+        void download_into_async(BufDownload& download, const TexDownloadConversion& conversion=TexDownloadConversion());
+        //converts and copies the result into dst which has rows of row_stride_bytes. Once the internal buffers have grown to the size needed there are no more allocations, neither on the cpu nor on the gpu, and only the bytes of the result are transfered
+        void download_into(void* dst, const size_t row_stride_bytes, const TexDownloadConversion& conversion=TexDownloadConversion());
+
+        //another texture object that shares the storage of this one, seen as internal_format and with nr_mips mips starting at base_mip. Nothing is copied. Needs inmutable storage and an internal format of the same compatibility class, see TextureView::formats_compatible()
+        TextureView make_view(const GLint internal_format, const int base_mip=0, const int nr_mips=1) const;
+
         void generate_mipmap(const int idx_max_lvl);
 
         //creates the full chain of mip map, up until the smallest possible texture
         void generate_mipmap_full();
 
+        //same as generate_mipmap() but with a compute shader that writes up to 12 levels in a single dispatch, and with a reduction per channel instead of only the average. The filter modes are left as they are
+        //Needs an internal format that can be bound as an image, so RGBA instead of RGB and no depth or srgb. Missing levels are allocated for mutable textures, inmutable ones need to have them already
+        //Min, Max and custom reductions cover the whole level also for odd sizes, which costs a new dispatch after every level with an odd size
+        void generate_mipmap_compute(const int idx_max_lvl, const TexMipReduction& reduction=TexMipReduction());
+        void generate_mipmap_compute_full(const TexMipReduction& reduction=TexMipReduction());
+        //builds a hierarchical depth pyramid for occlusion culling out of a depth texture, for example the one of a GBuffer. This texture becomes R32F with the full mip chain and the size of the power of two below the one of depth
+        //so that every texel of a level covers exactly 2x2 texels of the previous one and every texel of level 0 covers all the depth texels under it. Max keeps the farthest depth, use Min for reversed z
+        void generate_hiz_from_depth(const Texture2D& depth, const TexMipOp op=TexMipOp::Max);
+
 
         void bind() const;
 
         void unbind() const;
 
         int tex_id() const;
+        std::shared_ptr<TextureStorageGuard> storage_guard() const;
 
         bool storage_initialized () const;
 
+        bool storage_inmutable() const;
+
         GLint internal_format() const;
 
         GLenum format() const;
@@ -237,6 +355,7 @@ namespace gl{
         //return maximum number of mip map lvls, effectivelly it is mipmap_highest_idx+1
         int mipmap_nr_lvls() const;
         int mipmap_nr_levels_allocated() const;
+        static int mipmap_nr_lvls_for_size(const int width, const int height);
 
 
     private:
@@ -249,6 +368,8 @@ namespace gl{
         GLuint m_tex_id;
         bool m_tex_storage_initialized;
         bool m_tex_storage_inmutable;
+        std::shared_ptr<TextureStorageGuard> m_storage_guard;
+        void storage_changed(); //lets the pending streamed uploads know that they cannot write into the texture anymore
         GLint m_internal_format;
         GLenum m_format;
         GLenum m_type;
@@ -258,13 +379,55 @@ namespace gl{
         int m_nr_pbos_upload;
         int m_cur_pbo_upload_idx; //index into the pbo that we will use for uploading
         std::vector<gl::Buf> m_pbos_upload;
+        std::vector<GLsync> m_pbos_upload_fences; //signaled when the GPU finished reading the pbo into the texture
+
+        //persistently mapped pbos for map_upload_slot(). Allocated only when needed and kept as long as the frames fit in them
+        int m_cur_persistent_pbo_upload_idx;
+        std::vector< std::unique_ptr<gl::Buf> > m_persistent_pbos_upload;
+        std::vector<void*> m_persistent_pbos_upload_ptrs;
+        std::vector<GLsync> m_persistent_pbos_upload_fences;
+        bool m_upload_slot_mapped; //the fields below describe the slot between map_upload_slot() and commit_upload_slot()
+        GLint m_upload_slot_internal_format;
+        GLenum m_upload_slot_format;
+        GLenum m_upload_slot_type;
+        GLsizei m_upload_slot_width;
+        GLsizei m_upload_slot_height;
 
         //pbos used for downloading the texture
         int m_nr_pbos_download;
         int m_cur_pbo_download_idx; //index into the pbo that we will use for downloading to cpu. It point at the pbo we will use for writing next time we call download_to_pbo. Also it is the one we use for reading when calling download_from_oldest_pbo() because this is the oldest one and the current one that will get overwritten if we were to write into it
         std::vector<gl::Buf> m_pbos_download;
+        std::vector<GLsync> m_pbos_download_fences; //signaled when the GPU finished writing the texture into the pbo. Null if the pbo has no data that wasn't read yet
+
+        void delete_pbo_fences(std::vector<GLsync>& fences);
+        Buf& next_upload_pbo(const size_t size_bytes);
+        void fence_upload_pbo();
+        //converts the mat straight into a pbo with convert_pixels() and uploads it with transfer_format. The format and type are the ones the texture keeps for downloading
+        void upload_converted(const cv::Mat& cv_mat, GLint internal_format, GLenum format, GLenum type, GLenum transfer_format, const int transfer_channels, const PixelDepth transfer_depth, const bool swap_red_blue);
 
         std::vector<GLuint> m_fbos_for_mips; //each fbo point to a mip map of this texture
+
+        //for the progressive upload
+        cv::Mat m_progressive_source; //the full image, each level is made from it only when it gets uploaded
+        int m_finest_resident_lvl;
+
+        //compute kernels used by the texture. Compiled the first time they are needed and destroyed together with the texture. Keyed by name and defines
+        std::map<std::string, std::unique_ptr<Shader> > m_kernels;
+        Shader& kernel(const std::string& kernel_name, const char* src, const std::string& defines);
+
+        //for reduce()
+        std::unique_ptr<Primitives> m_reduce_primitives; //for the second pass, which is a 1D reduction
+        std::unique_ptr<Buf> m_reduce_partials; //one value per work group of the first pass
+        std::unique_ptr<Buf> m_reduce_result; //the single value for reduce_async()
+
+        //for generate_mipmap_compute()
+        std::unique_ptr<Buf> m_mip_counter; //atomic counter of work groups that finished the first 6 levels
+        void downsample_levels(const Texture2D& src, const int src_lvl, const int dst_lvl, const int idx_max_lvl, const TexMipReduction& reduction);
+        void allocate_mip_levels(const int idx_max_lvl);
+
+        //for download_into()
+        std::unique_ptr<Buf> m_download_converted; //the pixels after the conversion pass
+        BufDownload m_download_into_readback;
         // GLuint m_fbo_for_clearing_id; //for clearing we attach the texture to a fbo and clear that. It's a lot faster than glcleartexImage
 
 
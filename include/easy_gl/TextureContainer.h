@@ -0,0 +1,86 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+#include "easy_gl/Texture2D.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    enum class TextureContainerType{
+        KTX2,
+        DDS
+    };
+
+    struct TextureContainerLevel{
+        int width;
+        int height;
+        size_t offset; //from the start of the file
+        size_t size_bytes;
+    };
+
+    //Reads textures with precomputed mips from KTX2 and DDS files. The file is mmaped and every level goes straight from the mapping into the upload pbo, so there is no decoding and no runtime mip generation
+    //Supported are 2D textures without array layers or cube faces, with either block compressed levels (BC1-BC7) or 8, 16 and 32 bit float channels. KTX2 files with supercompression are not supported
+    class TextureContainer{
+    public:
+        TextureContainer();
+        TextureContainer(std::string name);
+        ~TextureContainer();
+
+        //rule of five (make the class non copyable and non movable because it owns the mapping)
+        TextureContainer(const TextureContainer& other) = delete; // copy ctor
+        TextureContainer& operator=(const TextureContainer& other) = delete; // assignment op
+        TextureContainer (TextureContainer && other) = delete; //move ctor
+        TextureContainer & operator=(TextureContainer &&) = delete; //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+
+        //mmaps the file and parses the header and the levels. The type is detected from the magic
+        void open(const std::string& path);
+        void close();
+        bool is_open() const;
+
+        //allocates inmutable storage with all the levels of the file and uploads them. The texture should not have storage yet
+        void upload(Texture2D& tex) const;
+        //opens the file, uploads it and closes it
+        static void load(const std::string& path, Texture2D& tex);
+
+        TextureContainerType type() const;
+        int width() const;
+        int height() const;
+        int nr_levels() const;
+        const TextureContainerLevel& level(const int lvl) const;
+        const unsigned char* level_data(const int lvl) const;
+        bool is_compressed() const;
+        GLenum internal_format() const;
+        GLenum format() const; //EGL_INVALID for compressed formats
+        GLenum gl_type() const; //EGL_INVALID for compressed formats
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        std::string m_path;
+        unsigned char* m_mapped_ptr;
+        size_t m_mapped_size_bytes;
+
+        TextureContainerType m_type;
+        GLenum m_internal_format;
+        GLenum m_format;
+        GLenum m_gl_type;
+        std::vector<TextureContainerLevel> m_levels;
+
+        void parse_ktx2();
+        void parse_dds();
+        void check_levels(); //the levels have the sizes that the format says and are inside the file
+    };
+}
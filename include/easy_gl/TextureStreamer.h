@@ -0,0 +1,113 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+
+#include "opencv2/opencv.hpp"
+
+#include "easy_gl/Buf.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    class Texture2D;
+    struct TextureStorageGuard;
+
+    //handle to an upload scheduled with TextureStreamer::upload(). The texture must not be bound until ready() returns true
+    class TextureStreamUpload{
+    public:
+        TextureStreamUpload();
+
+        //true once the worker issued the transfer and the GPU finished it, or once the upload got cancelled. Never blocks so it can be polled every frame
+        bool ready();
+        //blocks until the worker issued the transfer and the GPU finished it, or until the upload got cancelled
+        void wait();
+        bool valid() const; //false for a default constructed handle
+        //true if the texture was destroyed or its storage reallocated before the worker got to the upload, so nothing was written into it
+        bool cancelled() const;
+
+    private:
+        friend class TextureStreamer;
+        //shared between the worker, which publishes the fence, and the render thread which polls it
+        struct State{
+            ~State();
+            std::atomic<GLsync> fence{nullptr};
+            std::atomic<bool> cancelled{false}; //set before the fence gets published
+            bool signaled=false;
+        };
+        std::shared_ptr<State> m_state;
+    };
+
+    //Uploads textures from a worker thread that has its own GL context shared with the one of the render thread, so the memcpy into the pbo and the transfer don't cause hitches in the render loop.
+    //The library doesn't create windows or contexts so the caller gives a function that makes the shared context current on the calling thread, for example glfwMakeContextCurrent on a hidden GLFW window created with the main window as share, or eglMakeCurrent on a headless EGL context.
+    //The storage of the texture is (re)allocated on the render thread when calling upload() because changes to the storage done by one context are not visible to the other until they get syncronized. The worker only writes the pixels.
+    class TextureStreamer{
+    public:
+        TextureStreamer(std::function<void()> make_context_current, std::function<void()> release_context=nullptr, const int nr_pbos=4);
+        TextureStreamer(std::string name, std::function<void()> make_context_current, std::function<void()> release_context=nullptr, const int nr_pbos=4);
+        ~TextureStreamer(); //uploads that are still in the queue get done before the worker exits
+
+        //rule of five (make the class non copyable and non movable because the worker points to it)
+        TextureStreamer(const TextureStreamer& other) = delete; // copy ctor
+        TextureStreamer& operator=(const TextureStreamer& other) = delete; // assignment op
+        TextureStreamer (TextureStreamer && other) = delete; //move ctor
+        TextureStreamer & operator=(TextureStreamer &&) = delete; //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+
+        //schedules the upload of the mat into the texture. Has to be called from the render thread. The mat is not copied so don't write into its pixels until the upload is ready()
+        //If the texture is destroyed or its storage reallocated before the worker gets to it, the upload is cancelled instead of writing into whatever uses that texture id by then
+        TextureStreamUpload upload(Texture2D& tex, const cv::Mat& cv_mat, const bool flip_red_blue=true, const bool store_as_normalized_vals=true);
+        int nr_pending(); //uploads in the queue that the worker didn't start yet
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        struct Job{
+            GLuint tex_id;
+            std::shared_ptr<TextureStorageGuard> storage_guard; //keeps the guard alive even if the texture gets destroyed so the worker can find out
+            int storage_generation; //generation of the storage that was allocated for this upload
+            GLenum format;
+            GLenum type;
+            cv::Mat cv_mat;
+            GLsync storage_fence; //signaled once the render thread finished (re)allocating the storage of the texture. Null if it didn't change
+            std::shared_ptr<TextureStreamUpload::State> state;
+        };
+
+        std::function<void()> m_make_context_current;
+        std::function<void()> m_release_context;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::deque<Job> m_jobs;
+        bool m_stop;
+
+        //only used by the worker
+        int m_nr_pbos;
+        int m_cur_pbo_idx;
+        std::vector< std::unique_ptr<Buf> > m_pbos; //persistently mapped
+        std::vector<void*> m_pbos_ptrs;
+        std::vector<GLsync> m_pbos_fences; //signaled when the GPU finished reading the pbo into the texture
+
+        std::thread m_worker; //last so that everything above is constructed before it starts
+
+        void worker_loop();
+        void process(Job& job);
+        void cancel(Job& job); //the texture changed since the job was scheduled so nothing gets written into it
+    };
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    class Texture2D;
+
+    //Another texture object that shares the storage of a Texture2D through glTextureView, created with Texture2D::make_view(). It can read the texels as a different format of the same size (RGBA8 as R32UI, SRGB8_ALPHA8 as RGBA8...) or expose a range of mips as if it were its own texture, without copying anything.
+    //The view doesn't own the storage, the GL keeps it alive until both the texture and all its views are deleted. Bind it with Shader::bind_texture() or Shader::bind_image()
+    class TextureView{
+    public:
+        TextureView();
+        ~TextureView();
+
+        //rule of five (make the class non copyable)
+        TextureView(const TextureView& other) = delete; // copy ctor
+        TextureView& operator=(const TextureView& other) = delete; // assignment op
+        //the move ctors cannot be default because the view would end up being deleted twice
+        TextureView (TextureView && other); //move ctor
+        TextureView & operator=(TextureView && other); //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+
+        void set_wrap_mode(const GLenum wrap_mode);
+        void set_filter_mode_min_mag(const GLenum filter_mode);
+
+        void bind() const;
+        int tex_id() const;
+        bool storage_initialized() const; //true if it's a valid view
+        GLint internal_format() const;
+        int width() const; //of the first mip of the view
+        int height() const;
+        int base_mip() const; //mip of the original texture which is mip 0 of the view
+        int nr_mips() const;
+
+        //true if a texture of internal_format can have views of view_internal_format, which needs both to be of the same compatibility class
+        static bool formats_compatible(const GLenum internal_format, const GLenum view_internal_format);
+
+
+    private:
+        friend class Texture2D;
+        //makes the view, only Texture2D::make_view() calls it
+        void create(const GLuint orig_tex_id, const GLenum orig_internal_format, const GLenum internal_format, const int base_mip, const int nr_mips, const int width, const int height);
+        void destroy();
+
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        GLuint m_tex_id;
+        GLint m_internal_format;
+        int m_width;
+        int m_height;
+        int m_base_mip;
+        int m_nr_mips;
+    };
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <tuple>
+#include <memory>
+
+#include "easy_gl/Texture2D.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    struct TransientTextureDesc{
+        GLint internal_format=EGL_INVALID;
+        GLenum format=EGL_INVALID;
+        GLenum type=EGL_INVALID;
+        int width=0;
+        int height=0;
+        int nr_mips=1;
+    };
+
+    //declarations of one format and size this frame. Only these share textures between them
+    struct TransientTextureKeyStats{
+        TransientTextureDesc desc;
+        int nr_declared=0;
+        int peak_alive=0; //most declarations alive at the same pass, which is the nr of textures backing them
+        long long declared_bytes=0; //if each declaration had its own texture
+        long long used_bytes=0; //of the peak_alive textures
+    };
+
+    struct TransientTexturePoolStats{
+        int nr_declared=0; //textures declared this frame
+        int nr_textures=0; //textures that actually back them
+        int nr_created=0; //textures that had to be created this frame, in the steady state this is 0
+        int nr_evicted=0; //textures destroyed at the start of this frame because they were not used for a while
+        long long declared_bytes=0; //memory the declared textures would need if each one had its own
+        long long used_bytes=0; //memory of the textures backing the declarations of this frame. It's the sum of the peak of each key, since different keys never share memory
+        long long allocated_bytes=0; //memory of all the textures owned by the pool, including the ones kept around for a few frames without being used
+        std::vector<TransientTextureKeyStats> keys; //one per format and size declared this frame
+    };
+
+    //Per frame allocator for scratch render targets. Every frame the passes declare the textures they need together with the first and last pass that uses them, and textures whose lifetimes don't overlap get the same Texture2D.
+    //The textures stay in the pool between frames, so the same declarations every frame don't allocate anything and a change of size only allocates the new size once. Textures which are not used for a few frames are destroyed
+    //GL has no way of placing two textures in the same memory so a texture is only shared between declarations with the same format and size. Declarations of different formats or sizes always get different textures,
+    //so the savings depend on how many declarations of the same key have disjoint lifetimes. stats().keys shows them per key
+    //Usage every frame: begin_frame(), declare() for every scratch texture, then get() them while executing the passes. The contents of a texture are undefined at its first pass
+    class TransientTexturePool{
+    public:
+        TransientTexturePool();
+        TransientTexturePool(std::string name);
+        ~TransientTexturePool();
+
+        //rule of five (make the class non copyable)
+        TransientTexturePool(const TransientTexturePool& other) = delete; // copy ctor
+        TransientTexturePool& operator=(const TransientTexturePool& other) = delete; // assignment op
+        // Use default move ctors.  You have to declare these, otherwise the class will not have automatically generated move ctors.
+        TransientTexturePool (TransientTexturePool && other) = default; //move ctor
+        TransientTexturePool & operator=(TransientTexturePool &&) = default; //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+        //textures unused for more than this nr of frames are destroyed at begin_frame()
+        void set_max_unused_frames(const int nr_frames);
+
+        //forgets the declarations of the previous frame. Their handles are not valid anymore
+        void begin_frame();
+        //returns a handle for get(). first_pass and last_pass are the indices of the first and last pass that read or write the texture, in the order the passes run
+        int declare(const TransientTextureDesc& desc, const int first_pass, const int last_pass);
+        int declare(const GLint internal_format, const GLenum format, const GLenum type, const int width, const int height, const int first_pass, const int last_pass, const int nr_mips=1);
+        //the first call of each frame assigns the textures to the declarations, after that nothing else can be declared until the next frame
+        Texture2D& get(const int handle);
+
+        //destroys all the textures and the declarations of this frame
+        void clear();
+        TransientTexturePoolStats stats() const;
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        typedef std::tuple<GLint, GLenum, GLenum, int, int, int> TexKey; //internal_format, format, type, width, height, nr_mips
+
+        struct Declaration{
+            TexKey key;
+            int first_pass;
+            int last_pass;
+            int texture_idx; //into m_textures
+        };
+        struct PooledTexture{
+            std::unique_ptr<Texture2D> tex;
+            TexKey key;
+            long long bytes;
+            int busy_until_pass; //last pass of the declaration it was given to in this frame, -1 if it's free
+            long long last_used_frame;
+        };
+
+        std::vector<Declaration> m_declarations;
+        std::vector<PooledTexture> m_textures;
+        bool m_assigned;
+        long long m_frame;
+        int m_max_unused_frames;
+        TransientTexturePoolStats m_stats;
+
+        void assign();
+        int create_texture(const TexKey& key);
+        TransientTextureKeyStats& key_stats_for(const TexKey& key); //entry of m_stats.keys, added if it's not there yet
+    };
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <type_traits>
+
+#include <Eigen/Core>
+
+#include "easy_gl/Buf.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    //describes how a type T looks to the vertex fetch: the GL type of one component and how many components there are. Only specialized for the types that can be fed directly to an attribute
+    template<typename T>
+    struct GLTypeTraits{
+        static const bool is_specialized=false;
+    };
+
+    #define EGL_SCALAR_TRAITS(CPP_TYPE, GL_TYPE, IS_INTEGER) \
+    template<> \
+    struct GLTypeTraits<CPP_TYPE>{ \
+        static const bool is_specialized=true; \
+        static const GLenum gl_type=GL_TYPE; \
+        static const int nr_components=1; \
+        static const bool is_integer=IS_INTEGER; \
+    };
+    EGL_SCALAR_TRAITS(float, GL_FLOAT, false)
+    EGL_SCALAR_TRAITS(double, GL_DOUBLE, false)
+    EGL_SCALAR_TRAITS(int, GL_INT, true)
+    EGL_SCALAR_TRAITS(unsigned int, GL_UNSIGNED_INT, true)
+    EGL_SCALAR_TRAITS(short, GL_SHORT, true)
+    EGL_SCALAR_TRAITS(unsigned short, GL_UNSIGNED_SHORT, true)
+    EGL_SCALAR_TRAITS(signed char, GL_BYTE, true)
+    EGL_SCALAR_TRAITS(unsigned char, GL_UNSIGNED_BYTE, true)
+    #undef EGL_SCALAR_TRAITS
+
+    //fixed size Eigen vectors like Eigen::Vector3f or Eigen::Vector4i. They have no padding when the size is not a multiple of 16 bytes so an array of them is tightly packed
+    template<typename Scalar, int Rows, int Options, int MaxRows>
+    struct GLTypeTraits< Eigen::Matrix<Scalar, Rows, 1, Options, MaxRows, 1> >{
+        static_assert(Rows!=Eigen::Dynamic, "Dynamic size Eigen vectors like Eigen::VectorXf store their coefficients on the heap so they cannot be memcpy-ed into a buffer. Use a fixed size one like Eigen::Vector3f");
+        static_assert(Rows>=1 && Rows<=4, "Vertex attributes can only have between 1 and 4 components");
+        static const bool is_specialized=GLTypeTraits<Scalar>::is_specialized;
+        static const GLenum gl_type=GLTypeTraits<Scalar>::gl_type;
+        static const int nr_components=Rows;
+        static const bool is_integer=GLTypeTraits<Scalar>::is_integer;
+    };
+
+    //true for Eigen matrices and arrays whose size is only known at runtime. Their object only holds a pointer to the coefficients so copying it to the gpu would copy the pointer
+    template<typename T>
+    struct IsDynamicSizeEigen{
+        static const bool value=false;
+    };
+    template<typename Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+    struct IsDynamicSizeEigen< Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols> >{
+        static const bool value= Rows==Eigen::Dynamic || Cols==Eigen::Dynamic;
+    };
+    template<typename Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+    struct IsDynamicSizeEigen< Eigen::Array<Scalar, Rows, Cols, Options, MaxRows, MaxCols> >{
+        static const bool value= Rows==Eigen::Dynamic || Cols==Eigen::Dynamic;
+    };
+
+
+    //Buf that knows the type of its elements. The size in bytes and the GL type are deduced from T so uploads and downloads work in elements instead of bytes and the VertexArrayObject can set up the attributes without being told the type or the number of components.
+    //T can be a scalar, a fixed size Eigen vector or a POD struct and it gets copied to the gpu with memcpy. Note that Eigen types are not std::is_trivially_copyable even though they are fine to memcpy so we cannot check this at compile time. For structs each member is bound as a separate attribute with VertexArrayObject::vertex_attribute(prog, name, buf, &Vertex::member)
+    template<typename T>
+    class TypedBuf : public Buf{
+        static_assert(!IsDynamicSizeEigen<T>::value, "TypedBuf only supports fixed size types. Dynamic size Eigen types like Eigen::VectorXf or Eigen::MatrixXf keep their coefficients on the heap so use a fixed size one like Eigen::Vector3f instead");
+    public:
+        typedef T value_type;
+
+        TypedBuf(){
+            init_type();
+        }
+        TypedBuf(std::string name):
+            Buf(name){
+            init_type();
+        }
+
+        //rule of five (make the class non copyable)
+        TypedBuf(const TypedBuf& other) = delete; // copy ctor
+        TypedBuf& operator=(const TypedBuf& other) = delete; // assignment op
+        // Use default move ctors.  You have to declare these, otherwise the class will not have automatically generated move ctors.
+        TypedBuf (TypedBuf && other) = default; //move ctor
+        TypedBuf & operator=(TypedBuf &&) = default; //move assignment
+
+
+        //the target needs to be set before with set_target or one of the set_target_* functions. Uploading no elements leaves the buffer empty
+        void upload(const std::vector<T>& data, const GLenum usage_hints=GL_STATIC_DRAW){
+            upload(data.data(), data.size(), usage_hints);
+        }
+        void upload(const T* data_ptr, const size_t nr_elements, const GLenum usage_hints=GL_STATIC_DRAW){
+            upload_data(nr_elements*sizeof(T), data_ptr, usage_hints);
+        }
+        //overwrites part of the buffer starting at element idx_start without changing the size
+        void upload_sub(const size_t idx_start, const T* data_ptr, const size_t nr_elements){
+            CHECK(idx_start+nr_elements<=nr_elements_stored()) << "Cannot upload " << nr_elements << " elements starting at " << idx_start << " because the buffer " << name() << " only has " << nr_elements_stored();
+            upload_sub_data(idx_start*sizeof(T), nr_elements*sizeof(T), data_ptr);
+        }
+
+        //the byte based download of Buf stays available next to the one returning elements
+        using Buf::download;
+        std::vector<T> download(){
+            std::vector<T> data(nr_elements_stored());
+            if(!data.empty()){
+                Buf::download(data.data(), data.size()*sizeof(T));
+            }
+            return data;
+        }
+
+        //nr of elements of type T currently in the buffer
+        size_t nr_elements_stored() const{
+            if(!storage_initialized()){
+                return 0;
+            }
+            return size_bytes()/sizeof(T);
+        }
+
+        static constexpr GLsizei stride_bytes(){
+            return sizeof(T);
+        }
+
+
+    private:
+        void init_type(){
+            //structs have no single type, each of their members gets its own when binding them as attributes
+            if(GLTypeTraits<T>::is_specialized){
+                set_type(type_or_invalid<T>());
+            }
+        }
+
+        template<typename U, typename std::enable_if<GLTypeTraits<U>::is_specialized, int>::type = 0>
+        static GLenum type_or_invalid(){
+            return GLTypeTraits<U>::gl_type;
+        }
+        template<typename U, typename std::enable_if<!GLTypeTraits<U>::is_specialized, int>::type = 0>
+        static GLenum type_or_invalid(){
+            return EGL_INVALID;
+        }
+
+    };
+
+}
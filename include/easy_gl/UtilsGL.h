@@ -462,6 +462,43 @@ inline int round_up_to_nearest_multiple(const int number, const int divisor){
  return number - number % divisor + divisor * !!(number % divisor);
 }
 
+//nr of bytes that one vertex attribute occupies in the buffer. The packed types store all the components in one 32 bit value
+inline int gl_attribute_size_bytes(const GLenum type, const int nr_components){
+    switch(type){
+        case GL_BYTE: case GL_UNSIGNED_BYTE: return nr_components;
+        case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: return 2*nr_components;
+        case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT: case GL_FIXED: return 4*nr_components;
+        case GL_DOUBLE: return 8*nr_components;
+        case GL_INT_2_10_10_10_REV: case GL_UNSIGNED_INT_2_10_10_10_REV: case GL_UNSIGNED_INT_10F_11F_11F_REV: return 4;
+        default: LOG(FATAL) << "Unknown vertex attribute type " << std::hex << type << std::dec;
+    }
+    return 0;
+}
+
+//nr of components of a pixel transfer format
+inline int gl_format_nr_channels(const GLenum format){
+    switch(format){
+        case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: case GL_STENCIL_INDEX: return 1;
+        case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL: return 2;
+        case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: case GL_BGR_INTEGER: return 3;
+        case GL_RGBA: case GL_BGRA: case GL_RGBA_INTEGER: case GL_BGRA_INTEGER: return 4;
+        default: LOG(FATAL) << "Unknown format " << std::hex << format << std::dec;
+    }
+    return 0;
+}
+
+//nr of bytes of one pixel in client memory for a certain format and type. The packed types store the whole pixel in one value, including the depth stencil ones
+inline int gl_pixel_size_bytes(const GLenum format, const GLenum type){
+    switch(type){
+        case GL_UNSIGNED_BYTE_3_3_2: case GL_UNSIGNED_BYTE_2_3_3_REV: return 1;
+        case GL_UNSIGNED_SHORT_5_6_5: case GL_UNSIGNED_SHORT_5_6_5_REV: case GL_UNSIGNED_SHORT_4_4_4_4: case GL_UNSIGNED_SHORT_4_4_4_4_REV: case GL_UNSIGNED_SHORT_5_5_5_1: case GL_UNSIGNED_SHORT_1_5_5_5_REV: return 2;
+        case GL_UNSIGNED_INT_8_8_8_8: case GL_UNSIGNED_INT_8_8_8_8_REV: case GL_UNSIGNED_INT_10_10_10_2: case GL_UNSIGNED_INT_2_10_10_10_REV:
+        case GL_UNSIGNED_INT_10F_11F_11F_REV: case GL_UNSIGNED_INT_5_9_9_9_REV: case GL_UNSIGNED_INT_24_8: return 4;
+        case GL_FLOAT_32_UNSIGNED_INT_24_8_REV: return 8;
+    }
+    return gl_attribute_size_bytes(type, gl_format_nr_channels(format));
+}
+
 //calculates for a certain full sized image what would be size at a certain mip map level
 inline Eigen::Vector2i calculate_mipmap_size(const int full_w, const int full_h, const int level){
     int new_w=std::max<int>(1, floor(full_w / pow(2,level) )  );
@@ -471,6 +508,51 @@ inline Eigen::Vector2i calculate_mipmap_size(const int full_w, const int full_h,
     return new_size;
 }
 
+//S3TC is an extension so glad only has its enums if it was generated with it. RGTC and BPTC are core
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+    #define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+    #define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+//block compressed formats. All of them use blocks of 4x4 pixels
+inline bool is_internal_format_compressed(const GLenum internal_format){
+    switch(internal_format){
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_RED_RGTC1: case GL_COMPRESSED_SIGNED_RED_RGTC1: case GL_COMPRESSED_RG_RGTC2: case GL_COMPRESSED_SIGNED_RG_RGTC2:
+        case GL_COMPRESSED_RGBA_BPTC_UNORM: case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM: case GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT: case GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//bytes of one 4x4 block. BC1 and BC4 use 8 bytes and the rest 16
+inline int gl_compressed_block_size_bytes(const GLenum internal_format){
+    switch(internal_format){
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RED_RGTC1: case GL_COMPRESSED_SIGNED_RED_RGTC1:
+            return 8;
+        default:
+            CHECK(is_internal_format_compressed(internal_format)) << "Internal format " << std::hex << internal_format << std::dec << " is not compressed";
+            return 16;
+    }
+}
+
+//size of a whole image of a compressed format. The borders that don't fill a block still take a whole block
+inline int gl_compressed_size_bytes(const GLenum internal_format, const int width, const int height){
+    return ((width+3)/4) * ((height+3)/4) * gl_compressed_block_size_bytes(internal_format);
+}
+
 inline bool is_internal_format_valid(const GLenum internal_format){
 
     //taken from https://www.khronos.org/registry/OpenGL-Refpages/gl4/html/glTexImage2D.xhtml
@@ -546,6 +628,9 @@ inline bool is_internal_format_valid(const GLenum internal_format){
     allowed_internal_formats.push_back(GL_DEPTH24_STENCIL8);
     allowed_internal_formats.push_back(GL_DEPTH32F_STENCIL8);
     allowed_internal_formats.push_back(GL_STENCIL_INDEX8);
+    if(is_internal_format_compressed(internal_format)){
+        return true;
+    }
 
     //check that we are a valid one
     for (size_t i = 0; i < allowed_internal_formats.size(); i++) {
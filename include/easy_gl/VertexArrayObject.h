@@ -5,6 +5,8 @@
 
 #include "Shader.h"
 #include "Buf.h"
+#include "TypedBuf.h"
+#include "VertexPacking.h"
 
 namespace gl{
     class VertexArrayObject{
@@ -25,6 +27,29 @@ namespace gl{
         void bind() const;
 
         void vertex_attribute(const gl::Shader& prog, const std::string& attrib_name, const gl::Buf& buf, const int size) const;
+        //same as above but the attribute starts at the offset of the range, for example for buffers shared through a BufArena
+        void vertex_attribute(const gl::Shader& prog, const std::string& attrib_name, const gl::BufRange& range, const int size) const;
+        //fully specified attribute, for buffers with interleaved or non float data. Integer attributes (is_integer) are read by the shader as int, ivec, uint, etc, otherwise they are converted to float and normalized if requested
+        void vertex_attribute(const gl::Shader& prog, const std::string& attrib_name, const gl::Buf& buf, const int nr_components, const GLenum gl_type, const bool normalized, const bool is_integer, const GLsizei stride, const GLintptr offset) const;
+        //for buffers filled with the packers from VertexPacking.h. Snorm_2_10_10_10 always uses 4 components since the whole vertex is packed in one uint32
+        void vertex_attribute(const gl::Shader& prog, const std::string& attrib_name, const gl::Buf& buf, const int nr_components, const VertexFormat format) const;
+        //the type, nr of components and stride come from the element type of the buffer. Integer types are kept as integers so the shader has to declare them as int, ivec, uint, etc
+        template<typename T>
+        void vertex_attribute(const gl::Shader& prog, const std::string& attrib_name, const gl::TypedBuf<T>& buf) const{
+            static_assert(GLTypeTraits<T>::is_specialized, "The element type has no GLTypeTraits. For structs bind each member with vertex_attribute(prog, name, buf, &Struct::member)");
+            vertex_attribute(prog, attrib_name, buf, GLTypeTraits<T>::nr_components, GLTypeTraits<T>::gl_type, false, GLTypeTraits<T>::is_integer, sizeof(T), 0);
+        }
+        //binds one member of an interleaved buffer of structs, for example vertex_attribute(prog, "normal", buf, &Vertex::normal)
+        template<typename T, typename M>
+        void vertex_attribute(const gl::Shader& prog, const std::string& attrib_name, const gl::TypedBuf<T>& buf, M T::* member) const{
+            static_assert(GLTypeTraits<M>::is_specialized, "The type of the member has no GLTypeTraits so it cannot be used as a vertex attribute");
+            static_assert(std::is_standard_layout<T>::value, "The struct needs to have standard layout so that the offset of its members is well defined");
+            //offset of the member computed on a dummy storage so we don't need a default constructible T
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+            const T* obj=reinterpret_cast<const T*>(&storage);
+            GLintptr offset=reinterpret_cast<const char*>(&(obj->*member)) - reinterpret_cast<const char*>(obj);
+            vertex_attribute(prog, attrib_name, buf, GLTypeTraits<M>::nr_components, GLTypeTraits<M>::gl_type, false, GLTypeTraits<M>::is_integer, sizeof(T), offset);
+        }
         void indices(const gl::Buf& buf) const;
 
 
@@ -36,6 +61,5 @@ namespace gl{
         GLuint m_id;
 
 
-
     };
 }
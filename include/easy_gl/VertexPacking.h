@@ -0,0 +1,44 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+#include <Eigen/Core>
+
+
+namespace gl{
+
+    //formats in which a vertex attribute can be stored in the buffer. Everything except Int and UInt arrives in the shader as float
+    enum class VertexFormat{
+        Float, //GL_FLOAT, 4 bytes per component
+        Half, //GL_HALF_FLOAT, 2 bytes per component. Good for uvs and anything in a small range
+        Snorm_2_10_10_10, //GL_INT_2_10_10_10_REV normalized to [-1,1], 4 bytes for the whole vertex. Good for normals and tangents
+        Unorm8, //GL_UNSIGNED_BYTE normalized to [0,1]. Good for colors
+        Unorm16, //GL_UNSIGNED_SHORT normalized to [0,1]
+        Int, //GL_INT read with glVertexAttribIPointer as int, ivec
+        UInt //GL_UNSIGNED_INT read with glVertexAttribIPointer as uint, uvec
+    };
+
+    GLenum vertex_format_gl_type(const VertexFormat format);
+    bool vertex_format_is_normalized(const VertexFormat format);
+    bool vertex_format_is_integer(const VertexFormat format);
+
+
+    //CPU packers. The input has one vertex per row like the V, N, UV matrices of a mesh and the output is interleaved per vertex, ready for Buf::upload_data
+    //float to half. Uses F16C on x86 or NEON on arm when the cpu has it
+    std::vector<uint16_t> pack_half(const Eigen::MatrixXf& mat);
+    //3 or 4 columns in [-1,1], usually normals. With 3 columns the w is set to 0. Always gives one uint32 per vertex which is bound with 4 components
+    std::vector<uint32_t> pack_snorm_2_10_10_10(const Eigen::MatrixXf& mat);
+    //values in [0,1], usually colors. They get clamped
+    std::vector<uint8_t> pack_unorm8(const Eigen::MatrixXf& mat);
+    std::vector<uint16_t> pack_unorm16(const Eigen::MatrixXf& mat);
+    //just reorders to one vertex after another since eigen stores column by column
+    std::vector<int32_t> pack_int(const Eigen::MatrixXi& mat);
+
+    //single values, mostly useful for the scalar paths and for tests
+    uint16_t float_to_half(const float val);
+    float half_to_float(const uint16_t val);
+
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+
+#include "opencv2/opencv.hpp"
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Texture2D.h"
+#include "easy_gl/Shader.h"
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+    //On disk layout of a tile pyramid (little endian, as written by the machine):
+    //  VirtualTextureFileHeader
+    //  the tiles of level 0 row by row, then the ones of level 1 and so on, starting at data_offset
+    //Every tile is RGBA8 of (tile_size+2*border)^2 pixels. The border replicates the neighbouring pixels so the atlas can be sampled with bilinear filtering. Only the tiles that overlap the image are stored
+    #define EGL_VIRTUAL_TEXTURE_MAGIC "EGLVTEX"
+    #define EGL_VIRTUAL_TEXTURE_VERSION 1
+    #define EGL_VIRTUAL_TEXTURE_ALIGNMENT 64
+
+    struct VirtualTextureFileHeader{
+        char magic[8];
+        uint32_t version;
+        uint32_t width; //of the full resolution image
+        uint32_t height;
+        uint32_t tile_size;
+        uint32_t border;
+        uint32_t nr_levels;
+        uint64_t data_offset;
+    };
+    static_assert(sizeof(VirtualTextureFileHeader)==40, "VirtualTextureFileHeader should have no padding so it's the same on all compilers");
+
+    struct VirtualTextureStats{
+        int nr_resident_tiles=0;
+        int nr_pending_loads=0; //requested to the loader thread and not yet in the atlas
+        long long nr_loaded=0;
+        long long nr_evicted=0;
+        int nr_feedback_requests=0; //pages reported by the last feedback that was read
+        int nr_feedback_overflows=0; //times the feedback list was full and requests got dropped
+    };
+
+    //Software virtual texturing for images that don't fit in gpu memory. The image is split into a pyramid of tiles stored on disk and only the tiles that are visible get loaded into a fixed size atlas, so the memory stays the same no matter how big the image is.
+    //  - the page table is a Texture2D with one texel per tile and one mip per level of the pyramid. Each texel has the slot of the atlas where the tile lives and its level. Tiles which are not resident point to their closest resident ancestor so sampling always returns something
+    //  - the fragment shader reports the tiles it wants into a feedback buffer which is read back asynchronously, the missing ones are loaded by a thread and the least recently used ones get evicted
+    //  - the coarsest level is a single tile which is always resident
+    //Usage every frame: update(), bind() to the shader that samples with vt_sample() from glsl_code(), draw, end_frame()
+    class VirtualTexture{
+    public:
+        VirtualTexture();
+        VirtualTexture(std::string name);
+        ~VirtualTexture();
+
+        //rule of five (make the class non copyable and non movable because the loader thread points to it)
+        VirtualTexture(const VirtualTexture& other) = delete; // copy ctor
+        VirtualTexture& operator=(const VirtualTexture& other) = delete; // assignment op
+        VirtualTexture (VirtualTexture && other) = delete; //move ctor
+        VirtualTexture & operator=(VirtualTexture &&) = delete; //move assignment
+
+
+        void set_name(const std::string name);
+        std::string name() const;
+
+        //writes the tile pyramid of an 8 bit image with 1, 3 or 4 channels. The channels are in the opencv order (BGR)
+        static void build_tile_file(const cv::Mat& cv_mat, const std::string& path, const int tile_size=128, const int border=4);
+
+        //mmaps the tile file and allocates an atlas of atlas_slots_per_side^2 tiles. The atlas is all the memory the texture will ever use
+        void open(const std::string& path, const int atlas_slots_per_side=16);
+        void close();
+        bool is_open() const;
+
+        //call once per frame before drawing. Reads the feedback of a previous frame if it arrived, queues the missing tiles and uploads the ones that finished loading
+        void update();
+        //binds the page table, the atlas, the feedback buffers and the uniforms used by vt_sample()
+        void bind(Shader& shader);
+        //call once per frame after the draws that sample the texture. Schedules the readback of the feedback
+        void end_frame();
+        //the declarations and the vt_sample(uv) function to be pasted in a fragment shader (#version 430 or higher) before its main
+        static std::string glsl_code();
+
+        void set_max_uploads_per_frame(const int nr_tiles); //limits the time spent in update()
+        void set_max_pending_loads(const int nr_tiles);
+
+        int width() const;
+        int height() const;
+        int nr_levels() const;
+        Texture2D& page_table();
+        Texture2D& atlas();
+        VirtualTextureStats stats() const;
+
+
+    private:
+        std::string named(const std::string msg) const;
+        std::string m_name;
+
+        struct LoadedTile{
+            uint32_t id;
+            std::vector<unsigned char> pixels;
+        };
+
+        //file
+        unsigned char* m_mapped_ptr;
+        size_t m_mapped_size_bytes;
+        VirtualTextureFileHeader m_header;
+        std::vector<int> m_level_tiles_x; //nr of tiles in the file for each level
+        std::vector<int> m_level_tiles_y;
+        std::vector<uint64_t> m_level_first_file_tile; //index of the first tile of each level in the file
+        size_t m_tile_bytes;
+        int m_slot_size; //tile_size+2*border
+
+        //gpu side
+        std::unique_ptr<Texture2D> m_page_table;
+        std::unique_ptr<Texture2D> m_atlas;
+        std::unique_ptr<Buf> m_feedback; //count and list of the pages requested this frame
+        std::unique_ptr<Buf> m_feedback_stamps; //last frame in which each page was added to the list, so every page is added only once per frame
+        BufDownload m_feedback_download;
+        bool m_feedback_in_flight;
+        int m_feedback_capacity;
+        uint32_t m_frame;
+
+        //page table on the cpu. One RGBA8 texel per page and level
+        std::vector< std::vector<uint32_t> > m_page_entries;
+        std::vector<cv::Rect> m_page_dirty; //region of each level that changed since the last upload
+
+        //atlas slots. Slot 0 has the coarsest tile and is never evicted
+        int m_atlas_slots_per_side;
+        std::vector<uint32_t> m_slot_tile; //id of the tile in each slot or EGL_INVALID
+        std::vector<uint32_t> m_slot_last_frame;
+        std::list<int> m_lru; //slots ordered from the most to the least recently used
+        std::vector< std::list<int>::iterator > m_slot_lru_it;
+        std::vector<int> m_free_slots;
+        std::unordered_map<uint32_t, int> m_tile_slot;
+        std::unordered_set<uint32_t> m_pending; //tiles requested to the loader that are not yet in the atlas
+
+        //loader thread
+        std::thread m_loader;
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::deque<uint32_t> m_load_requests;
+        std::deque<LoadedTile> m_loaded;
+        bool m_stop_loader;
+
+        int m_max_uploads_per_frame;
+        int m_max_pending_loads;
+        VirtualTextureStats m_stats;
+
+        //tiles are identified by their index in a full pyramid of nr_levels levels, which is also how the shader indexes the stamps
+        int nr_pages(const int lvl) const; //per side
+        uint64_t level_first_page(const int lvl) const;
+        uint32_t tile_id(const int lvl, const int x, const int y) const;
+        void tile_coords(const uint32_t id, int& lvl, int& x, int& y) const;
+        bool tile_in_file(const int lvl, const int x, const int y) const;
+        const unsigned char* tile_pixels_in_file(const int lvl, const int x, const int y) const;
+
+        void process_feedback(const uint32_t* ids, const int nr_ids);
+        bool upload_tile(const uint32_t id, const unsigned char* pixels); //false if there was no slot to put it in
+        void write_slot(const int slot, const unsigned char* pixels);
+        int acquire_slot();
+        void touch_slot(const int slot);
+        void update_page_entries(const int lvl, const int x, const int y);
+        void upload_page_table();
+        void loader_loop();
+        void stop_loader();
+    };
+}
@@ -0,0 +1,450 @@
+#include "easy_gl/BlockCompression.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio> //rename
+#include <cstring> //memcpy, memcmp
+
+//mkdir
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+    #define EGL_BC_SSE2 1
+#endif
+
+#include "easy_gl/UtilsGL.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+namespace gl{
+
+//bump it whenever the output of the encoders changes so the old cache entries are not used anymore
+static const uint32_t bc_encoder_version=1;
+
+GLenum block_format_gl_internal_format(const BlockFormat format, const bool srgb){
+    switch(format){
+        case BlockFormat::BC1: return srgb? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockFormat::BC3: return srgb? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BlockFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+        case BlockFormat::BC5: return GL_COMPRESSED_RG_RGTC2;
+        case BlockFormat::BC7: return srgb? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+    LOG(FATAL) << "Unknown block format";
+    return GL_COMPRESSED_RGBA_BPTC_UNORM;
+}
+
+int block_format_block_size_bytes(const BlockFormat format){
+    return format==BlockFormat::BC1 || format==BlockFormat::BC4 ? 8 : 16;
+}
+
+
+//min and max of each channel of the 16 RGBA pixels of a block
+static void block_min_max(const unsigned char* block, unsigned char* min_rgba, unsigned char* max_rgba){
+    #ifdef EGL_BC_SSE2
+        __m128i row0=_mm_loadu_si128((const __m128i*)(block));
+        __m128i row1=_mm_loadu_si128((const __m128i*)(block+16));
+        __m128i row2=_mm_loadu_si128((const __m128i*)(block+32));
+        __m128i row3=_mm_loadu_si128((const __m128i*)(block+48));
+        __m128i mn=_mm_min_epu8(_mm_min_epu8(row0, row1), _mm_min_epu8(row2, row3));
+        __m128i mx=_mm_max_epu8(_mm_max_epu8(row0, row1), _mm_max_epu8(row2, row3));
+        //reduce the 4 pixels left in each register
+        mn=_mm_min_epu8(mn, _mm_srli_si128(mn, 8));
+        mx=_mm_max_epu8(mx, _mm_srli_si128(mx, 8));
+        mn=_mm_min_epu8(mn, _mm_srli_si128(mn, 4));
+        mx=_mm_max_epu8(mx, _mm_srli_si128(mx, 4));
+        uint32_t mn_bits=_mm_cvtsi128_si32(mn);
+        uint32_t mx_bits=_mm_cvtsi128_si32(mx);
+        memcpy(min_rgba, &mn_bits, 4);
+        memcpy(max_rgba, &mx_bits, 4);
+    #else
+        for(int c=0; c<4; c++){
+            min_rgba[c]=255;
+            max_rgba[c]=0;
+        }
+        for(int i=0; i<16; i++){
+            for(int c=0; c<4; c++){
+                min_rgba[c]=std::min(min_rgba[c], block[i*4+c]);
+                max_rgba[c]=std::max(max_rgba[c], block[i*4+c]);
+            }
+        }
+    #endif
+}
+
+static uint16_t to_565(const int r, const int g, const int b){
+    return (uint16_t)( ((r*31+127)/255)<<11 | ((g*63+127)/255)<<5 | ((b*31+127)/255) );
+}
+
+static void from_565(const uint16_t c, int* rgb){
+    int r=(c>>11)&31;
+    int g=(c>>5)&63;
+    int b=c&31;
+    rgb[0]=(r<<3)|(r>>2);
+    rgb[1]=(g<<2)|(g>>4);
+    rgb[2]=(b<<3)|(b>>2);
+}
+
+//color block of BC1 and BC3 in the 4 color mode. The endpoints are the corners of the bounding box inset a bit since the extremes are usually outliers
+static void encode_bc1_block(const unsigned char* block, unsigned char* dst){
+    unsigned char mn[4], mx[4];
+    block_min_max(block, mn, mx);
+    int lo[3], hi[3];
+    for(int c=0; c<3; c++){
+        int inset=(mx[c]-mn[c])/16;
+        lo[c]=mn[c]+inset;
+        hi[c]=mx[c]-inset;
+    }
+    uint16_t c0=to_565(hi[0], hi[1], hi[2]);
+    uint16_t c1=to_565(lo[0], lo[1], lo[2]);
+    if(c0<c1){
+        std::swap(c0, c1);
+    }
+
+    uint32_t indices=0;
+    if(c0!=c1){
+        int palette[4][3];
+        from_565(c0, palette[0]);
+        from_565(c1, palette[1]);
+        for(int c=0; c<3; c++){
+            palette[2][c]=(2*palette[0][c]+palette[1][c])/3;
+            palette[3][c]=(palette[0][c]+2*palette[1][c])/3;
+        }
+        for(int i=0; i<16; i++){
+            int best=0;
+            int best_dist=1<<30;
+            for(int p=0; p<4; p++){
+                int dr=block[i*4+0]-palette[p][0];
+                int dg=block[i*4+1]-palette[p][1];
+                int db=block[i*4+2]-palette[p][2];
+                int dist=dr*dr+dg*dg+db*db;
+                if(dist<best_dist){
+                    best_dist=dist;
+                    best=p;
+                }
+            }
+            indices|=(uint32_t)best<<(2*i);
+        }
+    }
+
+    dst[0]=c0&0xff;
+    dst[1]=c0>>8;
+    dst[2]=c1&0xff;
+    dst[3]=c1>>8;
+    memcpy(dst+4, &indices, 4);
+}
+
+//one channel with 8 interpolated values, used by BC4, BC5 and the alpha of BC3
+static void encode_bc4_block(const unsigned char* block, const int channel, unsigned char* dst){
+    int mn=255, mx=0;
+    for(int i=0; i<16; i++){
+        mn=std::min(mn, (int)block[i*4+channel]);
+        mx=std::max(mx, (int)block[i*4+channel]);
+    }
+
+    uint64_t indices=0;
+    if(mx!=mn){
+        //a0>a1 selects the mode with 6 interpolated values
+        int palette[8];
+        palette[0]=mx;
+        palette[1]=mn;
+        for(int p=1; p<7; p++){
+            palette[p+1]=((7-p)*mx + p*mn)/7;
+        }
+        for(int i=0; i<16; i++){
+            int val=block[i*4+channel];
+            int best=0;
+            int best_dist=256;
+            for(int p=0; p<8; p++){
+                int dist=std::abs(val-palette[p]);
+                if(dist<best_dist){
+                    best_dist=dist;
+                    best=p;
+                }
+            }
+            indices|=(uint64_t)best<<(3*i);
+        }
+    }
+
+    dst[0]=mx;
+    dst[1]=mn;
+    for(int b=0; b<6; b++){
+        dst[2+b]=(indices>>(8*b))&0xff;
+    }
+}
+
+//writes bits starting from the least significant bit of the block, the way BC7 is laid out
+struct BitWriter{
+    unsigned char* dst;
+    int pos=0;
+    void put(const uint32_t val, const int nr_bits){
+        for(int b=0; b<nr_bits; b++){
+            if((val>>b)&1){
+                dst[pos>>3]|=1<<(pos&7);
+            }
+            pos++;
+        }
+    }
+};
+
+//BC7 mode 6: a single subset with RGBA endpoints of 7 bits plus a p bit each and 4 bit indices
+static void encode_bc7_block(const unsigned char* block, unsigned char* dst){
+    static const int weights[16]={0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    unsigned char mn[4], mx[4];
+    block_min_max(block, mn, mx);
+
+    //quantize both endpoints to 7 bits with the p bit that gives the smaller error
+    int endpoints[2][4]; //the 8 bit values after quantization
+    int quantized[2][4];
+    int pbits[2];
+    const unsigned char* targets[2]={mn, mx};
+    for(int e=0; e<2; e++){
+        int best_err=1<<30;
+        for(int p=0; p<2; p++){
+            int err=0;
+            int q[4];
+            for(int c=0; c<4; c++){
+                q[c]=std::min(127, std::max(0, (targets[e][c]-p+1)/2));
+                int val=(q[c]<<1)|p;
+                err+=(val-targets[e][c])*(val-targets[e][c]);
+            }
+            if(err<best_err){
+                best_err=err;
+                pbits[e]=p;
+                for(int c=0; c<4; c++){
+                    quantized[e][c]=q[c];
+                    endpoints[e][c]=(q[c]<<1)|p;
+                }
+            }
+        }
+    }
+
+    int palette[16][4];
+    for(int i=0; i<16; i++){
+        for(int c=0; c<4; c++){
+            palette[i][c]=((64-weights[i])*endpoints[0][c] + weights[i]*endpoints[1][c] + 32)>>6;
+        }
+    }
+    int indices[16];
+    for(int i=0; i<16; i++){
+        int best=0;
+        int best_dist=1<<30;
+        for(int p=0; p<16; p++){
+            int dist=0;
+            for(int c=0; c<4; c++){
+                int d=block[i*4+c]-palette[p][c];
+                dist+=d*d;
+            }
+            if(dist<best_dist){
+                best_dist=dist;
+                best=p;
+            }
+        }
+        indices[i]=best;
+    }
+
+    //the index of the first pixel is stored with 3 bits so its top bit has to be 0. Swapping the endpoints flips all the indices
+    if(indices[0]&8){
+        for(int c=0; c<4; c++){
+            std::swap(quantized[0][c], quantized[1][c]);
+        }
+        std::swap(pbits[0], pbits[1]);
+        for(int i=0; i<16; i++){
+            indices[i]=15-indices[i];
+        }
+    }
+
+    memset(dst, 0, 16);
+    BitWriter writer;
+    writer.dst=dst;
+    writer.put(1<<6, 7); //mode 6
+    for(int c=0; c<4; c++){
+        writer.put(quantized[0][c], 7);
+        writer.put(quantized[1][c], 7);
+    }
+    writer.put(pbits[0], 1);
+    writer.put(pbits[1], 1);
+    writer.put(indices[0], 3);
+    for(int i=1; i<16; i++){
+        writer.put(indices[i], 4);
+    }
+}
+
+//copies the 4x4 block starting at x,y replicating the last row and column for the blocks that go past the border
+static void fetch_block(const unsigned char* rgba, const int width, const int height, const int x, const int y, unsigned char* block){
+    for(int by=0; by<4; by++){
+        int sy=std::min(y+by, height-1);
+        for(int bx=0; bx<4; bx++){
+            int sx=std::min(x+bx, width-1);
+            memcpy(block+(by*4+bx)*4, rgba+((size_t)sy*width+sx)*4, 4);
+        }
+    }
+}
+
+static void encode_block(const unsigned char* block, const BlockFormat format, unsigned char* dst){
+    switch(format){
+        case BlockFormat::BC1: encode_bc1_block(block, dst); break;
+        case BlockFormat::BC3: encode_bc4_block(block, 3, dst); encode_bc1_block(block, dst+8); break;
+        case BlockFormat::BC4: encode_bc4_block(block, 0, dst); break;
+        case BlockFormat::BC5: encode_bc4_block(block, 0, dst); encode_bc4_block(block, 1, dst+8); break;
+        case BlockFormat::BC7: encode_bc7_block(block, dst); break;
+    }
+}
+
+std::vector<unsigned char> compress_bc_rgba(const unsigned char* rgba, const int width, const int height, const BlockFormat format, const int nr_threads){
+    CHECK(rgba) << "The pixels are null";
+    CHECK(width>0 && height>0) << "Cannot compress an image of " << width << "x" << height;
+
+    int blocks_x=(width+3)/4;
+    int blocks_y=(height+3)/4;
+    int block_bytes=block_format_block_size_bytes(format);
+    std::vector<unsigned char> compressed((size_t)blocks_x*blocks_y*block_bytes);
+
+    //each thread takes every nr_threads-th row of blocks so they all get a similar amount of work
+    int nr_workers= nr_threads>0? nr_threads : std::max(1u, std::thread::hardware_concurrency());
+    nr_workers=std::min(nr_workers, blocks_y);
+    auto encode_rows=[&](const int first_row){
+        unsigned char block[64];
+        for(int by=first_row; by<blocks_y; by+=nr_workers){
+            for(int bx=0; bx<blocks_x; bx++){
+                fetch_block(rgba, width, height, bx*4, by*4, block);
+                encode_block(block, format, compressed.data() + ((size_t)by*blocks_x+bx)*block_bytes);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(int i=1; i<nr_workers; i++){
+        workers.emplace_back(encode_rows, i);
+    }
+    encode_rows(0);
+    for(size_t i=0; i<workers.size(); i++){
+        workers[i].join();
+    }
+
+    return compressed;
+}
+
+//the encoders work on RGBA so everything gets converted to it from the opencv order
+static cv::Mat to_rgba(const cv::Mat& cv_mat){
+    CHECK(!cv_mat.empty()) << "The mat is empty";
+    CHECK(cv_mat.depth()==CV_8U) << "Only 8 bit images can be block compressed";
+    cv::Mat rgba;
+    if(cv_mat.channels()==1){
+        cv::cvtColor(cv_mat, rgba, cv::COLOR_GRAY2RGBA);
+    }else if(cv_mat.channels()==3){
+        cv::cvtColor(cv_mat, rgba, cv::COLOR_BGR2RGBA);
+    }else if(cv_mat.channels()==4){
+        cv::cvtColor(cv_mat, rgba, cv::COLOR_BGRA2RGBA);
+    }else{
+        LOG(FATAL) << "Block compression needs 1, 3 or 4 channels but the mat has " << cv_mat.channels();
+    }
+    return rgba;
+}
+
+std::vector<unsigned char> compress_bc(const cv::Mat& cv_mat, const BlockFormat format, const int nr_threads){
+    cv::Mat rgba=to_rgba(cv_mat);
+    return compress_bc_rgba(rgba.ptr(), rgba.cols, rgba.rows, format, nr_threads);
+}
+
+
+//On disk layout of a cache entry: BcCacheHeader followed by the blocks
+struct BcCacheHeader{
+    char magic[8];
+    uint32_t encoder_version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint64_t size_bytes;
+};
+static_assert(sizeof(BcCacheHeader)==32, "BcCacheHeader should have no padding so it's the same on all compilers");
+#define EGL_BC_CACHE_MAGIC "EGLBC"
+
+//FNV-1a over the rows of the image
+static uint64_t hash_mat(const cv::Mat& cv_mat){
+    uint64_t hash=1469598103934665603ull;
+    size_t row_bytes=cv_mat.cols*cv_mat.elemSize();
+    for(int y=0; y<cv_mat.rows; y++){
+        const unsigned char* row=cv_mat.ptr(y);
+        for(size_t i=0; i<row_bytes; i++){
+            hash^=row[i];
+            hash*=1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+std::vector<unsigned char> compress_bc_cached(const cv::Mat& cv_mat, const BlockFormat format, const std::string& cache_dir, const int nr_threads){
+    CHECK(!cv_mat.empty()) << "The mat is empty";
+
+    //the hash includes everything that changes the output
+    uint64_t hash=hash_mat(cv_mat);
+    std::stringstream name;
+    name << std::hex << hash << "_" << cv_mat.cols << "x" << cv_mat.rows << "_t" << cv_mat.type() << "_bc" << std::dec << (int)format << "_v" << bc_encoder_version << ".bc";
+    std::string path=cache_dir + "/" + name.str();
+
+    {
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if(file.is_open()){
+            BcCacheHeader header;
+            file.read((char*)&header, sizeof(header));
+            bool valid= file.good()
+                && memcmp(header.magic, EGL_BC_CACHE_MAGIC, sizeof(EGL_BC_CACHE_MAGIC))==0
+                && header.encoder_version==bc_encoder_version
+                && header.format==(uint32_t)format
+                && header.width==(uint32_t)cv_mat.cols
+                && header.height==(uint32_t)cv_mat.rows
+                && header.size_bytes==(uint64_t)((cv_mat.cols+3)/4)*((cv_mat.rows+3)/4)*block_format_block_size_bytes(format);
+            if(valid){
+                std::vector<unsigned char> compressed(header.size_bytes);
+                file.read((char*)compressed.data(), header.size_bytes);
+                if(file.good()){
+                    return compressed;
+                }
+            }
+            LOG(WARNING) << "Block compression cache entry " << path << " is not valid. Encoding again";
+        }
+    }
+
+    std::vector<unsigned char> compressed=compress_bc(cv_mat, format, nr_threads);
+
+    //write into a temporary file and rename it so that other processes never read a half written entry
+    mkdir(cache_dir.c_str(), 0755);
+    std::string tmp_path=path + ".tmp" + std::to_string(getpid());
+    BcCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EGL_BC_CACHE_MAGIC, sizeof(EGL_BC_CACHE_MAGIC));
+    header.encoder_version=bc_encoder_version;
+    header.format=(uint32_t)format;
+    header.width=cv_mat.cols;
+    header.height=cv_mat.rows;
+    header.size_bytes=compressed.size();
+    std::ofstream file(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open()){
+        LOG(WARNING) << "Could not write block compression cache entry " << tmp_path;
+        return compressed;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)compressed.data(), compressed.size());
+    file.close();
+    if(!file.good() || std::rename(tmp_path.c_str(), path.c_str())!=0){
+        LOG(WARNING) << "Could not write block compression cache entry " << path;
+        std::remove(tmp_path.c_str());
+    }
+
+    return compressed;
+}
+
+
+} //namespace gl
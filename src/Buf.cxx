@@ -10,6 +10,7 @@
 #include <iostream>
 #include <vector>
 #include <cstring> //memcpy
+#include <algorithm>
 
 //loguru
 #define LOGURU_REPLACE_GLOG 1
@@ -22,6 +23,13 @@
 
 namespace gl{
 
+//glCopyBufferSubData through the copy targets, which don't disturb any other binding. glCopyNamedBufferSubData would be simpler but it needs GL 4.5 and the compute code built on Buf only needs 4.3
+static void copy_buffer_sub_data(const GLuint src_buf_id, const GLuint dst_buf_id, const GLintptr src_offset, const GLintptr dst_offset, const GLsizeiptr size_bytes){
+    glBindBuffer(GL_COPY_READ_BUFFER, src_buf_id);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, dst_buf_id);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src_offset, dst_offset, size_bytes);
+}
+
 Buf::Buf():
     m_width(0),
     m_height(0),
@@ -32,6 +40,14 @@ Buf::Buf():
     m_target(EGL_INVALID),
     m_usage_hints(EGL_INVALID),
     m_size_bytes(EGL_INVALID),
+    m_capacity_bytes(0),
+    m_inmutable_flags(0),
+    m_update_strategy(BufUpdateStrategy::Auto),
+    m_nr_consecutive_full_updates(0),
+    m_gpu_use_fence(nullptr),
+    m_gpu_use_tracked(false),
+    m_persistent_ptr(nullptr),
+    m_is_mapped_by_caller(false),
     m_is_cpu_dirty(false),
     m_is_gpu_dirty(false),
     m_cuda_transfer_enabled(false)
@@ -51,7 +67,69 @@ Buf::~Buf(){
         disable_cuda_transfer();
     #endif
 
-    glDeleteBuffers(1, &m_buf_id);
+    delete_gpu_use_fence();
+    //the persistent mapping gets released together with the buffer so no need to unmap
+    if(m_buf_id!=EGL_INVALID){
+        glDeleteBuffers(1, &m_buf_id);
+    }
+}
+
+Buf::Buf(Buf && other){
+    m_buf_id=EGL_INVALID;
+    m_gpu_use_fence=nullptr;
+    m_cuda_transfer_enabled=false;
+    move_from(other);
+}
+
+Buf & Buf::operator=(Buf && other){
+    if(this!=&other){
+        #ifdef EASYPBR_WITH_TORCH
+            disable_cuda_transfer();
+        #endif
+        delete_gpu_use_fence();
+        if(m_buf_id!=EGL_INVALID){
+            glDeleteBuffers(1, &m_buf_id);
+        }
+        move_from(other);
+    }
+    return *this;
+}
+
+//takes over everything that other owns and leaves it as if it had no buffer, so its destructor releases nothing
+void Buf::move_from(Buf& other){
+    m_width=other.m_width;
+    m_height=other.m_height;
+    m_depth=other.m_depth;
+    m_name=std::move(other.m_name);
+    m_buf_id=other.m_buf_id;
+    m_buf_storage_initialized=other.m_buf_storage_initialized;
+    m_buf_is_inmutable=other.m_buf_is_inmutable;
+    m_type=other.m_type;
+    m_target=other.m_target;
+    m_usage_hints=other.m_usage_hints;
+    m_size_bytes=other.m_size_bytes;
+    m_capacity_bytes=other.m_capacity_bytes;
+    m_inmutable_flags=other.m_inmutable_flags;
+    m_update_strategy=other.m_update_strategy;
+    m_update_stats=other.m_update_stats;
+    m_nr_consecutive_full_updates=other.m_nr_consecutive_full_updates;
+    m_gpu_use_fence=other.m_gpu_use_fence;
+    m_gpu_use_tracked=other.m_gpu_use_tracked;
+    m_persistent_ptr=other.m_persistent_ptr;
+    m_is_mapped_by_caller=other.m_is_mapped_by_caller;
+    m_is_cpu_dirty=other.m_is_cpu_dirty;
+    m_is_gpu_dirty=other.m_is_gpu_dirty;
+    m_cuda_transfer_enabled=other.m_cuda_transfer_enabled;
+    m_cuda_resource=other.m_cuda_resource;
+
+    other.m_buf_id=EGL_INVALID;
+    other.m_buf_storage_initialized=false;
+    other.m_gpu_use_fence=nullptr;
+    other.m_gpu_use_tracked=false;
+    other.m_persistent_ptr=nullptr;
+    other.m_is_mapped_by_caller=false;
+    other.m_cuda_transfer_enabled=false;
+    other.m_cuda_resource=nullptr;
 }
 
 //rule of five (make the class non copyable)
@@ -135,7 +213,7 @@ void Buf::orphan(){
         }
     #endif
 
-    glBufferData(m_target, m_size_bytes, NULL, m_usage_hints);
+    glBufferData(m_target, m_capacity_bytes, NULL, m_usage_hints);
 
     #ifdef EASYPBR_WITH_TORCH
         if (m_cuda_transfer_enabled){
@@ -160,6 +238,7 @@ void Buf::allocate_storage(const GLsizei size_bytes, const GLenum usage_hints ){
     glBufferData(m_target, size_bytes, NULL, usage_hints);
 
     m_size_bytes=size_bytes;
+    m_capacity_bytes=size_bytes;
     m_usage_hints=usage_hints;
     m_buf_storage_initialized=true;
 
@@ -173,58 +252,25 @@ void Buf::allocate_storage(const GLsizei size_bytes, const GLenum usage_hints ){
 
 void Buf::upload_data(const GLenum target, const GLsizei size_bytes, const void* data_ptr, const GLenum usage_hints ){
     if(m_buf_is_inmutable) LOG(FATAL) << named("Storage is inmutable so you cannot use glBufferData. You need to use glBufferStorage");
-    if(size_bytes==0) return;
-
-    glBindBuffer(target, m_buf_id);
-
-    #ifdef EASYPBR_WITH_TORCH
-        if (m_cuda_transfer_enabled){
-            unregister_cuda();
-        }
-    #endif
-
-
-    glBufferData(target, size_bytes, data_ptr, usage_hints);
-
-    m_target=target;
-    m_size_bytes=size_bytes;
-    m_usage_hints=usage_hints;
-    m_buf_storage_initialized=true;
+    //uploading nothing empties the buffer but keeps the capacity for the next upload
+    if(size_bytes==0){
+        if(m_buf_storage_initialized) m_size_bytes=0;
+        return;
+    }
 
-    //update the cuda resource since we have changed the memory of the texture
-    #ifdef EASYPBR_WITH_TORCH
-        if (m_cuda_transfer_enabled){
-            register_for_cuda();
-        }
-    #endif
+    upload_data_with_growth(target, size_bytes, data_ptr, usage_hints);
 }
 
 //same as above but without specifying the target as we use the one that is already set
 void Buf::upload_data(const GLsizei size_bytes, const void* data_ptr, const GLenum usage_hints ){
     if(m_buf_is_inmutable) LOG(FATAL) << named("Storage is inmutable so you cannot use glBufferData. You need to use glBufferStorage");
     if(m_target==EGL_INVALID)  LOG(FATAL) << named("Target not set. Use upload_data or allocate_inmutable first");
-    if(size_bytes==0) return;
-
-    glBindBuffer(m_target, m_buf_id);
-
-    #ifdef EASYPBR_WITH_TORCH
-        if (m_cuda_transfer_enabled){
-            unregister_cuda();
-        }
-    #endif
-
-    glBufferData(m_target, size_bytes, data_ptr, usage_hints);
-
-    m_size_bytes=size_bytes;
-    m_usage_hints=usage_hints;
-    m_buf_storage_initialized=true;
+    if(size_bytes==0){
+        if(m_buf_storage_initialized) m_size_bytes=0;
+        return;
+    }
 
-    //update the cuda resource since we have changed the memory of the texture
-    #ifdef EASYPBR_WITH_TORCH
-        if (m_cuda_transfer_enabled){
-            register_for_cuda();
-        }
-    #endif
+    upload_data_with_growth(m_target, size_bytes, data_ptr, usage_hints);
 }
 
 
@@ -233,27 +279,30 @@ void Buf::upload_data(const GLsizei size_bytes, const void* data_ptr ){
     if(m_buf_is_inmutable) LOG(FATAL) << named("Storage is inmutable so you cannot use glBufferData. You need to use glBufferStorage");
     if(m_target==EGL_INVALID)  LOG(FATAL) << named("Target not set. Use upload_data or allocate_inmutable first");
     if(m_usage_hints==EGL_INVALID) LOG(FATAL) << named("Usage hints have not been assigned. They will get assign by using upload_data.");
-    if(size_bytes==0) return;
+    if(size_bytes==0){
+        if(m_buf_storage_initialized) m_size_bytes=0;
+        return;
+    }
 
-    glBindBuffer(m_target, m_buf_id);
+    upload_data_with_growth(m_target, size_bytes, data_ptr, m_usage_hints);
+}
 
-    #ifdef EASYPBR_WITH_TORCH
-        if (m_cuda_transfer_enabled){
-            unregister_cuda();
-        }
-    #endif
+//makes sure the storage can hold at least capacity_bytes without reallocating. Like std::vector::reserve it keeps the current contents
+void Buf::reserve(const GLsizei capacity_bytes){
+    if(m_buf_is_inmutable) LOG(FATAL) << named("Storage is inmutable so it cannot be reallocated. You need to use glBufferStorage");
+    if(m_target==EGL_INVALID)  LOG(FATAL) << named("Target not set. Use set_target or upload_data first");
+    if(capacity_bytes<=m_capacity_bytes) return;
 
-    glBufferData(m_target, size_bytes, data_ptr, m_usage_hints);
+    GLenum usage_hints= m_usage_hints==EGL_INVALID? GL_DYNAMIC_DRAW : m_usage_hints;
+    reallocate_keeping_contents(capacity_bytes, usage_hints);
+}
 
-    m_size_bytes=size_bytes;
-    m_buf_storage_initialized=true;
+//reallocates the storage so that the capacity is the same as the size
+void Buf::shrink_to_fit(){
+    if(m_buf_is_inmutable) LOG(FATAL) << named("Storage is inmutable so it cannot be reallocated. You need to use glBufferStorage");
+    if(!m_buf_storage_initialized || m_capacity_bytes==m_size_bytes) return;
 
-    //update the cuda resource since we have changed the memory of the texture
-    #ifdef EASYPBR_WITH_TORCH
-        if (m_cuda_transfer_enabled){
-            register_for_cuda();
-        }
-    #endif
+    reallocate_keeping_contents(m_size_bytes, m_usage_hints);
 }
 
 void Buf::upload_sub_data(const GLenum target, const GLintptr offset, const GLsizei size_bytes, const void* data_ptr){
@@ -281,11 +330,116 @@ void Buf::upload_sub_data( const GLsizei size_bytes, const void* data_ptr){
     glBufferSubData(m_target, 0, size_bytes, data_ptr);
 }
 
+//writes a range of the buffer choosing the cheapest way to do it (see BufUpdateStrategy). The buffer needs to have storage already and the range has to fit in it
+void Buf::update(const GLintptr offset, const GLsizei size_bytes, const void* data_ptr){
+    if(!m_buf_storage_initialized) LOG(FATAL) << named("Buffer has no storage initialized. Use upload_data, or allocate_inmutable.");
+    if(m_target==EGL_INVALID)  LOG(FATAL) << named("Target not set. Use upload_data or allocate_inmutable first");
+    CHECK(offset>=0 && offset+size_bytes<=m_size_bytes) << named("Update range is outside of the buffer. Offset is ") << offset << " size is " << size_bytes << " but the buffer has " << m_size_bytes << " bytes";
+    if(size_bytes==0) return;
+
+    BufUpdateStrategy strategy= m_update_strategy==BufUpdateStrategy::Auto? choose_update_strategy(offset, size_bytes) : m_update_strategy;
+    //without mark_gpu_use() we don't know when the gpu is done so the driver has to syncronize the map
+    if(strategy==BufUpdateStrategy::UnsynchronizedMap && !m_gpu_use_tracked){
+        strategy=BufUpdateStrategy::SynchronizedMap;
+    }
+
+    glBindBuffer(m_target, m_buf_id);
+
+    if(strategy==BufUpdateStrategy::SubData){
+        CHECK(!m_buf_is_inmutable || (m_inmutable_flags & GL_DYNAMIC_STORAGE_BIT)) << named("Cannot use glBufferSubData because the inmutable storage was allocated without GL_DYNAMIC_STORAGE_BIT");
+        glBufferSubData(m_target, offset, size_bytes, data_ptr);
+        m_update_stats.nr_sub_data++;
+
+    }else if(strategy==BufUpdateStrategy::Orphan){
+        CHECK(offset==0 && size_bytes==m_size_bytes) << named("Orphaning throws away the contents so it can only be used when rewriting the whole buffer");
+        check_not_mapped_by_caller();
+        orphan();
+        //the new storage is not used by the gpu yet so there is nothing to wait for
+        delete_gpu_use_fence();
+        void* ptr=glMapBufferRange(m_target, 0, size_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        CHECK(ptr!=nullptr) << named("glMapBufferRange failed when writing into the orphaned buffer");
+        memcpy(ptr, data_ptr, size_bytes);
+        glUnmapBuffer(m_target);
+        m_update_stats.nr_orphan++;
+
+    }else if(strategy==BufUpdateStrategy::SynchronizedMap){
+        CHECK(!m_buf_is_inmutable || (m_inmutable_flags & GL_MAP_WRITE_BIT)) << named("Cannot map the buffer for writing because the inmutable storage was allocated without GL_MAP_WRITE_BIT");
+        check_not_mapped_by_caller();
+        release_persistent_mapping();
+        glBindBuffer(m_target, m_buf_id);
+        void* ptr=glMapBufferRange(m_target, offset, size_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        CHECK(ptr!=nullptr) << named("glMapBufferRange failed for the syncronized write");
+        memcpy(ptr, data_ptr, size_bytes);
+        glUnmapBuffer(m_target);
+        m_update_stats.nr_synchronized_map++;
+
+    }else if(strategy==BufUpdateStrategy::UnsynchronizedMap){
+        CHECK(!m_buf_is_inmutable || (m_inmutable_flags & GL_MAP_WRITE_BIT)) << named("Cannot map the buffer for writing because the inmutable storage was allocated without GL_MAP_WRITE_BIT");
+        check_not_mapped_by_caller();
+        release_persistent_mapping();
+        glBindBuffer(m_target, m_buf_id);
+        wait_for_gpu_use();
+        void* ptr=glMapBufferRange(m_target, offset, size_bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        CHECK(ptr!=nullptr) << named("glMapBufferRange failed for the unsynchronized write");
+        memcpy(ptr, data_ptr, size_bytes);
+        glUnmapBuffer(m_target);
+        m_update_stats.nr_unsynchronized_map++;
+
+    }else if(strategy==BufUpdateStrategy::Persistent){
+        CHECK(m_buf_is_inmutable && (m_inmutable_flags & GL_MAP_PERSISTENT_BIT) && (m_inmutable_flags & GL_MAP_WRITE_BIT)) << named("The Persistent strategy needs inmutable storage allocated with GL_MAP_PERSISTENT_BIT and GL_MAP_WRITE_BIT");
+        bool is_coherent= m_inmutable_flags & GL_MAP_COHERENT_BIT;
+        if(!m_persistent_ptr){
+            GLbitfield access=GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | (is_coherent? GL_MAP_COHERENT_BIT : GL_MAP_FLUSH_EXPLICIT_BIT);
+            m_persistent_ptr=map_range(0, m_capacity_bytes, access);
+            m_is_mapped_by_caller=false; //this mapping is ours so we can release it whenever we need to map again
+        }
+        wait_for_gpu_use();
+        memcpy((unsigned char*)m_persistent_ptr+offset, data_ptr, size_bytes);
+        if(!is_coherent){
+            glFlushMappedBufferRange(m_target, offset, size_bytes);
+        }
+        m_update_stats.nr_persistent++;
+    }
+
+    m_update_stats.nr_updates++;
+    m_update_stats.bytes_updated+=size_bytes;
+    m_update_stats.last_strategy=strategy;
+}
+
+//inserts a fence after the commands that read the buffer, for example after the draws of this frame. Once it signals update() can write without syncronization
+void Buf::mark_gpu_use(){
+    delete_gpu_use_fence();
+    m_gpu_use_fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_gpu_use_tracked=true;
+}
+
+void Buf::set_update_strategy(const BufUpdateStrategy strategy){
+    m_update_strategy=strategy;
+}
+
+BufUpdateStrategy Buf::update_strategy() const{
+    return m_update_strategy;
+}
+
+BufUpdateStats Buf::update_stats() const{
+    return m_update_stats;
+}
+
+void Buf::reset_update_stats(){
+    m_update_stats=BufUpdateStats();
+}
+
 void Buf::bind_for_modify(const GLint uniform_location){
     if(m_target==EGL_INVALID)  LOG(FATAL) << named("Target not set. Use upload_data or allocate_inmutable first");
     if(uniform_location==EGL_INVALID)  LOG(WARNING) << named("Uniform location does not exist");
 
-    glBindBufferBase(m_target, uniform_location, m_buf_id);
+    //the storage can be bigger than the bytes in use so we bind only those. An empty buffer would expose all the stale bytes of its capacity
+    CHECK(!m_buf_storage_initialized || m_size_bytes>0) << named("The buffer is empty so it cannot be bound. Upload something into it first");
+    if(m_buf_storage_initialized && m_size_bytes<m_capacity_bytes){
+        glBindBufferRange(m_target, uniform_location, m_buf_id, 0, m_size_bytes);
+    }else{
+        glBindBufferBase(m_target, uniform_location, m_buf_id);
+    }
 }
 
 
@@ -303,9 +457,13 @@ void Buf::allocate_inmutable( const GLenum target,  const GLsizei size_bytes, co
     #endif
 
     glBufferStorage(target, size_bytes, data_ptr, flags);
+    m_inmutable_flags=flags;
+    m_persistent_ptr=nullptr;
+    m_is_mapped_by_caller=false;
 
     m_target=target;
     m_size_bytes=size_bytes;
+    m_capacity_bytes=size_bytes;
     m_buf_is_inmutable=true;
     m_buf_storage_initialized=true;
 
@@ -330,8 +488,12 @@ void Buf::allocate_inmutable(const GLsizei size_bytes, const void* data_ptr, con
     #endif
 
     glBufferStorage(m_target, size_bytes, data_ptr, flags);
+    m_inmutable_flags=flags;
+    m_persistent_ptr=nullptr;
+    m_is_mapped_by_caller=false;
 
     m_size_bytes=size_bytes;
+    m_capacity_bytes=size_bytes;
     m_buf_is_inmutable=true;
     m_buf_storage_initialized=true;
 
@@ -343,6 +505,59 @@ void Buf::allocate_inmutable(const GLsizei size_bytes, const void* data_ptr, con
     #endif
 }
 
+//copies bytes from another buffer (or from another part of this one) without going through the cpu
+void Buf::copy_from(const Buf& src, const GLintptr src_offset, const GLintptr dst_offset, const GLsizeiptr size_bytes){
+    if(!src.m_buf_storage_initialized) LOG(FATAL) << named("Source buffer ") << src.name() << " has no storage initialized";
+    if(!m_buf_storage_initialized) LOG(FATAL) << named("Buffer has no storage initialized. Use upload_data, or allocate_inmutable.");
+    CHECK(src_offset>=0 && src_offset+size_bytes<=src.m_size_bytes) << named("Copy range is outside of the source buffer. Offset is ") << src_offset << " size is " << size_bytes << " but the source has " << src.m_size_bytes << " bytes";
+    CHECK(dst_offset>=0 && dst_offset+size_bytes<=m_size_bytes) << named("Copy range is outside of the buffer. Offset is ") << dst_offset << " size is " << size_bytes << " but the buffer has " << m_size_bytes << " bytes";
+    CHECK(&src!=this || src_offset+size_bytes<=dst_offset || dst_offset+size_bytes<=src_offset) << named("Copying inside the same buffer requires the source and destination ranges to not overlap");
+    if(size_bytes==0) return;
+
+    copy_buffer_sub_data(src.m_buf_id, m_buf_id, src_offset, dst_offset, size_bytes);
+}
+
+//many copies from the same source, done in the order they are given. Consecutive regions that are contiguous in both buffers get merged into one copy
+void Buf::copy_regions(const Buf& src, const std::vector<BufCopyRegion>& regions){
+    if(regions.empty()) return;
+
+    //inside the same buffer a copy could read the bytes written by another one, so none of the regions we read can overlap the ones we write
+    if(&src==this){
+        std::vector< std::pair<GLintptr, GLintptr> > dst_ranges; //start and end
+        for(size_t i=0; i<regions.size(); i++){
+            if(regions[i].size_bytes>0){
+                dst_ranges.push_back(std::make_pair(regions[i].dst_offset, regions[i].dst_offset+regions[i].size_bytes));
+            }
+        }
+        std::sort(dst_ranges.begin(), dst_ranges.end());
+        //biggest end seen so far, so that a range starting before src_end but ending after src_start is found even if a longer one came before it
+        std::vector<GLintptr> max_end(dst_ranges.size());
+        for(size_t i=0; i<dst_ranges.size(); i++){
+            max_end[i]= i==0? dst_ranges[i].second : std::max(max_end[i-1], dst_ranges[i].second);
+        }
+        for(size_t i=0; i<regions.size(); i++){
+            const BufCopyRegion& r=regions[i];
+            if(r.size_bytes==0) continue;
+            //the dst ranges that start before the end of this src range overlap it if any of them ends after its start
+            size_t nr_before=std::lower_bound(dst_ranges.begin(), dst_ranges.end(), std::make_pair(r.src_offset+r.size_bytes, (GLintptr)0)) - dst_ranges.begin();
+            CHECK(nr_before==0 || max_end[nr_before-1]<=r.src_offset) << named("Region ") << i << " reads bytes [" << r.src_offset << ", " << r.src_offset+r.size_bytes << ") that another region writes. Copying inside the same buffer requires the source and destination regions to not overlap";
+        }
+    }
+
+    BufCopyRegion merged=regions[0];
+    for(size_t i=1; i<regions.size(); i++){
+        const BufCopyRegion& r=regions[i];
+        bool is_contiguous= r.src_offset==merged.src_offset+merged.size_bytes && r.dst_offset==merged.dst_offset+merged.size_bytes;
+        if(is_contiguous){
+            merged.size_bytes+=r.size_bytes;
+        }else{
+            copy_from(src, merged.src_offset, merged.dst_offset, merged.size_bytes);
+            merged=r;
+        }
+    }
+    copy_from(src, merged.src_offset, merged.dst_offset, merged.size_bytes);
+}
+
 //clear the dat assuming the buffer is composed of floats and only 1 per element
 void Buf::clear_to_float(const float val){
     CHECK(m_buf_storage_initialized) << "Buffer storage not initialized. Use allocate_inmutable or upload_data first";
@@ -351,6 +566,45 @@ void Buf::clear_to_float(const float val){
     glClearNamedBufferSubData( m_buf_id, GL_R32F, 0, m_size_bytes, GL_RED, GL_FLOAT, clear_color.data() );
 }
 
+//maps a range of the buffer and returns a cpu pointer into it. For persistent mappings the storage has to be allocated with allocate_inmutable and the GL_MAP_PERSISTENT_BIT
+void* Buf::map_range(const GLintptr offset, const GLsizeiptr size_bytes, const GLbitfield access){
+    if(!m_buf_storage_initialized) LOG(FATAL) << named("Buffer has no storage initialized. Use upload_data, or allocate_inmutable.");
+    if(m_target==EGL_INVALID)  LOG(FATAL) << named("Target not set. Use upload_data or allocate_inmutable first");
+    CHECK(offset>=0 && offset+size_bytes<=m_capacity_bytes) << named("Mapping range is outside of the buffer. Offset is ") << offset << " size is " << size_bytes << " but the buffer has " << m_capacity_bytes << " bytes";
+
+    //a buffer can only be mapped once so the mapping kept by the Persistent strategy has to go. update() maps it again when needed
+    check_not_mapped_by_caller();
+    release_persistent_mapping();
+    glBindBuffer(m_target, m_buf_id);
+    void* ptr=glMapBufferRange(m_target, offset, size_bytes, access);
+    CHECK(ptr!=nullptr) << named("glMapBufferRange failed. Check that the access flags are compatible with the flags used when allocating the storage");
+    m_is_mapped_by_caller=true;
+    return ptr;
+}
+
+void Buf::unmap(){
+    if(m_target==EGL_INVALID)  LOG(FATAL) << named("Target not set. Use upload_data or allocate_inmutable first");
+
+    glBindBuffer(m_target, m_buf_id);
+    glUnmapBuffer(m_target);
+    //if it was the mapping of the Persistent strategy it's gone now
+    m_persistent_ptr=nullptr;
+    m_is_mapped_by_caller=false;
+}
+
+//a mapping returned by map_range(), for example the one of a StreamBuf, is used by the caller so we cannot unmap it to map the buffer again ourselves
+void Buf::check_not_mapped_by_caller() const{
+    CHECK(!m_is_mapped_by_caller) << named("The buffer is still mapped through map_range() and it can only be mapped once. Call unmap() first or copy the data with copy_from() or download_async()");
+}
+
+void Buf::release_persistent_mapping(){
+    if(m_persistent_ptr){
+        glBindBuffer(m_target, m_buf_id);
+        glUnmapBuffer(m_target);
+        m_persistent_ptr=nullptr;
+    }
+}
+
 
 #ifdef EASYPBR_WITH_TORCH
     void Buf::from_tensor(torch::Tensor& tensor){
@@ -365,9 +619,9 @@ void Buf::clear_to_float(const float val){
         size_t nr_bytes_tensor=nr_elements_tensor* elementSize( tensor.scalar_type() );
 
 
-        //if the buffer already has the correct size we just copy into it
-        if(m_buf_storage_initialized && nr_bytes_tensor==(size_t)m_size_bytes){
-            //nothing to do here
+        //if the buffer already has the correct size we just copy into it. We check the capacity because that is what cuda sees when it maps the buffer
+        if(m_buf_storage_initialized && nr_bytes_tensor==(size_t)m_capacity_bytes){
+            m_size_bytes=nr_bytes_tensor; //the whole capacity gets written
 
         }else{
             //we allocate a new bufffer with the corresponding size
@@ -454,7 +708,8 @@ void Buf::clear_to_float(const float val){
         void *buf_data_ptr;
         size_t size_vieweable_by_cuda;
         cudaGraphicsResourceGetMappedPointer(&buf_data_ptr, &size_vieweable_by_cuda, m_cuda_resource);
-        CHECK(size_vieweable_by_cuda==nr_bytes_tensor) << "nr_bytes_tensor and size_vieweable_by_cuda should be the same. But nr_bytes_tensor is " << nr_bytes_tensor << " size_vieweable_by_cuda is " << size_vieweable_by_cuda;
+        //the buffer can have more capacity than the size that is actually used
+        CHECK(size_vieweable_by_cuda>=nr_bytes_tensor) << "size_vieweable_by_cuda should be at least nr_bytes_tensor. But nr_bytes_tensor is " << nr_bytes_tensor << " size_vieweable_by_cuda is " << size_vieweable_by_cuda;
 
         //copy from tensor to tex_data_ptr http://leadsense.ilooktech.com/sdk/docs/page_samplewithopengl.html
         tensor=tensor.contiguous();
@@ -490,6 +745,10 @@ GLenum Buf::target() const {
     return m_target;
 }
 
+GLenum Buf::usage_hints() const {
+    return m_usage_hints;
+}
+
 int Buf::buf_id() const{
     return m_buf_id;
 }
@@ -498,6 +757,10 @@ bool Buf::storage_initialized () const{
     return m_buf_storage_initialized;
 }
 
+bool Buf::is_inmutable() const{
+    return m_buf_is_inmutable;
+}
+
 void Buf::set_cpu_dirty(const bool dirty){
     m_is_cpu_dirty=dirty;
 }
@@ -523,19 +786,298 @@ void Buf::set_depth(const int depth){
 int Buf::width() const{ LOG_IF(WARNING,m_width==0) << "Width of the buffer is 0"; return m_width; };
 int Buf::height() const{ LOG_IF(WARNING,m_height==0) << "Height of the buffer is 0";return m_height; };
 int Buf::depth() const{ LOG_IF(WARNING,m_depth==0) << "Depth of the buffer is 0";return m_depth; };
-int Buf::size_bytes(){
+int Buf::size_bytes() const{
     return m_size_bytes;
 }
+int Buf::capacity_bytes() const{
+    return m_capacity_bytes;
+}
+
+//if the data fits in the current storage we just overwrite it with glBufferSubData, otherwise we grow the storage geometrically like a std::vector so that buffers which change size a bit every frame stop reallocating
+void Buf::upload_data_with_growth(const GLenum target, const GLsizei size_bytes, const void* data_ptr, const GLenum usage_hints){
+    bool fits= m_buf_storage_initialized && usage_hints==m_usage_hints && size_bytes<=m_capacity_bytes;
+
+    glBindBuffer(target, m_buf_id);
+
+    if(fits){
+        if(data_ptr){
+            glBufferSubData(target, 0, size_bytes, data_ptr);
+        }
+    }else{
+        //first allocation is exact, afterwards we grow by 1.5x
+        GLsizei new_capacity=size_bytes;
+        if(m_buf_storage_initialized){
+            long long grown_capacity=(long long)m_capacity_bytes*3/2;
+            new_capacity=(GLsizei)std::min<long long>( std::max<long long>(size_bytes, grown_capacity), EGL_INVALID-1 );
+        }
+
+        #ifdef EASYPBR_WITH_TORCH
+            if (m_cuda_transfer_enabled){
+                unregister_cuda();
+            }
+        #endif
+
+        if(new_capacity==size_bytes){
+            glBufferData(target, size_bytes, data_ptr, usage_hints);
+        }else{
+            glBufferData(target, new_capacity, NULL, usage_hints);
+            if(data_ptr){
+                glBufferSubData(target, 0, size_bytes, data_ptr);
+            }
+        }
+        m_capacity_bytes=new_capacity;
+
+        //update the cuda resource since we have changed the memory of the buffer
+        #ifdef EASYPBR_WITH_TORCH
+            if (m_cuda_transfer_enabled){
+                register_for_cuda();
+            }
+        #endif
+    }
+
+    m_target=target;
+    m_size_bytes=size_bytes;
+    m_usage_hints=usage_hints;
+    m_buf_storage_initialized=true;
+}
+
+//allocates new storage with the new capacity and copies over the bytes that are currently used
+void Buf::reallocate_keeping_contents(const GLsizei new_capacity_bytes, const GLenum usage_hints){
+    bool has_contents= m_buf_storage_initialized && m_size_bytes!=EGL_INVALID && m_size_bytes>0;
+    GLsizei bytes_to_keep= has_contents? std::min(m_size_bytes, new_capacity_bytes) : 0;
+
+    //glBufferData throws away the contents so we stash them in a temporary buffer
+    GLuint tmp_buf_id=0;
+    if(bytes_to_keep>0){
+        glGenBuffers(1, &tmp_buf_id);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, tmp_buf_id);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes_to_keep, NULL, GL_STREAM_COPY);
+        copy_buffer_sub_data(m_buf_id, tmp_buf_id, 0, 0, bytes_to_keep);
+    }
+
+    #ifdef EASYPBR_WITH_TORCH
+        if (m_cuda_transfer_enabled){
+            unregister_cuda();
+        }
+    #endif
+
+    glBindBuffer(m_target, m_buf_id);
+    glBufferData(m_target, new_capacity_bytes, NULL, usage_hints);
+
+    if(bytes_to_keep>0){
+        copy_buffer_sub_data(tmp_buf_id, m_buf_id, 0, 0, bytes_to_keep);
+        glDeleteBuffers(1, &tmp_buf_id);
+    }
+
+    #ifdef EASYPBR_WITH_TORCH
+        if (m_cuda_transfer_enabled){
+            register_for_cuda();
+        }
+    #endif
+
+    m_capacity_bytes=new_capacity_bytes;
+    m_size_bytes= has_contents? bytes_to_keep : 0;
+    m_usage_hints=usage_hints;
+    m_buf_storage_initialized=true;
+}
+
+//decides how update() writes the data. Inmutable storage is decided by its flags. For mutable storage we look at the pattern of the updates
+BufUpdateStrategy Buf::choose_update_strategy(const GLintptr offset, const GLsizei size_bytes){
+    if(m_buf_is_inmutable){
+        //writing through the persistent mapping is only safe if mark_gpu_use() tells us when the gpu is done with the buffer. If it's still busy or we don't know, we let the driver syncronize with glBufferSubData or a normal map
+        bool can_map_persistent= (m_inmutable_flags & GL_MAP_PERSISTENT_BIT) && (m_inmutable_flags & GL_MAP_WRITE_BIT);
+        if( can_map_persistent && m_gpu_use_tracked && is_gpu_done_with_buffer() ){
+            return BufUpdateStrategy::Persistent;
+        }else if(m_inmutable_flags & GL_DYNAMIC_STORAGE_BIT){
+            return BufUpdateStrategy::SubData;
+        }else if(can_map_persistent && m_gpu_use_tracked){
+            return BufUpdateStrategy::Persistent; //waits for the gpu
+        }else if(m_inmutable_flags & GL_MAP_WRITE_BIT){
+            return BufUpdateStrategy::SynchronizedMap;
+        }
+        LOG(FATAL) << named("The inmutable storage was allocated without GL_DYNAMIC_STORAGE_BIT or GL_MAP_WRITE_BIT so it cannot be updated");
+    }
+
+    bool is_full_update= offset==0 && size_bytes==m_size_bytes;
+    m_nr_consecutive_full_updates= is_full_update? m_nr_consecutive_full_updates+1 : 0;
+
+    //a buffer that keeps being rewritten completely is used for streaming so we orphan it and never wait for the gpu. The first full write may be a one off so we wait to see it a second time
+    if(is_full_update && m_nr_consecutive_full_updates>=2){
+        return BufUpdateStrategy::Orphan;
+    }
+    //small writes are cheapest with glBufferSubData as the driver just copies them into the command stream
+    const GLsizei min_bytes_for_map=64*1024;
+    if(size_bytes<min_bytes_for_map){
+        return BufUpdateStrategy::SubData;
+    }
+    //bigger partial writes go directly into the buffer if we know the gpu is done reading it
+    if(m_gpu_use_tracked && is_gpu_done_with_buffer()){
+        return BufUpdateStrategy::UnsynchronizedMap;
+    }
+    return BufUpdateStrategy::SubData;
+}
+
+//checks the fence from mark_gpu_use() without waiting. The fence is consumed by the first write that waits on it so without a fence we don't know if commands issued since then read the buffer
+bool Buf::is_gpu_done_with_buffer(){
+    if(!m_gpu_use_fence){
+        return false;
+    }
+    GLenum status=glClientWaitSync(m_gpu_use_fence, 0, 0);
+    return status==GL_ALREADY_SIGNALED || status==GL_CONDITION_SATISFIED;
+}
+
+//waits for the fence from mark_gpu_use() and counts a stall if it wasn't signaled yet
+void Buf::wait_for_gpu_use(){
+    //without mark_gpu_use() we would have to fence and wait for all the commands issued until now at every update, which is the same as a glFinish
+    CHECK(m_gpu_use_tracked) << named("Writing through the persistent mapping needs mark_gpu_use() after the commands that read the buffer. Call it or use the SubData or SynchronizedMap strategy");
+    //the fence was consumed by an earlier write since the last mark_gpu_use(). Commands issued after that mark may still read the buffer so we fence them too
+    if(!m_gpu_use_fence){
+        m_gpu_use_fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    GLenum status=glClientWaitSync(m_gpu_use_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if(status==GL_TIMEOUT_EXPIRED){
+        m_update_stats.nr_stalls++;
+        while(status==GL_TIMEOUT_EXPIRED){
+            status=glClientWaitSync(m_gpu_use_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); //1ms
+        }
+    }
+    LOG_IF(ERROR, status==GL_WAIT_FAILED) << named("Waiting for the gpu to finish using the buffer failed");
+
+    delete_gpu_use_fence();
+}
+
+void Buf::delete_gpu_use_fence(){
+    if(m_gpu_use_fence){
+        glDeleteSync(m_gpu_use_fence);
+        m_gpu_use_fence=nullptr;
+    }
+}
 
 //download from gpu to cpu
 void Buf::download(void* destination_data_ptr, const int bytes_to_copy){
     if(m_target==EGL_INVALID)  LOG(FATAL) << named("Target not set. Use upload_data or allocate_inmutable first");
     if(m_size_bytes==EGL_INVALID) LOG(FATAL) << named("Size have not been assigned. It will get assign by using upload_data.");
 
+    check_not_mapped_by_caller();
+    release_persistent_mapping();
     glBindBuffer(m_target, m_buf_id);
     void* ptr = (void*)glMapBuffer(m_target, GL_READ_ONLY);
     memcpy ( destination_data_ptr, ptr, bytes_to_copy );
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glUnmapBuffer(m_target);
+}
+
+BufDownload Buf::download_async(const GLintptr offset, const GLsizeiptr bytes) const{
+    BufDownload download;
+    download_async(download, offset, bytes);
+    return download;
+}
+
+//same as above but reuses the readback buffer of a previous download if it's big enough so we don't allocate a new one each time
+void Buf::download_async(BufDownload& download, const GLintptr offset, const GLsizeiptr bytes) const{
+    if(!m_buf_storage_initialized) LOG(FATAL) << named("Buffer has no storage initialized. Use upload_data, or allocate_inmutable.");
+    CHECK(bytes>0) << named("Cannot download ") << bytes << " bytes";
+    CHECK(offset>=0 && offset+bytes<=m_size_bytes) << named("Download range is outside of the buffer. Offset is ") << offset << " size is " << bytes << " but the buffer has " << m_size_bytes << " bytes";
+
+    //whatever the handle was waiting for before is not needed anymore
+    download.delete_fence();
+
+    //the readback buffer lives in client memory and stays mapped so reading it after the fence doesn't require any more syncronization
+    if(!download.m_readback_buf || download.m_readback_buf->m_size_bytes<bytes){
+        GLbitfield map_flags=GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        download.m_readback_buf.reset(new Buf(named("readback")));
+        download.m_readback_buf->allocate_inmutable(GL_COPY_WRITE_BUFFER, bytes, NULL, map_flags | GL_CLIENT_STORAGE_BIT);
+        download.m_mapped_ptr=download.m_readback_buf->map_range(0, bytes, map_flags);
+    }
+
+    //the copy happens on the gpu timeline so this returns inmediatelly
+    copy_buffer_sub_data(m_buf_id, download.m_readback_buf->m_buf_id, offset, 0, bytes);
+    download.m_fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    download.m_size_bytes=bytes;
+}
+
+
+
+BufDownload::BufDownload():
+    m_mapped_ptr(nullptr),
+    m_size_bytes(0),
+    m_fence(nullptr){
+}
+
+BufDownload::~BufDownload(){
+    delete_fence();
+}
+
+BufDownload::BufDownload(BufDownload && other):
+    m_readback_buf(std::move(other.m_readback_buf)),
+    m_mapped_ptr(other.m_mapped_ptr),
+    m_size_bytes(other.m_size_bytes),
+    m_fence(other.m_fence){
+    other.m_mapped_ptr=nullptr;
+    other.m_size_bytes=0;
+    other.m_fence=nullptr;
+}
+
+BufDownload& BufDownload::operator=(BufDownload && other){
+    if(this!=&other){
+        delete_fence();
+        m_readback_buf=std::move(other.m_readback_buf);
+        m_mapped_ptr=other.m_mapped_ptr;
+        m_size_bytes=other.m_size_bytes;
+        m_fence=other.m_fence;
+        other.m_mapped_ptr=nullptr;
+        other.m_size_bytes=0;
+        other.m_fence=nullptr;
+    }
+    return *this;
+}
+
+bool BufDownload::ready(){
+    if(!m_readback_buf){
+        return false;
+    }
+    if(m_fence){
+        //the flush makes sure the fence actually gets to the GPU, otherwise we could poll it forever
+        GLenum status=glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if(status==GL_TIMEOUT_EXPIRED){
+            return false;
+        }
+        LOG_IF(ERROR, status==GL_WAIT_FAILED) << "Waiting for the download fence failed";
+        delete_fence();
+    }
+    return true;
+}
+
+void BufDownload::wait(){
+    CHECK(m_readback_buf) << "No download was started into this handle. Use buf.download_async() first";
+    if(m_fence){
+        GLenum status=GL_TIMEOUT_EXPIRED;
+        while(status==GL_TIMEOUT_EXPIRED){
+            status=glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); //1ms
+        }
+        LOG_IF(ERROR, status==GL_WAIT_FAILED) << "Waiting for the download fence failed";
+        delete_fence();
+    }
+}
+
+const void* BufDownload::data(){
+    wait();
+    return m_mapped_ptr;
+}
+
+GLsizeiptr BufDownload::size_bytes() const{
+    return m_size_bytes;
+}
+
+bool BufDownload::has_download() const{
+    return m_readback_buf!=nullptr;
+}
+
+void BufDownload::delete_fence(){
+    if(m_fence){
+        glDeleteSync(m_fence);
+        m_fence=nullptr;
+    }
 }
 
 
@@ -0,0 +1,303 @@
+#include "easy_gl/BufArena.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+
+#include "easy_gl/Buf.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+BufArena::BufArena():
+    m_target(EGL_INVALID),
+    m_usage_hints(EGL_INVALID),
+    m_block_size_bytes(0),
+    m_alignment(16)
+    {
+}
+
+BufArena::BufArena(std::string name):
+    BufArena(){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+}
+
+BufArena::~BufArena(){
+}
+
+
+void BufArena::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string BufArena::name() const{
+    return m_name;
+}
+
+void BufArena::init(const GLenum target, const GLsizeiptr block_size_bytes, const GLenum usage_hints){
+    CHECK(m_blocks.empty()) << named("Arena was already initialized and has blocks allocated");
+    CHECK(block_size_bytes>0) << named("Block size should be positive but it is ") << block_size_bytes;
+
+    m_target=target;
+    m_usage_hints=usage_hints;
+
+    //every allocation might end up being bound with glBindBufferRange so we respect the strictest offset alignment
+    GLint ubo_alignment=16;
+    GLint ssbo_alignment=16;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ubo_alignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssbo_alignment);
+    m_alignment=std::max( {16, ubo_alignment, ssbo_alignment} );
+
+    m_block_size_bytes=align(block_size_bytes);
+}
+
+int BufArena::allocate(const GLsizeiptr size_bytes){
+    CHECK(m_target!=EGL_INVALID) << named("Arena is not initialized. Use init() first");
+    CHECK(size_bytes>0) << named("Cannot allocate ") << size_bytes << " bytes";
+
+    GLsizeiptr aligned_size=align(size_bytes);
+
+    //best fit over all the blocks, the smallest free range that can hold the allocation
+    int best_block=-1;
+    GLintptr best_offset=0;
+    GLsizeiptr best_size=0;
+    for(size_t i=0; i<m_blocks.size(); i++){
+        auto it=m_blocks[i].free_by_size.lower_bound( std::make_pair(aligned_size, (GLintptr)0) );
+        if(it!=m_blocks[i].free_by_size.end() && (best_block==-1 || it->first<best_size) ){
+            best_block=i;
+            best_size=it->first;
+            best_offset=it->second;
+        }
+    }
+
+    //nothing fits so we need a new block
+    if(best_block==-1){
+        best_block=create_block( std::max(m_block_size_bytes, aligned_size) );
+        best_offset=0;
+        best_size=m_blocks[best_block].size_bytes;
+    }
+
+    //take the allocation from the start of the free range and give back what is left
+    Block& block=m_blocks[best_block];
+    erase_free_range(block, best_offset);
+    if(best_size>aligned_size){
+        insert_free_range(block, best_offset+aligned_size, best_size-aligned_size);
+    }
+
+    int alloc_id;
+    if(!m_free_alloc_ids.empty()){
+        alloc_id=m_free_alloc_ids.back();
+        m_free_alloc_ids.pop_back();
+    }else{
+        alloc_id=m_allocations.size();
+        m_allocations.emplace_back();
+    }
+    Allocation& alloc=m_allocations[alloc_id];
+    alloc.block_idx=best_block;
+    alloc.offset=best_offset;
+    alloc.size_bytes=aligned_size;
+    alloc.in_use=true;
+
+    return alloc_id;
+}
+
+void BufArena::free(const int alloc_id){
+    CHECK(alloc_id>=0 && alloc_id<(int)m_allocations.size() && m_allocations[alloc_id].in_use) << named("Allocation id ") << alloc_id << " is not valid";
+
+    Allocation& alloc=m_allocations[alloc_id];
+    insert_free_range(m_blocks[alloc.block_idx], alloc.offset, alloc.size_bytes);
+    alloc.in_use=false;
+    m_free_alloc_ids.push_back(alloc_id);
+}
+
+BufRange BufArena::range(const int alloc_id) const{
+    CHECK(alloc_id>=0 && alloc_id<(int)m_allocations.size() && m_allocations[alloc_id].in_use) << named("Allocation id ") << alloc_id << " is not valid";
+
+    const Allocation& alloc=m_allocations[alloc_id];
+    BufRange range;
+    range.buf=m_blocks[alloc.block_idx].buf.get();
+    range.offset=alloc.offset;
+    range.size_bytes=alloc.size_bytes;
+    return range;
+}
+
+void BufArena::upload(const int alloc_id, const void* data_ptr, const GLsizeiptr size_bytes, const GLintptr offset_in_alloc){
+    CHECK(alloc_id>=0 && alloc_id<(int)m_allocations.size() && m_allocations[alloc_id].in_use) << named("Allocation id ") << alloc_id << " is not valid";
+
+    Allocation& alloc=m_allocations[alloc_id];
+    CHECK(offset_in_alloc>=0 && offset_in_alloc+size_bytes<=alloc.size_bytes) << named("Upload of ") << size_bytes << " bytes at offset " << offset_in_alloc << " does not fit in the allocation of " << alloc.size_bytes << " bytes";
+
+    m_blocks[alloc.block_idx].buf->upload_sub_data(alloc.offset+offset_in_alloc, size_bytes, data_ptr);
+}
+
+int BufArena::defragment(){
+    int nr_moved=0;
+
+    //gather the allocations of each block sorted by offset
+    std::vector< std::vector<int> > allocs_per_block(m_blocks.size());
+    for(size_t i=0; i<m_allocations.size(); i++){
+        if(m_allocations[i].in_use){
+            allocs_per_block[ m_allocations[i].block_idx ].push_back(i);
+        }
+    }
+
+    std::vector<Block> new_blocks;
+    for(size_t b=0; b<m_blocks.size(); b++){
+        std::vector<int>& allocs=allocs_per_block[b];
+        if(allocs.empty()){
+            continue; //block is empty so it gets released
+        }
+        std::sort(allocs.begin(), allocs.end(), [&](const int a, const int c){ return m_allocations[a].offset<m_allocations[c].offset; });
+
+        //see if the block is already packed
+        GLintptr packed_end=0;
+        bool is_packed=true;
+        for(size_t i=0; i<allocs.size(); i++){
+            if(m_allocations[allocs[i]].offset!=packed_end){
+                is_packed=false;
+            }
+            packed_end+=m_allocations[allocs[i]].size_bytes;
+        }
+
+        Block& old_block=m_blocks[b];
+        int new_block_idx=new_blocks.size();
+        if(is_packed){
+            new_blocks.push_back(std::move(old_block));
+        }else{
+            //the ranges can overlap when moving inside the same buffer so we copy everything into a new block instead
+            Block block;
+            block.size_bytes=old_block.size_bytes;
+            block.buf.reset(new Buf(named("arena_block")));
+            block.buf->set_target(m_target);
+            block.buf->allocate_storage(block.size_bytes, m_usage_hints);
+
+            GLintptr new_offset=0;
+            for(size_t i=0; i<allocs.size(); i++){
+                Allocation& alloc=m_allocations[allocs[i]];
+                block.buf->copy_from(*old_block.buf, alloc.offset, new_offset, alloc.size_bytes);
+                if(alloc.offset!=new_offset){
+                    nr_moved++;
+                }
+                alloc.offset=new_offset;
+                new_offset+=alloc.size_bytes;
+            }
+            new_blocks.push_back(std::move(block));
+        }
+
+        //everything after the packed allocations is one big free range
+        Block& block=new_blocks.back();
+        block.free_by_offset.clear();
+        block.free_by_size.clear();
+        if(packed_end<block.size_bytes){
+            insert_free_range(block, packed_end, block.size_bytes-packed_end);
+        }
+        for(size_t i=0; i<allocs.size(); i++){
+            m_allocations[allocs[i]].block_idx=new_block_idx;
+        }
+    }
+
+    m_blocks=std::move(new_blocks);
+
+    return nr_moved;
+}
+
+int BufArena::nr_blocks() const{
+    return m_blocks.size();
+}
+
+int BufArena::nr_allocations() const{
+    return m_allocations.size()-m_free_alloc_ids.size();
+}
+
+GLsizeiptr BufArena::block_size_bytes() const{
+    return m_block_size_bytes;
+}
+
+GLsizeiptr BufArena::allocated_bytes() const{
+    GLsizeiptr bytes=0;
+    for(size_t i=0; i<m_allocations.size(); i++){
+        if(m_allocations[i].in_use){
+            bytes+=m_allocations[i].size_bytes;
+        }
+    }
+    return bytes;
+}
+
+GLsizeiptr BufArena::free_bytes() const{
+    GLsizeiptr bytes=0;
+    for(size_t i=0; i<m_blocks.size(); i++){
+        for(auto& range : m_blocks[i].free_by_offset){
+            bytes+=range.second;
+        }
+    }
+    return bytes;
+}
+
+Buf& BufArena::block(const int block_idx){
+    CHECK(block_idx>=0 && block_idx<(int)m_blocks.size()) << named("Block idx ") << block_idx << " is out of range. We have " << m_blocks.size() << " blocks";
+    return *m_blocks[block_idx].buf;
+}
+
+int BufArena::create_block(const GLsizeiptr size_bytes){
+    Block block;
+    block.size_bytes=size_bytes;
+    block.buf.reset(new Buf(named("arena_block")));
+    block.buf->set_target(m_target);
+    block.buf->allocate_storage(size_bytes, m_usage_hints);
+    insert_free_range(block, 0, size_bytes);
+
+    m_blocks.push_back(std::move(block));
+    return m_blocks.size()-1;
+}
+
+void BufArena::insert_free_range(Block& block, GLintptr offset, GLsizeiptr size_bytes){
+    //merge with the free range that ends where this one starts
+    auto next=block.free_by_offset.lower_bound(offset);
+    if(next!=block.free_by_offset.begin()){
+        auto prev=std::prev(next);
+        if(prev->first+prev->second==offset){
+            offset=prev->first;
+            size_bytes+=prev->second;
+            erase_free_range(block, prev->first);
+        }
+    }
+    //merge with the free range that starts where this one ends
+    next=block.free_by_offset.find(offset+size_bytes);
+    if(next!=block.free_by_offset.end()){
+        size_bytes+=next->second;
+        erase_free_range(block, next->first);
+    }
+
+    block.free_by_offset[offset]=size_bytes;
+    block.free_by_size.insert( std::make_pair(size_bytes, offset) );
+}
+
+void BufArena::erase_free_range(Block& block, const GLintptr offset){
+    auto it=block.free_by_offset.find(offset);
+    CHECK(it!=block.free_by_offset.end()) << named("There is no free range at offset ") << offset;
+    block.free_by_size.erase( std::make_pair(it->second, it->first) );
+    block.free_by_offset.erase(it);
+}
+
+GLsizeiptr BufArena::align(const GLsizeiptr size_bytes) const{
+    return (size_bytes + m_alignment-1)/m_alignment*m_alignment;
+}
+
+
+std::string BufArena::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+} //namespace gl
@@ -229,6 +229,11 @@ Texture2D& GBuffer::tex_with_name(const std::string name){
     return m_textures[0]; //HACK because this line will never occur because the previous line will kill it but we just put it to shut up the compiler warning
 }
 
+void GBuffer::build_hiz(Texture2D& hiz, const TexMipOp op){
+    CHECK(m_has_depth_tex) << named("The gbuffer has no depth texture. Add one with add_depth()");
+    hiz.generate_hiz_from_depth(m_depth_tex, op);
+}
+
 bool GBuffer::has_tex_with_name(const std::string name){
     for(size_t i=0; i<m_textures.size(); i++){
         if(m_textures[i].name()==name){
@@ -0,0 +1,124 @@
+#include "easy_gl/GatherScatter.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <memory>
+#include <algorithm>
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Shader.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+//each invocation moves whole elements. The loop lets a limited nr of work groups cover any nr of indices
+static const char* gather_scatter_comp_src = R"(
+    #version 430
+    layout(local_size_x=256) in;
+
+    layout(std430) readonly buffer src_buf{ uint src[]; };
+    layout(std430) writeonly buffer dst_buf{ uint dst[]; };
+    layout(std430) readonly buffer indices_buf{ uint indices[]; };
+
+    uniform int nr_indices;
+    uniform int words_per_element;
+    uniform int nr_src_elements;
+    uniform int nr_dst_elements;
+    uniform bool is_scatter;
+
+    void main(){
+        uint stride=gl_NumWorkGroups.x*gl_WorkGroupSize.x;
+        for(uint i=gl_GlobalInvocationID.x; i<uint(nr_indices); i+=stride){
+            uint src_elem= is_scatter? i : indices[i];
+            uint dst_elem= is_scatter? indices[i] : i;
+            if(src_elem>=uint(nr_src_elements) || dst_elem>=uint(nr_dst_elements)){
+                continue;
+            }
+            uint w_per_elem=uint(words_per_element);
+            for(uint w=0; w<w_per_elem; w++){
+                dst[dst_elem*w_per_elem+w]=src[src_elem*w_per_elem+w];
+            }
+        }
+    }
+)";
+
+GatherScatter::GatherScatter(){
+}
+
+GatherScatter::GatherScatter(std::string name):
+    GatherScatter(){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+}
+
+GatherScatter::~GatherScatter(){
+}
+
+
+void GatherScatter::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string GatherScatter::name() const{
+    return m_name;
+}
+
+void GatherScatter::gather(const Buf& src, const Buf& indices, Buf& dst, const int element_size_bytes, const int nr_indices){
+    run(src, indices, dst, element_size_bytes, nr_indices, false);
+}
+
+void GatherScatter::scatter(const Buf& src, const Buf& indices, Buf& dst, const int element_size_bytes, const int nr_indices){
+    run(src, indices, dst, element_size_bytes, nr_indices, true);
+}
+
+void GatherScatter::run(const Buf& src, const Buf& indices, Buf& dst, const int element_size_bytes, const int nr_indices, const bool is_scatter){
+    CHECK(src.storage_initialized() && indices.storage_initialized() && dst.storage_initialized()) << named("The source, indices and destination buffers all need storage");
+    CHECK(element_size_bytes>0 && element_size_bytes%4==0) << named("Element size has to be a multiple of 4 bytes but it is ") << element_size_bytes;
+
+    int nr_indices_available=indices.size_bytes()/sizeof(uint32_t);
+    int nr_indices_used= nr_indices==-1? nr_indices_available : nr_indices;
+    CHECK(nr_indices_used<=nr_indices_available) << named("We want to use ") << nr_indices_used << " indices but the index buffer only has " << nr_indices_available;
+    int nr_src_elements=src.size_bytes()/element_size_bytes;
+    int nr_dst_elements=dst.size_bytes()/element_size_bytes;
+    if(!is_scatter){
+        CHECK(nr_indices_used<=nr_dst_elements) << named("Gathering ") << nr_indices_used << " elements but the destination only has space for " << nr_dst_elements;
+    }else{
+        CHECK(nr_indices_used<=nr_src_elements) << named("Scattering ") << nr_indices_used << " elements but the source only has " << nr_src_elements;
+    }
+    if(nr_indices_used==0) return;
+
+    if(!m_shader){
+        m_shader.reset(new Shader(named("gather_scatter")));
+        m_shader->compile_from_source(gather_scatter_comp_src);
+    }
+
+    m_shader->use();
+    m_shader->bind_buffer(src, GL_SHADER_STORAGE_BUFFER, "src_buf");
+    m_shader->bind_buffer(dst, GL_SHADER_STORAGE_BUFFER, "dst_buf");
+    m_shader->bind_buffer(indices, GL_SHADER_STORAGE_BUFFER, "indices_buf");
+    m_shader->uniform_int(nr_indices_used, "nr_indices");
+    m_shader->uniform_int(element_size_bytes/4, "words_per_element");
+    m_shader->uniform_int(nr_src_elements, "nr_src_elements");
+    m_shader->uniform_int(nr_dst_elements, "nr_dst_elements");
+    m_shader->uniform_bool(is_scatter, "is_scatter");
+
+    //the shader loops over the indices so we don't need more groups than the maximum allowed in x
+    const int local_size=256;
+    int total_x=std::min(nr_indices_used, 65535*local_size);
+    m_shader->dispatch(total_x, 1, local_size, 1);
+}
+
+
+std::string GatherScatter::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+} //namespace gl
@@ -0,0 +1,362 @@
+#include "easy_gl/MeshFile.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <cstring> //memcpy, strncpy
+
+//mmap
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Shader.h"
+#include "easy_gl/VertexArrayObject.h"
+#include "easy_gl/UtilsGL.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+//the offsets are 64 bit because the files can be bigger than what round_up_to_nearest_multiple can handle
+static uint64_t align_offset(const uint64_t offset){
+    return (offset + EGL_MESH_FILE_ALIGNMENT-1)/EGL_MESH_FILE_ALIGNMENT*EGL_MESH_FILE_ALIGNMENT;
+}
+
+//the types gl_attribute_size_bytes() knows. The header of a file can have anything so we check them before using them
+static bool is_valid_attribute_type(const uint32_t type){
+    switch(type){
+        case GL_BYTE: case GL_UNSIGNED_BYTE: case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT:
+        case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT: case GL_FIXED: case GL_DOUBLE:
+        case GL_INT_2_10_10_10_REV: case GL_UNSIGNED_INT_2_10_10_10_REV: case GL_UNSIGNED_INT_10F_11F_11F_REV:
+            return true;
+    }
+    return false;
+}
+
+static bool is_valid_index_type(const uint32_t type){
+    return type==GL_UNSIGNED_INT || type==GL_UNSIGNED_SHORT || type==GL_UNSIGNED_BYTE;
+}
+
+MeshFile::MeshFile():
+    m_mapped_ptr(nullptr),
+    m_mapped_size_bytes(0)
+    {
+    memset(&m_header, 0, sizeof(m_header));
+    memset(&m_pending_indices.desc, 0, sizeof(m_pending_indices.desc));
+}
+
+MeshFile::MeshFile(std::string name):
+    MeshFile(){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+}
+
+MeshFile::~MeshFile(){
+    close();
+}
+
+MeshFile::MeshFile(MeshFile && other):
+    m_name(std::move(other.m_name)),
+    m_pending_attributes(std::move(other.m_pending_attributes)),
+    m_pending_indices(other.m_pending_indices),
+    m_mapped_ptr(other.m_mapped_ptr),
+    m_mapped_size_bytes(other.m_mapped_size_bytes),
+    m_header(other.m_header),
+    m_attributes(std::move(other.m_attributes)),
+    m_bufs(std::move(other.m_bufs)),
+    m_index_buf(std::move(other.m_index_buf))
+    {
+    other.m_mapped_ptr=nullptr;
+    other.m_mapped_size_bytes=0;
+}
+
+MeshFile & MeshFile::operator=(MeshFile && other){
+    if(this!=&other){
+        close();
+        m_name=std::move(other.m_name);
+        m_pending_attributes=std::move(other.m_pending_attributes);
+        m_pending_indices=other.m_pending_indices;
+        m_mapped_ptr=other.m_mapped_ptr;
+        m_mapped_size_bytes=other.m_mapped_size_bytes;
+        m_header=other.m_header;
+        m_attributes=std::move(other.m_attributes);
+        m_bufs=std::move(other.m_bufs);
+        m_index_buf=std::move(other.m_index_buf);
+        other.m_mapped_ptr=nullptr;
+        other.m_mapped_size_bytes=0;
+    }
+    return *this;
+}
+
+
+void MeshFile::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string MeshFile::name() const{
+    return m_name;
+}
+
+void MeshFile::add_attribute(const std::string& attrib_name, const GLenum gl_type, const int nr_components, const void* data_ptr, const size_t size_bytes, const bool normalized, const bool is_integer){
+    CHECK(attrib_name.size()<sizeof(MeshFileAttribute::name)) << named("Attribute name ") << attrib_name << " is too long. It can have at most " << sizeof(MeshFileAttribute::name)-1 << " characters";
+    CHECK(nr_components>=1 && nr_components<=4) << named("Attribute ") << attrib_name << " should have between 1 and 4 components but it has " << nr_components;
+    CHECK(data_ptr || size_bytes==0) << named("Attribute ") << attrib_name << " has no data";
+
+    int vertex_size=gl_attribute_size_bytes(gl_type, nr_components);
+    CHECK(size_bytes%vertex_size==0) << named("Attribute ") << attrib_name << " has " << size_bytes << " bytes which is not a multiple of the " << vertex_size << " bytes of one vertex";
+    size_t nr_vertices=size_bytes/vertex_size;
+    if(!m_pending_attributes.empty()){
+        size_t nr_vertices_first=m_pending_attributes[0].desc.size_bytes/gl_attribute_size_bytes(m_pending_attributes[0].desc.gl_type, m_pending_attributes[0].desc.nr_components);
+        CHECK(nr_vertices==nr_vertices_first) << named("Attribute ") << attrib_name << " has " << nr_vertices << " vertices but the previous attributes have " << nr_vertices_first;
+    }
+
+    PendingBlob blob;
+    memset(&blob.desc, 0, sizeof(blob.desc));
+    strncpy(blob.desc.name, attrib_name.c_str(), sizeof(blob.desc.name)-1);
+    blob.desc.gl_type=gl_type;
+    blob.desc.nr_components=nr_components;
+    blob.desc.normalized=normalized;
+    blob.desc.is_integer=is_integer;
+    blob.desc.size_bytes=size_bytes;
+    blob.data_ptr=data_ptr;
+    m_pending_attributes.push_back(blob);
+}
+
+void MeshFile::set_indices(const GLenum gl_type, const void* data_ptr, const size_t size_bytes){
+    CHECK(gl_type==GL_UNSIGNED_INT || gl_type==GL_UNSIGNED_SHORT || gl_type==GL_UNSIGNED_BYTE) << named("Indices can only be of type GL_UNSIGNED_INT, GL_UNSIGNED_SHORT or GL_UNSIGNED_BYTE");
+    CHECK(data_ptr || size_bytes==0) << named("Indices have no data");
+
+    m_pending_indices.desc.gl_type=gl_type;
+    m_pending_indices.desc.size_bytes=size_bytes;
+    m_pending_indices.data_ptr=data_ptr;
+}
+
+void MeshFile::write(const std::string& path) const{
+    CHECK(!m_pending_attributes.empty()) << named("There are no attributes to write. Use add_attribute() first");
+
+    //lay out the blobs after the header and the attribute table
+    std::vector<MeshFileAttribute> attributes;
+    uint64_t offset=sizeof(MeshFileHeader) + sizeof(MeshFileAttribute)*m_pending_attributes.size();
+    for(size_t i=0; i<m_pending_attributes.size(); i++){
+        offset=align_offset(offset);
+        MeshFileAttribute desc=m_pending_attributes[i].desc;
+        desc.offset=offset;
+        attributes.push_back(desc);
+        offset+=desc.size_bytes;
+    }
+
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EGL_MESH_FILE_MAGIC, sizeof(EGL_MESH_FILE_MAGIC));
+    header.version=EGL_MESH_FILE_VERSION;
+    header.nr_attributes=attributes.size();
+    header.nr_vertices=attributes[0].size_bytes/gl_attribute_size_bytes(attributes[0].gl_type, attributes[0].nr_components);
+    if(m_pending_indices.data_ptr){
+        offset=align_offset(offset);
+        header.index_gl_type=m_pending_indices.desc.gl_type;
+        header.index_offset=offset;
+        header.index_size_bytes=m_pending_indices.desc.size_bytes;
+    }
+
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    CHECK(file.is_open()) << named("Could not open file for writing ") << path;
+
+    //writes zeros until the stream reaches the offset of the next blob
+    auto pad_to=[&](const uint64_t target_offset){
+        static const char zeros[EGL_MESH_FILE_ALIGNMENT]={0};
+        uint64_t cur=file.tellp();
+        CHECK(cur<=target_offset) << named("Something went wrong with the layout of the file");
+        file.write(zeros, target_offset-cur);
+    };
+
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)attributes.data(), sizeof(MeshFileAttribute)*attributes.size());
+    for(size_t i=0; i<attributes.size(); i++){
+        pad_to(attributes[i].offset);
+        file.write((const char*)m_pending_attributes[i].data_ptr, attributes[i].size_bytes);
+    }
+    if(m_pending_indices.data_ptr){
+        pad_to(header.index_offset);
+        file.write((const char*)m_pending_indices.data_ptr, header.index_size_bytes);
+    }
+
+    CHECK(file.good()) << named("Failed to write the mesh file ") << path;
+}
+
+void MeshFile::open(const std::string& path){
+    close();
+
+    int fd=::open(path.c_str(), O_RDONLY);
+    CHECK(fd>=0) << named("Could not open mesh file ") << path;
+    struct stat file_stat;
+    CHECK(fstat(fd, &file_stat)==0) << named("Could not stat mesh file ") << path;
+    size_t file_size=file_stat.st_size;
+    CHECK(file_size>=sizeof(MeshFileHeader)) << named("File ") << path << " is too small to be a mesh file";
+
+    void* ptr=mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); //the mapping keeps its own reference to the file
+    CHECK(ptr!=MAP_FAILED) << named("Could not mmap mesh file ") << path;
+    //we read the whole file exactly once so let the kernel read ahead aggressively
+    madvise(ptr, file_size, MADV_SEQUENTIAL);
+    madvise(ptr, file_size, MADV_WILLNEED);
+
+    m_mapped_ptr=(unsigned char*)ptr;
+    m_mapped_size_bytes=file_size;
+
+    //validate everything before trusting any offset
+    memcpy(&m_header, m_mapped_ptr, sizeof(MeshFileHeader));
+    CHECK(memcmp(m_header.magic, EGL_MESH_FILE_MAGIC, sizeof(EGL_MESH_FILE_MAGIC))==0) << named("File ") << path << " is not a mesh file";
+    CHECK(m_header.version==EGL_MESH_FILE_VERSION) << named("Mesh file ") << path << " has version " << m_header.version << " but we can only read version " << EGL_MESH_FILE_VERSION;
+    check_blob(sizeof(MeshFileHeader), (uint64_t)m_header.nr_attributes*sizeof(MeshFileAttribute), "attribute table");
+
+    m_attributes.resize(m_header.nr_attributes);
+    memcpy(m_attributes.data(), m_mapped_ptr+sizeof(MeshFileHeader), m_header.nr_attributes*sizeof(MeshFileAttribute));
+    for(size_t i=0; i<m_attributes.size(); i++){
+        MeshFileAttribute& attr=m_attributes[i];
+        attr.name[sizeof(attr.name)-1]='\0';
+        CHECK(attr.nr_components>=1 && attr.nr_components<=4) << named("Attribute ") << attr.name << " has " << attr.nr_components << " components";
+        CHECK(is_valid_attribute_type(attr.gl_type)) << named("Attribute ") << attr.name << " of mesh file " << path << " has an unknown type " << std::hex << attr.gl_type << std::dec;
+        check_blob(attr.offset, attr.size_bytes, attr.name);
+        CHECK(attr.size_bytes==m_header.nr_vertices*gl_attribute_size_bytes(attr.gl_type, attr.nr_components)) << named("Attribute ") << attr.name << " does not have the size for " << m_header.nr_vertices << " vertices";
+    }
+    if(m_header.index_gl_type!=0){
+        CHECK(is_valid_index_type(m_header.index_gl_type)) << named("Mesh file ") << path << " has indices of unknown type " << std::hex << m_header.index_gl_type << std::dec << ". They can only be GL_UNSIGNED_INT, GL_UNSIGNED_SHORT or GL_UNSIGNED_BYTE";
+        CHECK(m_header.index_size_bytes%gl_attribute_size_bytes(m_header.index_gl_type, 1)==0) << named("The indices of mesh file ") << path << " have " << m_header.index_size_bytes << " bytes which is not a multiple of the size of one index";
+        check_blob(m_header.index_offset, m_header.index_size_bytes, "indices");
+    }
+}
+
+void MeshFile::close(){
+    if(m_mapped_ptr){
+        munmap(m_mapped_ptr, m_mapped_size_bytes);
+        m_mapped_ptr=nullptr;
+        m_mapped_size_bytes=0;
+    }
+}
+
+bool MeshFile::is_open() const{
+    return m_mapped_ptr!=nullptr;
+}
+
+int MeshFile::nr_attributes() const{
+    return m_attributes.size();
+}
+
+const MeshFileAttribute& MeshFile::attribute(const int idx) const{
+    CHECK(idx>=0 && idx<(int)m_attributes.size()) << named("Attribute idx ") << idx << " is out of range. We have " << m_attributes.size() << " attributes";
+    return m_attributes[idx];
+}
+
+int MeshFile::attribute_idx(const std::string& attrib_name) const{
+    for(size_t i=0; i<m_attributes.size(); i++){
+        if(attrib_name==m_attributes[i].name){
+            return i;
+        }
+    }
+    return -1;
+}
+
+const void* MeshFile::attribute_data(const int idx) const{
+    CHECK(is_open()) << named("The file is not open so there is no data for the attributes");
+    return m_mapped_ptr+attribute(idx).offset;
+}
+
+size_t MeshFile::nr_vertices() const{
+    return m_header.nr_vertices;
+}
+
+bool MeshFile::has_indices() const{
+    return m_header.index_gl_type!=0;
+}
+
+GLenum MeshFile::index_type() const{
+    return m_header.index_gl_type;
+}
+
+size_t MeshFile::nr_indices() const{
+    if(!has_indices()){
+        return 0;
+    }
+    return m_header.index_size_bytes/gl_attribute_size_bytes(m_header.index_gl_type, 1);
+}
+
+const void* MeshFile::index_data() const{
+    CHECK(is_open()) << named("The file is not open so there is no data for the indices");
+    CHECK(has_indices()) << named("The file has no indices");
+    return m_mapped_ptr+m_header.index_offset;
+}
+
+void MeshFile::upload(const GLbitfield storage_flags){
+    CHECK(is_open()) << named("The file is not open. Use open() first");
+
+    //glBufferStorage cannot make empty buffers so a mesh without vertices gets buffers without storage, which setup_vao() skips
+    m_bufs.clear();
+    for(size_t i=0; i<m_attributes.size(); i++){
+        std::unique_ptr<Buf> buf(new Buf(named(m_attributes[i].name)));
+        if(m_attributes[i].size_bytes>0){
+            //allocate_inmutable takes the size as a GLsizei so bigger blobs would wrap around
+            CHECK(m_attributes[i].size_bytes<=(uint64_t)std::numeric_limits<GLsizei>::max()) << named("Attribute ") << m_attributes[i].name << " has " << m_attributes[i].size_bytes << " bytes but a buffer can be at most " << std::numeric_limits<GLsizei>::max() << " bytes";
+            buf->allocate_inmutable(GL_ARRAY_BUFFER, m_attributes[i].size_bytes, attribute_data(i), storage_flags);
+        }
+        m_bufs.push_back(std::move(buf));
+    }
+
+    m_index_buf.reset();
+    if(has_indices() && m_header.index_size_bytes>0){
+        CHECK(m_header.index_size_bytes<=(uint64_t)std::numeric_limits<GLsizei>::max()) << named("The indices have ") << m_header.index_size_bytes << " bytes but a buffer can be at most " << std::numeric_limits<GLsizei>::max() << " bytes";
+        m_index_buf.reset(new Buf(named("indices")));
+        m_index_buf->allocate_inmutable(GL_ELEMENT_ARRAY_BUFFER, m_header.index_size_bytes, index_data(), storage_flags);
+    }
+}
+
+void MeshFile::setup_vao(const gl::Shader& prog, gl::VertexArrayObject& vao) const{
+    CHECK(m_bufs.size()==m_attributes.size()) << named("The attributes were not uploaded. Use upload() first");
+
+    for(size_t i=0; i<m_attributes.size(); i++){
+        const MeshFileAttribute& attr=m_attributes[i];
+        //the file can have more attributes than this shader needs so we skip the ones it doesn't use
+        if(!m_bufs[i]->storage_initialized() || prog.get_attrib_location(attr.name)==-1){
+            continue;
+        }
+        vao.vertex_attribute(prog, attr.name, *m_bufs[i], attr.nr_components, attr.gl_type, attr.normalized, attr.is_integer, 0, 0);
+    }
+    if(m_index_buf){
+        vao.indices(*m_index_buf);
+    }
+}
+
+Buf& MeshFile::buf(const std::string& attrib_name){
+    int idx=attribute_idx(attrib_name);
+    CHECK(idx!=-1) << named("The file has no attribute named ") << attrib_name;
+    CHECK(idx<(int)m_bufs.size()) << named("The attributes were not uploaded. Use upload() first");
+    return *m_bufs[idx];
+}
+
+Buf& MeshFile::index_buf(){
+    CHECK(m_index_buf) << named("There is no index buffer. Either the file has no indices or upload() was not called");
+    return *m_index_buf;
+}
+
+void MeshFile::check_blob(const uint64_t offset, const uint64_t size_bytes, const std::string& what) const{
+    CHECK(offset<=m_mapped_size_bytes && size_bytes<=m_mapped_size_bytes-offset) << named("The ") << what << " at offset " << offset << " with " << size_bytes << " bytes goes past the end of the file which has " << m_mapped_size_bytes << " bytes";
+}
+
+
+std::string MeshFile::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+} //namespace gl
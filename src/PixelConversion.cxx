@@ -0,0 +1,524 @@
+#include "easy_gl/PixelConversion.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cstring> //memcpy
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define EGL_CONVERSION_X86 1
+#elif defined(__aarch64__)
+    #include <arm_neon.h>
+    #define EGL_CONVERSION_NEON 1
+#endif
+
+#include "easy_gl/VertexPacking.h" //float_to_half
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+namespace gl{
+
+GLenum pixel_depth_gl_type(const PixelDepth depth){
+    switch(depth){
+        case PixelDepth::U8: return GL_UNSIGNED_BYTE;
+        case PixelDepth::F16: return GL_HALF_FLOAT;
+        case PixelDepth::F32: return GL_FLOAT;
+    }
+    LOG(FATAL) << "Unknown pixel depth";
+    return GL_UNSIGNED_BYTE;
+}
+
+int pixel_depth_size_bytes(const PixelDepth depth){
+    switch(depth){
+        case PixelDepth::U8: return 1;
+        case PixelDepth::F16: return 2;
+        case PixelDepth::F32: return 4;
+    }
+    LOG(FATAL) << "Unknown pixel depth";
+    return 1;
+}
+
+
+//Pool of threads that split the rows of an image between them. The calling thread also takes chunks so with nr_threads=1 there are no workers at all
+//Only one image is converted at a time, if another thread is already using the pool the conversion just runs in the calling thread
+class ConversionPool{
+public:
+    ConversionPool(const int nr_threads):
+        m_nr_threads(std::max(1, nr_threads)),
+        m_job(nullptr),
+        m_nr_chunks(0),
+        m_next_chunk(0),
+        m_nr_done(0),
+        m_stop(false){
+        for(int i=1; i<m_nr_threads; i++){
+            m_workers.emplace_back(&ConversionPool::worker_loop, this);
+        }
+    }
+    ~ConversionPool(){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop=true;
+        }
+        m_cond_work.notify_all();
+        for(size_t i=0; i<m_workers.size(); i++){
+            m_workers[i].join();
+        }
+    }
+
+    int nr_threads() const{
+        return m_nr_threads;
+    }
+
+    //calls job(chunk) for every chunk in [0,nr_chunks) and returns when all of them finished
+    void run(const int nr_chunks, const std::function<void(int)>& job){
+        std::unique_lock<std::mutex> run_lock(m_run_mutex, std::try_to_lock);
+        if(!run_lock.owns_lock() || m_workers.empty()){
+            for(int i=0; i<nr_chunks; i++){
+                job(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job=&job;
+            m_nr_chunks=nr_chunks;
+            m_next_chunk=0;
+            m_nr_done=0;
+        }
+        m_cond_work.notify_all();
+        while(run_one_chunk()){}
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond_done.wait(lock, [&]{ return m_nr_done==m_nr_chunks; });
+        m_job=nullptr;
+    }
+
+private:
+    //takes the next chunk of the current job if there is one left
+    bool run_one_chunk(){
+        const std::function<void(int)>* job;
+        int chunk;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(m_next_chunk>=m_nr_chunks){
+                return false;
+            }
+            job=m_job;
+            chunk=m_next_chunk++;
+        }
+        (*job)(chunk);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_nr_done++;
+            if(m_nr_done==m_nr_chunks){
+                m_cond_done.notify_one();
+            }
+        }
+        return true;
+    }
+
+    void worker_loop(){
+        while(true){
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond_work.wait(lock, [&]{ return m_stop || m_next_chunk<m_nr_chunks; });
+                if(m_stop){
+                    return;
+                }
+            }
+            while(run_one_chunk()){}
+        }
+    }
+
+    int m_nr_threads;
+    std::vector<std::thread> m_workers;
+    std::mutex m_run_mutex; //held for the whole duration of run()
+    std::mutex m_mutex;
+    std::condition_variable m_cond_work;
+    std::condition_variable m_cond_done;
+    const std::function<void(int)>* m_job;
+    int m_nr_chunks;
+    int m_next_chunk;
+    int m_nr_done;
+    bool m_stop;
+};
+
+static std::mutex pool_mutex;
+static ConversionPool* pool=nullptr; //leaked on purpose so the workers are not joined during static destruction
+
+static ConversionPool& conversion_pool(){
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if(!pool){
+        pool=new ConversionPool(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    return *pool;
+}
+
+void set_pixel_conversion_nr_threads(const int nr_threads){
+    CHECK(nr_threads>=1) << "The pixel conversion needs at least 1 thread but we got " << nr_threads;
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    delete pool;
+    pool=new ConversionPool(nr_threads);
+}
+
+int pixel_conversion_nr_threads(){
+    return conversion_pool().nr_threads();
+}
+
+
+#ifdef EGL_CONVERSION_X86
+static bool cpu_has_ssse3(){
+    static const bool has=__builtin_cpu_supports("ssse3");
+    return has;
+}
+static bool cpu_has_avx2(){
+    static const bool has=__builtin_cpu_supports("avx2");
+    return has;
+}
+static bool cpu_has_f16c(){
+    static const bool has=__builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+    return has;
+}
+
+//4 pixels of 3 bytes to 4 pixels of 4 bytes. The -1 of the shuffle writes zeros where the alpha goes
+__attribute__((target("ssse3")))
+static int rgb_to_rgba_u8_ssse3(const unsigned char* src, unsigned char* dst, const int width, const bool swap_red_blue){
+    const __m128i shuffle= swap_red_blue ? _mm_setr_epi8(2,1,0,-1, 5,4,3,-1, 8,7,6,-1, 11,10,9,-1) : _mm_setr_epi8(0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+    const __m128i alpha=_mm_set1_epi32(0xff000000);
+    int x=0;
+    for(; x+6<=width; x+=4){ //the load reads 16 bytes so we stop before it goes past the row
+        __m128i pixels=_mm_loadu_si128((const __m128i*)(src+x*3));
+        _mm_storeu_si128((__m128i*)(dst+x*4), _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha));
+    }
+    return x;
+}
+
+__attribute__((target("ssse3")))
+static int swap_red_blue_rgba_u8_ssse3(const unsigned char* src, unsigned char* dst, const int width){
+    const __m128i shuffle=_mm_setr_epi8(2,1,0,3, 6,5,4,7, 10,9,8,11, 14,13,12,15);
+    int x=0;
+    for(; x+4<=width; x+=4){
+        __m128i pixels=_mm_loadu_si128((const __m128i*)(src+x*4));
+        _mm_storeu_si128((__m128i*)(dst+x*4), _mm_shuffle_epi8(pixels, shuffle));
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static size_t u8_to_f32_avx2(const unsigned char* src, float* dst, const size_t nr_values, const float scale){
+    const __m256 mul=_mm256_set1_ps(scale/255.0f);
+    size_t i=0;
+    for(; i+8<=nr_values; i+=8){
+        __m128i bytes=_mm_loadl_epi64((const __m128i*)(src+i));
+        __m256 floats=_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+        _mm256_storeu_ps(dst+i, _mm256_mul_ps(floats, mul));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t f32_to_u8_avx2(const float* src, unsigned char* dst, const size_t nr_values, const float scale){
+    const __m256 mul=_mm256_set1_ps(scale*255.0f);
+    const __m256 zero=_mm256_setzero_ps();
+    const __m256 max_val=_mm256_set1_ps(255.0f);
+    const __m256 half=_mm256_set1_ps(0.5f);
+    size_t i=0;
+    for(; i+8<=nr_values; i+=8){
+        __m256 floats=_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src+i), mul), zero), max_val);
+        //adding 0.5 and truncating rounds halves up like the scalar loop. _mm256_cvtps_epi32 would round them to even so 2.5 would become 2 here and 3 there
+        __m256i ints=_mm256_cvttps_epi32(_mm256_add_ps(floats, half));
+        __m128i shorts=_mm_packs_epi32(_mm256_castsi256_si128(ints), _mm256_extracti128_si256(ints, 1));
+        __m128i bytes=_mm_packus_epi16(shorts, shorts);
+        _mm_storel_epi64((__m128i*)(dst+i), bytes);
+    }
+    return i;
+}
+
+__attribute__((target("avx")))
+static size_t scale_f32_avx(const float* src, float* dst, const size_t nr_values, const float scale){
+    const __m256 mul=_mm256_set1_ps(scale);
+    size_t i=0;
+    for(; i+8<=nr_values; i+=8){
+        _mm256_storeu_ps(dst+i, _mm256_mul_ps(_mm256_loadu_ps(src+i), mul));
+    }
+    return i;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t f32_to_f16_f16c(const float* src, uint16_t* dst, const size_t nr_values){
+    size_t i=0;
+    for(; i+8<=nr_values; i+=8){
+        _mm_storeu_si128((__m128i*)(dst+i), _mm256_cvtps_ph(_mm256_loadu_ps(src+i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    return i;
+}
+#endif
+
+
+//channel stage: reorders and pads the channels of one row without changing the depth
+template<typename T>
+static void remap_channels_row(const T* src, T* dst, const int width, const int src_channels, const int dst_channels, const bool swap_red_blue, const T alpha){
+    for(int x=0; x<width; x++){
+        const T* s=src+x*src_channels;
+        T* d=dst+x*dst_channels;
+        T c0=s[0], c1= src_channels>1? s[1] : 0, c2= src_channels>2? s[2] : 0;
+        T c3= src_channels>3? s[3] : alpha;
+        if(swap_red_blue){
+            std::swap(c0, c2);
+        }
+        d[0]=c0;
+        if(dst_channels>1) d[1]=c1;
+        if(dst_channels>2) d[2]=c2;
+        if(dst_channels>3) d[3]=c3;
+    }
+}
+
+static void remap_channels_row_u8(const unsigned char* src, unsigned char* dst, const int width, const int src_channels, const int dst_channels, const bool swap_red_blue){
+    int x=0;
+    #if defined(EGL_CONVERSION_X86)
+        if(cpu_has_ssse3()){
+            if(src_channels==3 && dst_channels==4){
+                x=rgb_to_rgba_u8_ssse3(src, dst, width, swap_red_blue);
+            }else if(src_channels==4 && dst_channels==4 && swap_red_blue){
+                x=swap_red_blue_rgba_u8_ssse3(src, dst, width);
+            }
+        }
+    #elif defined(EGL_CONVERSION_NEON)
+        if(src_channels==3 && dst_channels==4){
+            for(; x+16<=width; x+=16){
+                uint8x16x3_t rgb=vld3q_u8(src+x*3);
+                uint8x16x4_t rgba;
+                rgba.val[0]= swap_red_blue? rgb.val[2] : rgb.val[0];
+                rgba.val[1]=rgb.val[1];
+                rgba.val[2]= swap_red_blue? rgb.val[0] : rgb.val[2];
+                rgba.val[3]=vdupq_n_u8(255);
+                vst4q_u8(dst+x*4, rgba);
+            }
+        }else if(src_channels==4 && dst_channels==4 && swap_red_blue){
+            for(; x+16<=width; x+=16){
+                uint8x16x4_t rgba=vld4q_u8(src+x*4);
+                std::swap(rgba.val[0], rgba.val[2]);
+                vst4q_u8(dst+x*4, rgba);
+            }
+        }
+    #endif
+    remap_channels_row<unsigned char>(src+x*src_channels, dst+x*dst_channels, width-x, src_channels, dst_channels, swap_red_blue, 255);
+}
+
+static void remap_channels_row_f32(const float* src, float* dst, const int width, const int src_channels, const int dst_channels, const bool swap_red_blue){
+    int x=0;
+    #if defined(__SSE2__)
+        if(dst_channels==4 && (src_channels==3 || src_channels==4)){
+            const __m128 keep_rgb=_mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+            const __m128 alpha=_mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+            //with 3 channels the load takes one float of the next pixel so we stop one pixel before the end
+            int last= src_channels==3? width-1 : width;
+            for(; x<last; x++){
+                __m128 pixel=_mm_loadu_ps(src+x*src_channels);
+                if(swap_red_blue){
+                    pixel=_mm_shuffle_ps(pixel, pixel, _MM_SHUFFLE(3,0,1,2));
+                }
+                if(src_channels==3){
+                    pixel=_mm_or_ps(_mm_and_ps(pixel, keep_rgb), alpha);
+                }
+                _mm_storeu_ps(dst+x*4, pixel);
+            }
+        }
+    #elif defined(EGL_CONVERSION_NEON)
+        if(src_channels==3 && dst_channels==4){
+            for(; x+4<=width; x+=4){
+                float32x4x3_t rgb=vld3q_f32(src+x*3);
+                float32x4x4_t rgba;
+                rgba.val[0]= swap_red_blue? rgb.val[2] : rgb.val[0];
+                rgba.val[1]=rgb.val[1];
+                rgba.val[2]= swap_red_blue? rgb.val[0] : rgb.val[2];
+                rgba.val[3]=vdupq_n_f32(1.0f);
+                vst4q_f32(dst+x*4, rgba);
+            }
+        }
+    #endif
+    remap_channels_row<float>(src+x*src_channels, dst+x*dst_channels, width-x, src_channels, dst_channels, swap_red_blue, 1.0f);
+}
+
+
+//depth stage: converts nr_values values which are already in the channel order of the destination
+static void u8_to_f32(const unsigned char* src, float* dst, const size_t nr_values, const float scale){
+    size_t i=0;
+    #if defined(EGL_CONVERSION_X86)
+        if(cpu_has_avx2()){
+            i=u8_to_f32_avx2(src, dst, nr_values, scale);
+        }
+    #elif defined(EGL_CONVERSION_NEON)
+        float32x4_t mul=vdupq_n_f32(scale/255.0f);
+        for(; i+8<=nr_values; i+=8){
+            uint16x8_t shorts=vmovl_u8(vld1_u8(src+i));
+            vst1q_f32(dst+i, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(shorts))), mul));
+            vst1q_f32(dst+i+4, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(shorts))), mul));
+        }
+    #endif
+    const float mul=scale/255.0f;
+    for(; i<nr_values; i++){
+        dst[i]=src[i]*mul;
+    }
+}
+
+static void f32_to_u8(const float* src, unsigned char* dst, const size_t nr_values, const float scale){
+    size_t i=0;
+    #if defined(EGL_CONVERSION_X86)
+        if(cpu_has_avx2()){
+            i=f32_to_u8_avx2(src, dst, nr_values, scale);
+        }
+    #endif
+    const float mul=scale*255.0f;
+    for(; i<nr_values; i++){
+        float val=std::min(std::max(src[i]*mul, 0.0f), 255.0f);
+        dst[i]=(unsigned char)(val+0.5f);
+    }
+}
+
+//src and dst can be the same
+static void scale_f32(const float* src, float* dst, const size_t nr_values, const float scale){
+    if(scale==1.0f){
+        if(src!=dst){
+            memcpy(dst, src, nr_values*sizeof(float));
+        }
+        return;
+    }
+    size_t i=0;
+    #if defined(EGL_CONVERSION_X86)
+        static const bool has_avx=__builtin_cpu_supports("avx");
+        if(has_avx){
+            i=scale_f32_avx(src, dst, nr_values, scale);
+        }
+    #elif defined(EGL_CONVERSION_NEON)
+        float32x4_t mul=vdupq_n_f32(scale);
+        for(; i+4<=nr_values; i+=4){
+            vst1q_f32(dst+i, vmulq_f32(vld1q_f32(src+i), mul));
+        }
+    #endif
+    for(; i<nr_values; i++){
+        dst[i]=src[i]*scale;
+    }
+}
+
+static void f32_to_f16(const float* src, uint16_t* dst, const size_t nr_values){
+    size_t i=0;
+    #if defined(EGL_CONVERSION_X86)
+        if(cpu_has_f16c()){
+            i=f32_to_f16_f16c(src, dst, nr_values);
+        }
+    #elif defined(EGL_CONVERSION_NEON)
+        for(; i+4<=nr_values; i+=4){
+            vst1_u16(dst+i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src+i))));
+        }
+    #endif
+    for(; i<nr_values; i++){
+        dst[i]=float_to_half(src[i]);
+    }
+}
+
+//the conversions to half go through float in small pieces that stay in L1
+static void to_f16(const void* src, const PixelDepth src_depth, uint16_t* dst, const size_t nr_values, const float scale){
+    const size_t piece=256;
+    float floats[piece];
+    for(size_t i=0; i<nr_values; i+=piece){
+        size_t nr=std::min(piece, nr_values-i);
+        if(src_depth==PixelDepth::U8){
+            u8_to_f32((const unsigned char*)src+i, floats, nr, scale);
+        }else{
+            scale_f32((const float*)src+i, floats, nr, scale);
+        }
+        f32_to_f16(floats, dst+i, nr);
+    }
+}
+
+static void convert_depth(const void* src, const PixelDepth src_depth, void* dst, const PixelDepth dst_depth, const size_t nr_values, const float scale){
+    if(dst_depth==PixelDepth::F16){
+        to_f16(src, src_depth, (uint16_t*)dst, nr_values, scale);
+    }else if(src_depth==PixelDepth::U8 && dst_depth==PixelDepth::F32){
+        u8_to_f32((const unsigned char*)src, (float*)dst, nr_values, scale);
+    }else if(src_depth==PixelDepth::F32 && dst_depth==PixelDepth::U8){
+        f32_to_u8((const float*)src, (unsigned char*)dst, nr_values, scale);
+    }else if(src_depth==PixelDepth::F32 && dst_depth==PixelDepth::F32){
+        scale_f32((const float*)src, (float*)dst, nr_values, scale);
+    }else if(scale==1.0f){ //U8 to U8
+        if(src!=dst){
+            memcpy(dst, src, nr_values);
+        }
+    }else{
+        const unsigned char* s=(const unsigned char*)src;
+        unsigned char* d=(unsigned char*)dst;
+        for(size_t i=0; i<nr_values; i++){
+            d[i]=(unsigned char)std::min(s[i]*scale+0.5f, 255.0f);
+        }
+    }
+}
+
+
+void convert_pixels(const void* src, const size_t src_row_stride_bytes, const int src_channels, const PixelDepth src_depth,
+                    void* dst, const size_t dst_row_stride_bytes, const int dst_channels, const PixelDepth dst_depth,
+                    const int width, const int height, const bool swap_red_blue, const float scale){
+    CHECK(src && dst) << "The source or destination pointer is null";
+    CHECK(src_channels>=1 && src_channels<=4) << "The source needs between 1 and 4 channels but it has " << src_channels;
+    CHECK(dst_channels==src_channels || (src_channels==3 && dst_channels==4)) << "Converting from " << src_channels << " to " << dst_channels << " channels is not supported. The channels stay the same or 3 are padded to 4";
+    CHECK(!swap_red_blue || src_channels>=3) << "Swapping red and blue needs at least 3 channels";
+    CHECK(src_depth!=PixelDepth::F16) << "Half floats are only supported as destination";
+    CHECK(src_row_stride_bytes>=(size_t)width*src_channels*pixel_depth_size_bytes(src_depth)) << "The source row stride is smaller than a row";
+    CHECK(dst_row_stride_bytes>=(size_t)width*dst_channels*pixel_depth_size_bytes(dst_depth)) << "The destination row stride is smaller than a row";
+    if(width<=0 || height<=0){
+        return;
+    }
+
+    const bool needs_remap= swap_red_blue || src_channels!=dst_channels;
+    const bool needs_depth= src_depth!=dst_depth || scale!=1.0f;
+    const size_t nr_values=(size_t)width*dst_channels;
+
+    auto convert_rows=[&](const int y_begin, const int y_end){
+        std::vector<unsigned char> remapped; //one row with the channels of the destination and the depth of the source
+        if(needs_remap && needs_depth){
+            remapped.resize(nr_values*pixel_depth_size_bytes(src_depth));
+        }
+        for(int y=y_begin; y<y_end; y++){
+            const unsigned char* src_row=(const unsigned char*)src + (size_t)y*src_row_stride_bytes;
+            unsigned char* dst_row=(unsigned char*)dst + (size_t)y*dst_row_stride_bytes;
+            const unsigned char* depth_src=src_row;
+            if(needs_remap){
+                unsigned char* remap_dst= needs_depth? remapped.data() : dst_row;
+                if(src_depth==PixelDepth::U8){
+                    remap_channels_row_u8(src_row, remap_dst, width, src_channels, dst_channels, swap_red_blue);
+                }else{
+                    remap_channels_row_f32((const float*)src_row, (float*)remap_dst, width, src_channels, dst_channels, swap_red_blue);
+                }
+                depth_src=remap_dst;
+            }
+            if(needs_depth || !needs_remap){
+                convert_depth(depth_src, src_depth, dst_row, dst_depth, nr_values, scale);
+            }
+        }
+    };
+
+    //small images are not worth waking up the threads
+    ConversionPool& conversion_threads=conversion_pool();
+    if((size_t)width*height<(1<<16) || conversion_threads.nr_threads()==1){
+        convert_rows(0, height);
+        return;
+    }
+    int nr_chunks=std::min(height, conversion_threads.nr_threads()*4);
+    conversion_threads.run(nr_chunks, [&](const int chunk){
+        convert_rows( (int)((long long)height*chunk/nr_chunks), (int)((long long)height*(chunk+1)/nr_chunks) );
+    });
+}
+
+
+} //namespace gl
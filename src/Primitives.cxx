@@ -0,0 +1,555 @@
+#include "easy_gl/Primitives.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Shader.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+//the kernels get the #version and the defines prepended by kernel()
+
+//work efficient (Blelloch) exclusive scan of 512 elements per work group in shared memory. The total of each group goes into block_sums so the next level can scan them
+static const char* scan_blocks_comp_src = R"(
+    layout(local_size_x=256) in;
+
+    layout(std430) readonly buffer in_buf{ uint data_in[]; };
+    layout(std430) writeonly buffer out_buf{ uint data_out[]; };
+    layout(std430) writeonly buffer block_sums_buf{ uint block_sums[]; };
+
+    uniform int nr_elements;
+    uniform bool inclusive;
+    uniform bool write_block_sums;
+
+    shared uint temp[512];
+
+    void main(){
+        uint tid=gl_LocalInvocationID.x;
+        uint block_start=gl_WorkGroupID.x*512u;
+        uint n=uint(nr_elements);
+        uint ai=tid;
+        uint bi=tid+256u;
+        uint val_a= block_start+ai<n? data_in[block_start+ai] : 0u;
+        uint val_b= block_start+bi<n? data_in[block_start+bi] : 0u;
+        temp[ai]=val_a;
+        temp[bi]=val_b;
+
+        //up sweep
+        uint offset=1u;
+        for(uint d=256u; d>0u; d>>=1){
+            barrier();
+            if(tid<d){
+                uint a=offset*(2u*tid+1u)-1u;
+                uint b=offset*(2u*tid+2u)-1u;
+                temp[b]+=temp[a];
+            }
+            offset*=2u;
+        }
+
+        if(tid==0u){
+            if(write_block_sums){
+                block_sums[gl_WorkGroupID.x]=temp[511];
+            }
+            temp[511]=0u;
+        }
+
+        //down sweep
+        for(uint d=1u; d<512u; d*=2u){
+            offset>>=1;
+            barrier();
+            if(tid<d){
+                uint a=offset*(2u*tid+1u)-1u;
+                uint b=offset*(2u*tid+2u)-1u;
+                uint t=temp[a];
+                temp[a]=temp[b];
+                temp[b]+=t;
+            }
+        }
+        barrier();
+
+        if(block_start+ai<n) data_out[block_start+ai]=temp[ai] + (inclusive? val_a : 0u);
+        if(block_start+bi<n) data_out[block_start+bi]=temp[bi] + (inclusive? val_b : 0u);
+    }
+)";
+
+//adds the scanned total of the previous groups to every element of a group
+static const char* scan_add_block_sums_comp_src = R"(
+    layout(local_size_x=256) in;
+
+    layout(std430) buffer data_buf{ uint data[]; };
+    layout(std430) readonly buffer block_sums_buf{ uint block_sums[]; };
+
+    uniform int nr_elements;
+
+    void main(){
+        uint block_start=gl_WorkGroupID.x*512u;
+        uint sum=block_sums[gl_WorkGroupID.x];
+        uint ai=block_start+gl_LocalInvocationID.x;
+        uint bi=ai+256u;
+        if(ai<uint(nr_elements)) data[ai]+=sum;
+        if(bi<uint(nr_elements)) data[bi]+=sum;
+    }
+)";
+
+//tree reduction of 512 elements per work group into one value. TYPE, OP and IDENTITY come from the defines
+static const char* reduce_comp_src = R"(
+    layout(local_size_x=256) in;
+
+    layout(std430) readonly buffer in_buf{ TYPE data_in[]; };
+    layout(std430) writeonly buffer out_buf{ TYPE data_out[]; };
+
+    uniform int nr_elements;
+
+    shared TYPE partial[256];
+
+    TYPE op(TYPE a, TYPE b){
+        #if defined(OP_SUM)
+            return a+b;
+        #elif defined(OP_MIN)
+            return min(a,b);
+        #else
+            return max(a,b);
+        #endif
+    }
+
+    void main(){
+        uint tid=gl_LocalInvocationID.x;
+        uint base=gl_WorkGroupID.x*512u;
+        uint n=uint(nr_elements);
+
+        TYPE val=IDENTITY;
+        if(base+tid<n) val=data_in[base+tid];
+        if(base+tid+256u<n) val=op(val, data_in[base+tid+256u]);
+        partial[tid]=val;
+
+        for(uint s=128u; s>0u; s>>=1){
+            barrier();
+            if(tid<s){
+                partial[tid]=op(partial[tid], partial[tid+s]);
+            }
+        }
+
+        if(tid==0u){
+            data_out[gl_WorkGroupID.x]=partial[0];
+        }
+    }
+)";
+
+//turns the flags into 0 or 1 so that their scan gives the output positions. Any non zero flag means keep
+static const char* compact_predicate_comp_src = R"(
+    layout(local_size_x=256) in;
+
+    layout(std430) readonly buffer flags_buf{ uint flags[]; };
+    layout(std430) writeonly buffer predicate_buf{ uint predicate[]; };
+
+    uniform int nr_elements;
+
+    void main(){
+        uint n=uint(nr_elements);
+        uint stride=gl_NumWorkGroups.x*gl_WorkGroupSize.x;
+        for(uint i=gl_GlobalInvocationID.x; i<n; i+=stride){
+            predicate[i]= flags[i]!=0u? 1u : 0u;
+        }
+    }
+)";
+
+//writes the flagged elements at the position given by the exclusive scan of the flags
+static const char* compact_comp_src = R"(
+    layout(local_size_x=256) in;
+
+    layout(std430) readonly buffer in_buf{ uint data_in[]; };
+    layout(std430) readonly buffer flags_buf{ uint flags[]; };
+    layout(std430) readonly buffer positions_buf{ uint positions[]; };
+    layout(std430) writeonly buffer out_buf{ uint data_out[]; };
+    layout(std430) writeonly buffer count_buf{ uint count[]; };
+
+    uniform int nr_elements;
+    uniform int words_per_element;
+    uniform int count_idx;
+
+    void main(){
+        uint n=uint(nr_elements);
+        uint w_per_elem=uint(words_per_element);
+        uint stride=gl_NumWorkGroups.x*gl_WorkGroupSize.x;
+        for(uint i=gl_GlobalInvocationID.x; i<n; i+=stride){
+            bool keep= flags[i]!=0u;
+            if(keep){
+                uint dst=positions[i];
+                for(uint w=0u; w<w_per_elem; w++){
+                    data_out[dst*w_per_elem+w]=data_in[i*w_per_elem+w];
+                }
+            }
+            if(i==n-1u){
+                count[count_idx]=positions[i] + (keep? 1u : 0u);
+            }
+        }
+    }
+)";
+
+//counts how many keys of each group of 256 have each of the 16 possible digits. Stored digit major so that one scan gives the global output offsets
+static const char* radix_count_comp_src = R"(
+    layout(local_size_x=256) in;
+
+    layout(std430) readonly buffer keys_buf{ uint keys[]; };
+    layout(std430) writeonly buffer block_hist_buf{ uint block_hist[]; };
+
+    uniform int nr_elements;
+    uniform int shift;
+    uniform int nr_blocks;
+
+    shared uint counts[16];
+
+    void main(){
+        uint tid=gl_LocalInvocationID.x;
+        if(tid<16u){
+            counts[tid]=0u;
+        }
+        barrier();
+
+        uint i=gl_WorkGroupID.x*256u+tid;
+        if(i<uint(nr_elements)){
+            atomicAdd(counts[(keys[i]>>uint(shift)) & 15u], 1u);
+        }
+        barrier();
+
+        if(tid<16u){
+            block_hist[tid*uint(nr_blocks)+gl_WorkGroupID.x]=counts[tid];
+        }
+    }
+)";
+
+//sorts the group of 256 keys by their digit with 1 bit splits in shared memory so the order stays stable, then each key goes to the offset of its digit for this group plus its rank among the keys of the group with the same digit
+static const char* radix_scatter_comp_src = R"(
+    layout(local_size_x=256) in;
+
+    layout(std430) readonly buffer keys_in_buf{ uint keys_in[]; };
+    layout(std430) writeonly buffer keys_out_buf{ uint keys_out[]; };
+    #ifdef HAS_VALUES
+        layout(std430) readonly buffer values_in_buf{ uint values_in[]; };
+        layout(std430) writeonly buffer values_out_buf{ uint values_out[]; };
+    #endif
+    layout(std430) readonly buffer offsets_buf{ uint offsets[]; };
+
+    uniform int nr_elements;
+    uniform int shift;
+    uniform int nr_blocks;
+
+    shared uint s_key[256];
+    shared uint s_value[256];
+    shared uint s_sort_key[256];
+    shared uint s_scan[256];
+    shared uint s_digit_start[16];
+
+    void main(){
+        uint tid=gl_LocalInvocationID.x;
+        uint i=gl_WorkGroupID.x*256u+tid;
+        bool valid= i<uint(nr_elements);
+
+        uint key= valid? keys_in[i] : 0u;
+        uint value=0u;
+        #ifdef HAS_VALUES
+            if(valid) value=values_in[i];
+        #endif
+        //the 5th bit sends the elements past the end of the array to the back of the group
+        uint sort_key=((key>>uint(shift)) & 15u) | (valid? 0u : 16u);
+
+        for(uint bit=0u; bit<5u; bit++){
+            uint b=(sort_key>>bit) & 1u;
+
+            //inclusive scan of the zeros
+            s_scan[tid]=1u-b;
+            barrier();
+            for(uint off=1u; off<256u; off<<=1){
+                uint t= tid>=off? s_scan[tid-off] : 0u;
+                barrier();
+                s_scan[tid]+=t;
+                barrier();
+            }
+            uint total_zeros=s_scan[255];
+            uint zeros_before=s_scan[tid]-(1u-b);
+            uint new_pos= b==0u? zeros_before : total_zeros + (tid-zeros_before);
+            barrier();
+
+            s_key[new_pos]=key;
+            s_value[new_pos]=value;
+            s_sort_key[new_pos]=sort_key;
+            barrier();
+            key=s_key[tid];
+            value=s_value[tid];
+            sort_key=s_sort_key[tid];
+            barrier();
+        }
+
+        //the group is now sorted by digit so each digit starts where it differs from the previous element
+        bool is_valid_sorted= sort_key<16u;
+        uint digit=sort_key & 15u;
+        if(is_valid_sorted && (tid==0u || s_sort_key[tid-1u]!=sort_key)){
+            s_digit_start[digit]=tid;
+        }
+        barrier();
+
+        if(is_valid_sorted){
+            uint dst=offsets[digit*uint(nr_blocks)+gl_WorkGroupID.x] + (tid-s_digit_start[digit]);
+            keys_out[dst]=key;
+            #ifdef HAS_VALUES
+                values_out[dst]=value;
+            #endif
+        }
+    }
+)";
+
+//the dispatch needs one work group per block and we can have at most this many in x
+static const int max_work_groups=65535;
+
+
+Primitives::Primitives(){
+}
+
+Primitives::Primitives(std::string name):
+    Primitives(){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+}
+
+Primitives::~Primitives(){
+}
+
+
+void Primitives::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string Primitives::name() const{
+    return m_name;
+}
+
+void Primitives::exclusive_scan(const Buf& in, Buf& out, const int nr_elements){
+    scan(in, out, nr_elements, false, 0);
+}
+
+void Primitives::inclusive_scan(const Buf& in, Buf& out, const int nr_elements){
+    scan(in, out, nr_elements, true, 0);
+}
+
+void Primitives::reduce(const Buf& in, const int nr_elements, const ReduceOp op, const ReduceType type, Buf& out, const GLintptr out_offset){
+    CHECK(nr_elements>0) << named("Cannot reduce ") << nr_elements << " elements";
+    CHECK(in.size_bytes()>=nr_elements*4) << named("Input buffer has ") << in.size_bytes() << " bytes which is not enough for " << nr_elements << " elements";
+    CHECK(nr_elements<=(long long)max_work_groups*512) << named("Too many elements to reduce. Maximum is ") << max_work_groups*512;
+
+    std::string defines;
+    if(type==ReduceType::UInt){
+        defines+="#define TYPE uint\n";
+        defines+= op==ReduceOp::Sum? "#define IDENTITY 0u\n" : op==ReduceOp::Min? "#define IDENTITY 0xffffffffu\n" : "#define IDENTITY 0u\n";
+    }else if(type==ReduceType::Int){
+        defines+="#define TYPE int\n";
+        defines+= op==ReduceOp::Sum? "#define IDENTITY 0\n" : op==ReduceOp::Min? "#define IDENTITY 2147483647\n" : "#define IDENTITY int(0x80000000u)\n";
+    }else{
+        defines+="#define TYPE float\n";
+        defines+= op==ReduceOp::Sum? "#define IDENTITY 0.0\n" : op==ReduceOp::Min? "#define IDENTITY uintBitsToFloat(0x7f800000u)\n" : "#define IDENTITY uintBitsToFloat(0xff800000u)\n";
+    }
+    defines+= op==ReduceOp::Sum? "#define OP_SUM\n" : op==ReduceOp::Min? "#define OP_MIN\n" : "#define OP_MAX\n";
+    Shader& shader=kernel("reduce", reduce_comp_src, defines);
+
+    //every pass turns 512 elements into 1 until only one is left
+    const Buf* cur_in=&in;
+    int cur_nr=nr_elements;
+    int pass=0;
+    do{
+        int nr_blocks=(cur_nr+511)/512;
+        Buf& partials=scratch(m_reduce_partials[pass%2], nr_blocks*4, "reduce_partials");
+
+        shader.use();
+        shader.bind_buffer(*cur_in, GL_SHADER_STORAGE_BUFFER, "in_buf");
+        shader.bind_buffer(partials, GL_SHADER_STORAGE_BUFFER, "out_buf");
+        shader.uniform_int(cur_nr, "nr_elements");
+        shader.dispatch(nr_blocks*256, 1, 256, 1);
+
+        cur_in=&partials;
+        cur_nr=nr_blocks;
+        pass++;
+    }while(cur_nr>1);
+
+    out.copy_from(*cur_in, 0, out_offset, 4);
+}
+
+void Primitives::compact(const Buf& in, const Buf& flags, const int nr_elements, const int element_size_bytes, Buf& out, Buf& count, const GLintptr count_offset){
+    CHECK(element_size_bytes>0 && element_size_bytes%4==0) << named("Element size has to be a multiple of 4 bytes but it is ") << element_size_bytes;
+    CHECK(in.size_bytes()>=(long long)nr_elements*element_size_bytes) << named("Input buffer is too small for ") << nr_elements << " elements";
+    CHECK(out.size_bytes()>=(long long)nr_elements*element_size_bytes) << named("Output buffer needs space for all the ") << nr_elements << " elements since in the worst case all of them are kept";
+    CHECK(count_offset%4==0) << named("Count offset has to be a multiple of 4 bytes");
+    if(nr_elements==0){
+        unsigned int zero=0;
+        count.upload_sub_data(count_offset, sizeof(zero), &zero);
+        return;
+    }
+
+    //the flags can have any non zero value so we scan a 0/1 predicate of them, otherwise the positions would go past the end of out
+    Buf& positions=scratch(m_compact_positions, nr_elements*4, "compact_positions");
+    Shader& predicate_shader=kernel("compact_predicate", compact_predicate_comp_src);
+    predicate_shader.use();
+    predicate_shader.bind_buffer(flags, GL_SHADER_STORAGE_BUFFER, "flags_buf");
+    predicate_shader.bind_buffer(positions, GL_SHADER_STORAGE_BUFFER, "predicate_buf");
+    predicate_shader.uniform_int(nr_elements, "nr_elements");
+    predicate_shader.dispatch(std::min(nr_elements, max_work_groups*256), 1, 256, 1);
+    exclusive_scan(positions, positions, nr_elements);
+
+    Shader& shader=kernel("compact", compact_comp_src);
+    shader.use();
+    shader.bind_buffer(in, GL_SHADER_STORAGE_BUFFER, "in_buf");
+    shader.bind_buffer(flags, GL_SHADER_STORAGE_BUFFER, "flags_buf");
+    shader.bind_buffer(positions, GL_SHADER_STORAGE_BUFFER, "positions_buf");
+    shader.bind_buffer(out, GL_SHADER_STORAGE_BUFFER, "out_buf");
+    shader.bind_buffer(count, GL_SHADER_STORAGE_BUFFER, "count_buf");
+    shader.uniform_int(nr_elements, "nr_elements");
+    shader.uniform_int(element_size_bytes/4, "words_per_element");
+    shader.uniform_int(count_offset/4, "count_idx");
+    shader.dispatch(std::min(nr_elements, max_work_groups*256), 1, 256, 1);
+}
+
+void Primitives::sort(Buf& keys, const int nr_elements, const int nr_key_bits){
+    radix_sort(keys, nullptr, nr_elements, nr_key_bits);
+}
+
+void Primitives::sort_by_key(Buf& keys, Buf& values, const int nr_elements, const int nr_key_bits){
+    radix_sort(keys, &values, nr_elements, nr_key_bits);
+}
+
+void Primitives::radix_sort(Buf& keys, Buf* values, const int nr_elements, const int nr_key_bits){
+    CHECK(nr_key_bits>0 && nr_key_bits<=32) << named("Keys can have between 1 and 32 bits but we got ") << nr_key_bits;
+    CHECK(keys.size_bytes()>=nr_elements*4) << named("Key buffer is too small for ") << nr_elements << " elements";
+    CHECK(!values || values->size_bytes()>=nr_elements*4) << named("Value buffer is too small for ") << nr_elements << " elements";
+    int nr_blocks=(nr_elements+255)/256;
+    CHECK(nr_blocks<=max_work_groups) << named("Too many elements to sort. Maximum is ") << max_work_groups*256;
+    if(nr_elements<=1) return;
+
+    std::string defines= values? "#define HAS_VALUES\n" : "";
+    Shader& count_shader=kernel("radix_count", radix_count_comp_src);
+    Shader& scatter_shader=kernel("radix_scatter", radix_scatter_comp_src, defines);
+
+    Buf& tmp_keys=scratch(m_sort_keys, nr_elements*4, "sort_keys");
+    Buf* tmp_values= values? &scratch(m_sort_values, nr_elements*4, "sort_values") : nullptr;
+    Buf& block_hist=scratch(m_sort_block_hist, 16*nr_blocks*4, "sort_block_hist");
+
+    //ping pong between the input buffers and the scratch ones, 4 bits per pass
+    Buf* keys_in=&keys;
+    Buf* keys_out=&tmp_keys;
+    Buf* values_in=values;
+    Buf* values_out=tmp_values;
+    int nr_passes=(nr_key_bits+3)/4;
+    for(int pass=0; pass<nr_passes; pass++){
+        int shift=pass*4;
+
+        count_shader.use();
+        count_shader.bind_buffer(*keys_in, GL_SHADER_STORAGE_BUFFER, "keys_buf");
+        count_shader.bind_buffer(block_hist, GL_SHADER_STORAGE_BUFFER, "block_hist_buf");
+        count_shader.uniform_int(nr_elements, "nr_elements");
+        count_shader.uniform_int(shift, "shift");
+        count_shader.uniform_int(nr_blocks, "nr_blocks");
+        count_shader.dispatch(nr_blocks*256, 1, 256, 1);
+
+        exclusive_scan(block_hist, block_hist, 16*nr_blocks);
+
+        scatter_shader.use();
+        scatter_shader.bind_buffer(*keys_in, GL_SHADER_STORAGE_BUFFER, "keys_in_buf");
+        scatter_shader.bind_buffer(*keys_out, GL_SHADER_STORAGE_BUFFER, "keys_out_buf");
+        if(values){
+            scatter_shader.bind_buffer(*values_in, GL_SHADER_STORAGE_BUFFER, "values_in_buf");
+            scatter_shader.bind_buffer(*values_out, GL_SHADER_STORAGE_BUFFER, "values_out_buf");
+        }
+        scatter_shader.bind_buffer(block_hist, GL_SHADER_STORAGE_BUFFER, "offsets_buf");
+        scatter_shader.uniform_int(nr_elements, "nr_elements");
+        scatter_shader.uniform_int(shift, "shift");
+        scatter_shader.uniform_int(nr_blocks, "nr_blocks");
+        scatter_shader.dispatch(nr_blocks*256, 1, 256, 1);
+
+        std::swap(keys_in, keys_out);
+        std::swap(values_in, values_out);
+    }
+
+    //with an odd nr of passes the result ended up in the scratch buffers
+    if(keys_in!=&keys){
+        keys.copy_from(*keys_in, 0, 0, nr_elements*4);
+        if(values){
+            values->copy_from(*values_in, 0, 0, nr_elements*4);
+        }
+    }
+}
+
+Shader& Primitives::kernel(const std::string& kernel_name, const char* src, const std::string& defines){
+    std::string key=kernel_name+"\n"+defines;
+    auto it=m_kernels.find(key);
+    if(it!=m_kernels.end()){
+        return *it->second;
+    }
+
+    std::unique_ptr<Shader> shader(new Shader(named(kernel_name)));
+    shader->compile_from_source("#version 430\n" + defines + src);
+    Shader& ref=*shader;
+    m_kernels[key]=std::move(shader);
+    return ref;
+}
+
+//makes sure the scratch buffer exists and has the requested size. It only reallocates when it has to grow
+Buf& Primitives::scratch(std::unique_ptr<Buf>& buf, const GLsizei size_bytes, const std::string& scratch_name){
+    if(!buf){
+        buf.reset(new Buf(named(scratch_name)));
+        buf->set_target(GL_SHADER_STORAGE_BUFFER);
+    }
+    buf->upload_data(std::max(size_bytes, 4), NULL, GL_DYNAMIC_COPY);
+    return *buf;
+}
+
+void Primitives::scan(const Buf& in, Buf& out, const int nr_elements, const bool inclusive, const int level){
+    CHECK(in.size_bytes()>=nr_elements*4 && out.size_bytes()>=nr_elements*4) << named("Buffers are too small to scan ") << nr_elements << " elements";
+    int nr_blocks=(nr_elements+511)/512;
+    CHECK(nr_blocks<=max_work_groups) << named("Too many elements to scan. Maximum is ") << max_work_groups*512;
+    if(nr_elements==0) return;
+
+    if((int)m_scan_block_sums.size()<=level){
+        m_scan_block_sums.resize(level+1);
+    }
+    Buf& block_sums=scratch(m_scan_block_sums[level], nr_blocks*4, "scan_block_sums");
+
+    Shader& scan_shader=kernel("scan_blocks", scan_blocks_comp_src);
+    scan_shader.use();
+    scan_shader.bind_buffer(in, GL_SHADER_STORAGE_BUFFER, "in_buf");
+    scan_shader.bind_buffer(out, GL_SHADER_STORAGE_BUFFER, "out_buf");
+    scan_shader.bind_buffer(block_sums, GL_SHADER_STORAGE_BUFFER, "block_sums_buf");
+    scan_shader.uniform_int(nr_elements, "nr_elements");
+    scan_shader.uniform_bool(inclusive, "inclusive");
+    scan_shader.uniform_bool(nr_blocks>1, "write_block_sums");
+    scan_shader.dispatch(nr_blocks*256, 1, 256, 1);
+
+    //each block only scanned its own elements so we scan the totals of the blocks and add them back
+    if(nr_blocks>1){
+        scan(block_sums, block_sums, nr_blocks, false, level+1);
+
+        Shader& add_shader=kernel("scan_add_block_sums", scan_add_block_sums_comp_src);
+        add_shader.use();
+        add_shader.bind_buffer(out, GL_SHADER_STORAGE_BUFFER, "data_buf");
+        add_shader.bind_buffer(block_sums, GL_SHADER_STORAGE_BUFFER, "block_sums_buf");
+        add_shader.uniform_int(nr_elements, "nr_elements");
+        add_shader.dispatch(nr_blocks*256, 1, 256, 1);
+    }
+}
+
+
+std::string Primitives::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+} //namespace gl
@@ -0,0 +1,204 @@
+#include "easy_gl/ResourcePool.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <algorithm>
+
+#include "easy_gl/Buf.h"
+#include "easy_gl/Texture2D.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+//the next power of two after this doesn't fit in a GLsizei so bigger buffers get a bucket of their exact size
+static const GLsizei max_pow2_bucket_size=1<<30;
+
+//smallest power of two that is at least size. Sizes bellow 256 bytes all go in the same bucket
+static GLsizei round_up_to_pow2(const GLsizei size){
+    GLsizei pow2=256;
+    while(pow2<size){
+        pow2*=2;
+    }
+    return pow2;
+}
+
+//biggest power of two that is at most size
+static GLsizei round_down_to_pow2(const GLsizei size){
+    GLsizei pow2=1;
+    while(pow2<=size/2){
+        pow2*=2;
+    }
+    return pow2;
+}
+
+ResourcePool::ResourcePool():
+    m_max_pooled_per_bucket(8)
+    {
+}
+
+ResourcePool::ResourcePool(std::string name):
+    ResourcePool(){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+}
+
+ResourcePool::~ResourcePool(){
+}
+
+
+void ResourcePool::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string ResourcePool::name() const{
+    return m_name;
+}
+
+void ResourcePool::set_max_pooled_per_bucket(const int max_pooled){
+    CHECK(max_pooled>=0) << named("Max pooled objects per bucket cannot be negative");
+    m_max_pooled_per_bucket=max_pooled;
+}
+
+std::unique_ptr<Buf> ResourcePool::acquire_buf(const GLenum target, const GLsizei size_bytes, const GLenum usage_hints){
+    CHECK(size_bytes>0) << named("Cannot acquire a buffer of ") << size_bytes << " bytes";
+
+    GLsizei bucket_size= size_bytes>max_pow2_bucket_size? size_bytes : round_up_to_pow2(size_bytes);
+    BufKey key=std::make_tuple(target, bucket_size, usage_hints);
+
+    std::unique_ptr<Buf> buf;
+    auto it=m_buf_buckets.find(key);
+    if(it!=m_buf_buckets.end() && !it->second.empty()){
+        buf=std::move(it->second.back());
+        it->second.pop_back();
+        m_stats.buf_hits++;
+        m_stats.nr_pooled_bufs--;
+        m_stats.pooled_bytes-=buf->capacity_bytes();
+    }else{
+        buf.reset(new Buf());
+        buf->set_target(target);
+        buf->allocate_storage(bucket_size, usage_hints);
+        m_stats.buf_misses++;
+    }
+
+    //the size fits in the capacity so this only sets the size without touching the storage
+    buf->upload_data(target, size_bytes, NULL, usage_hints);
+
+    return buf;
+}
+
+void ResourcePool::release_buf(std::unique_ptr<Buf> buf){
+    if(!buf){
+        return;
+    }
+    //inmutable storage can have all kinds of flags that we don't track so we don't bother reusing it
+    if(!buf->storage_initialized() || buf->is_inmutable() || m_max_pooled_per_bucket==0){
+        return;
+    }
+
+    //the buffer might have grown to a size that is not a power of two so we round down so that it can serve all the request of that bucket. The huge ones only serve requests of their exact size, like in acquire_buf()
+    GLsizei bucket_size= buf->capacity_bytes()>max_pow2_bucket_size? buf->capacity_bytes() : round_down_to_pow2(buf->capacity_bytes());
+    if(bucket_size<256){
+        return;
+    }
+    BufKey key=std::make_tuple(buf->target(), bucket_size, buf->usage_hints());
+
+    std::vector< std::unique_ptr<Buf> >& bucket=m_buf_buckets[key];
+    if((int)bucket.size()>=m_max_pooled_per_bucket){
+        return; //the buffer gets destroyed here
+    }
+    m_stats.nr_pooled_bufs++;
+    m_stats.pooled_bytes+=buf->capacity_bytes();
+    bucket.push_back(std::move(buf));
+}
+
+std::unique_ptr<Texture2D> ResourcePool::acquire_texture(const GLint internal_format, const GLenum format, const GLenum type, const int width, const int height, const int nr_mips){
+    CHECK(width>0 && height>0) << named("Cannot acquire a texture of size ") << width << "x" << height;
+    CHECK(nr_mips>=1) << named("A texture needs at least one mip but we requested ") << nr_mips;
+
+    TexKey key=std::make_tuple(internal_format, format, type, width, height, nr_mips);
+
+    std::unique_ptr<Texture2D> tex;
+    auto it=m_tex_buckets.find(key);
+    if(it!=m_tex_buckets.end() && !it->second.empty()){
+        tex=std::move(it->second.back());
+        it->second.pop_back();
+        m_stats.tex_hits++;
+        m_stats.nr_pooled_textures--;
+        m_stats.pooled_bytes-=texture_bytes(*tex);
+    }else{
+        tex.reset(new Texture2D());
+        tex->allocate_storage(internal_format, format, type, width, height);
+        if(nr_mips>1){
+            tex->generate_mipmap(nr_mips-1);
+        }
+        m_stats.tex_misses++;
+    }
+
+    return tex;
+}
+
+void ResourcePool::release_texture(std::unique_ptr<Texture2D> tex){
+    if(!tex){
+        return;
+    }
+    if(!tex->storage_initialized() || m_max_pooled_per_bucket==0){
+        return;
+    }
+
+    TexKey key=std::make_tuple(tex->internal_format(), tex->format(), tex->type(), tex->width(), tex->height(), tex->mipmap_nr_levels_allocated());
+
+    std::vector< std::unique_ptr<Texture2D> >& bucket=m_tex_buckets[key];
+    if((int)bucket.size()>=m_max_pooled_per_bucket){
+        return; //the texture gets destroyed here
+    }
+    m_stats.nr_pooled_textures++;
+    m_stats.pooled_bytes+=texture_bytes(*tex);
+    bucket.push_back(std::move(tex));
+}
+
+void ResourcePool::clear(){
+    m_buf_buckets.clear();
+    m_tex_buckets.clear();
+    m_stats.nr_pooled_bufs=0;
+    m_stats.nr_pooled_textures=0;
+    m_stats.pooled_bytes=0;
+}
+
+ResourcePoolStats ResourcePool::stats() const{
+    return m_stats;
+}
+
+void ResourcePool::reset_stats(){
+    m_stats.buf_hits=0;
+    m_stats.buf_misses=0;
+    m_stats.tex_hits=0;
+    m_stats.tex_misses=0;
+}
+
+long long ResourcePool::texture_bytes(Texture2D& tex) const{
+    long long bytes=tex.num_bytes_texture();
+    //the whole mip chain adds roughly a third on top of the base level
+    if(tex.mipmap_nr_levels_allocated()>1){
+        bytes=bytes*4/3;
+    }
+    return bytes;
+}
+
+
+std::string ResourcePool::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+} //namespace gl
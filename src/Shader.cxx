@@ -6,6 +6,7 @@
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
+#include <algorithm>
 
 #include <easy_gl/UtilsGL.h>
 #include "easy_gl/Texture2D.h"
@@ -28,14 +29,21 @@ Shader::Shader():
     m_is_compiled(false),
     m_is_compute_shader(false),
     m_nr_texture_units_used(0),
-    m_nr_image_units_used(0)
+    m_nr_image_units_used(0),
+    m_nr_buffer_binding_points_used(0)
     {
         //when we bind a texture we use up a texture unit. We check that we don't go above this value
         GL_C(glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &m_max_allowed_texture_units));
 
         //when we bind a image we use up a image unit. We check that we don't go above this value
-        //GL_C(glGetIntegerv(GL_MAX_IMAGE_UNITS, &m_max_allowed_image_units));
-m_max_allowed_image_units=8; //for soem reason the GL_MAX_IMAGE_UNITS is not defined in opengl3 evne if I included the glad with the image_load_store extensions. Either way, I just set the maximum to 8 which is the minimum that Opengl will require to have
+        GL_C(glGetIntegerv(GL_MAX_IMAGE_UNITS, &m_max_allowed_image_units));
+
+        //buffer blocks have their own binding points, separate from the image units. The ssbo and ubo ones are separate too but we hand out the same number to both so we take the smaller limit
+        GLint max_ssbo_bindings=0;
+        GLint max_ubo_bindings=0;
+        GL_C(glGetIntegerv(GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS, &max_ssbo_bindings));
+        GL_C(glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &max_ubo_bindings));
+        m_max_allowed_buffer_binding_points=std::min(max_ssbo_bindings, max_ubo_bindings);
 }
 
 Shader::Shader(const std::string name):
@@ -71,6 +79,17 @@ void Shader::compile(const std::string &vertex_shader_filename,
     m_is_compiled=true;
 }
 
+//same as above but from the source code instead of a file. Useful for shaders that are part of the library
+void Shader::compile_from_source(const std::string &compute_shader_src){
+    m_prog_id = program_init(compute_shader_src);
+    m_is_compiled=true;
+    m_is_compute_shader=true;
+}
+void Shader::compile_from_source(const std::string &vertex_shader_src, const std::string &fragment_shader_src){
+    m_prog_id = program_init(vertex_shader_src, fragment_shader_src);
+    m_is_compiled=true;
+}
+
 
 void Shader::use() const{
     CHECK(m_is_compiled) << named("Program is not compiled! Use prog.compile() first");
@@ -105,9 +124,10 @@ void Shader::bind_texture(const T& tex, const std::string& uniform_name){
 }
 
 //bind with a certain access mode a 2D image
-void Shader::bind_image(const gl::Texture2D& tex, const GLenum access, const std::string& uniform_name){
+void Shader::bind_image(const gl::Texture2D& tex, const GLenum access, const std::string& uniform_name, const int lvl){
     CHECK(m_is_compiled) << named("Program is not compiled! Use prog.compile() first");
     CHECK(tex.storage_initialized()) << named("Texture " + tex.name() + " has no storage initialized");
+    CHECK(lvl>=0 && lvl<tex.mipmap_nr_levels_allocated()) << named("Texture " ) << tex.name() << " has no mip level " << lvl;
     CHECK(is_internal_format_valid_for_image_bind(tex.internal_format())) << named("Texture " ) << tex.name() << "is internal format invalid for image bind. Check the list of valid formats at https://www.khronos.org/opengl/wiki/Image_Load_Store";
 
     // check_format_is_valid_for_image_bind(tex);
@@ -124,11 +144,31 @@ void Shader::bind_image(const gl::Texture2D& tex, const GLenum access, const std
         cur_image_unit=image2image_units[uniform_name];
     }
     uniform_int(cur_image_unit, uniform_name); //we cna either use binding=x in the shader or we can set it programatically like this
-    CHECK(m_nr_image_units_used<m_max_allowed_image_units) << named("You used too many image units! Try to bind less images to the shader");
+    CHECK(m_nr_image_units_used<=m_max_allowed_image_units) << named("You used too many image units! Try to bind less images to the shader");
 
 
 
-    GL_C(glBindImageTexture(cur_image_unit, tex.tex_id(), 0, GL_FALSE, 0, access, tex.internal_format()));
+    GL_C(glBindImageTexture(cur_image_unit, tex.tex_id(), lvl, GL_FALSE, 0, access, tex.internal_format()));
+}
+
+//bind the first mip of the view as a 2D image
+void Shader::bind_image(const gl::TextureView& view, const GLenum access, const std::string& uniform_name){
+    CHECK(m_is_compiled) << named("Program is not compiled! Use prog.compile() first");
+    CHECK(view.storage_initialized()) << named("Texture view " + view.name() + " was not created");
+    CHECK(is_internal_format_valid_for_image_bind(view.internal_format())) << named("Texture view " ) << view.name() << "is internal format invalid for image bind. Check the list of valid formats at https://www.khronos.org/opengl/wiki/Image_Load_Store";
+
+    int cur_image_unit;
+    if(image2image_units.find (uniform_name) == image2image_units.end()){
+        cur_image_unit=m_nr_image_units_used;
+        image2image_units[uniform_name]=cur_image_unit;
+        m_nr_image_units_used++;
+    }else{
+        cur_image_unit=image2image_units[uniform_name];
+    }
+    uniform_int(cur_image_unit, uniform_name);
+    CHECK(m_nr_image_units_used<=m_max_allowed_image_units) << named("You used too many image units! Try to bind less images to the shader");
+
+    GL_C(glBindImageTexture(cur_image_unit, view.tex_id(), 0, GL_FALSE, 0, access, view.internal_format()));
 }
 
 // //bind all layers of the Texture Array
@@ -150,7 +190,7 @@ void Shader::bind_image(const gl::Texture2D& tex, const GLenum access, const std
 //         cur_image_unit=image2image_units[uniform_name];
 //     }
 //     uniform_int(cur_image_unit, uniform_name); //we cna either use binding=x in the shader or we can set it programatically like this
-//     CHECK(m_nr_image_units_used<m_max_allowed_image_units) << named("You used too many image units! Try to bind less images to the shader");
+//     CHECK(m_nr_image_units_used<=m_max_allowed_image_units) << named("You used too many image units! Try to bind less images to the shader");
 
 //     GL_C(glBindImageTexture(cur_image_unit, tex.tex_id(), 0, GL_TRUE, 0, access, tex.internal_format()));
 // }
@@ -181,29 +221,43 @@ void Shader::bind_image(const gl::Texture2D& tex, const GLenum access, const std
 //         cur_image_unit=image2image_units[uniform_name];
 //     }
 //     uniform_int(cur_image_unit, uniform_name); //we cna either use binding=x in the shader or we can set it programatically like this
-//     CHECK(m_nr_image_units_used<m_max_allowed_image_units) << named("You used too many image units! Try to bind less images to the shader");
+//     CHECK(m_nr_image_units_used<=m_max_allowed_image_units) << named("You used too many image units! Try to bind less images to the shader");
 
 //     GL_C(glBindImageTexture(cur_image_unit, tex.tex_id(), 0, GL_TRUE, 0, access, tex.internal_format()));
 // }
 
 
 //bind a buffer
-void Shader::bind_buffer(const gl::Buf& buf, const std::string& uniform_name){
-
-    int cur_image_unit;
-    if(image2image_units.find (uniform_name) == image2image_units.end()){
-        //the image was never used before so we bind it
-        cur_image_unit=m_nr_image_units_used;
-        image2image_units[uniform_name]=cur_image_unit;
-        m_nr_image_units_used++;
+//buffers grow geometrically so the storage can be bigger than the bytes in use. In that case only the used bytes are bound so that the .length() of an ssbo or the range of an ubo doesn't include the stale bytes after them
+//An empty buffer that still has capacity cannot be bound as a range of 0 bytes and binding all of it would expose the stale bytes, so it's an error
+void Shader::bind_buffer_used_bytes(const GLenum target, const int binding_point, const gl::Buf& buf) const{
+    CHECK(!buf.storage_initialized() || buf.size_bytes()>0) << named("Buffer ") << buf.name() << " is empty so it cannot be bound. Upload something into it first";
+    if(buf.storage_initialized() && buf.size_bytes()<buf.capacity_bytes()){
+        glBindBufferRange(target, binding_point, buf.buf_id(), 0, buf.size_bytes());
     }else{
-        //the image was used before and the texture was already assigned to a certain image unit, We bind the image to the same one
-        cur_image_unit=image2image_units[uniform_name];
+        glBindBufferBase(target, binding_point, buf.buf_id());
     }
-    uniform_int(cur_image_unit, uniform_name); //we cna either use binding=x in the shader or we can set it programatically like this
-    CHECK(m_nr_image_units_used<m_max_allowed_image_units) << named("You used too many image units! Try to bind less images to the shader");
+}
+
+void Shader::bind_buffer(const gl::Buf& buf, const std::string& uniform_name){
+    int binding_point=buffer_binding_point(uniform_name);
+    bind_buffer_used_bytes(buf.target(), binding_point, buf);
+}
+
+//bind to a different target than the one of the buffer, for example a vertex buffer as GL_SHADER_STORAGE_BUFFER for a compute shader
+void Shader::bind_buffer(const gl::Buf& buf, const GLenum target, const std::string& uniform_name){
+    int binding_point=buffer_binding_point(uniform_name);
+    bind_buffer_used_bytes(target, binding_point, buf);
+}
 
-    glBindBufferBase(buf.target(), cur_image_unit, buf.buf_id());
+//bind only a range of a buffer with glBindBufferRange, for example an allocation of a BufArena. The target is given because arenas usually hold vertex or index data whose targets are not indexed
+void Shader::bind_buffer(const gl::BufRange& range, const GLenum target, const std::string& uniform_name){
+    CHECK(range.buf) << named("The range for ") << uniform_name << " does not point to any buffer";
+    CHECK(range.buf->storage_initialized()) << named("Buffer " + range.buf->name() + " has no storage initialized");
+    CHECK(target==GL_SHADER_STORAGE_BUFFER || target==GL_UNIFORM_BUFFER) << named("A range can only be bound to GL_SHADER_STORAGE_BUFFER or GL_UNIFORM_BUFFER but the target for ") << uniform_name << " is " << std::hex << target << std::dec;
+
+    int binding_point=buffer_binding_point(uniform_name);
+    glBindBufferRange(target, binding_point, range.buf->buf_id(), range.offset, range.size_bytes);
 }
 
 GLint Shader::get_attrib_location(const std::string attrib_name) const{
@@ -419,6 +473,34 @@ std::string Shader::named(const std::string msg) const{
     return m_name.empty()? msg : m_name + ": " + msg;
 }
 
+//gets the binding point for a buffer block and points the block in the shader towards it
+int Shader::buffer_binding_point(const std::string& block_name){
+    auto it=buffer2binding_points.find(block_name);
+    if(it!=buffer2binding_points.end()){
+        //the block already points to this binding point so there is nothing to tell the program
+        return it->second;
+    }
+
+    //the buffer was never used before so it gets the next binding point
+    int binding_point=m_nr_buffer_binding_points_used;
+    buffer2binding_points[block_name]=binding_point;
+    m_nr_buffer_binding_points_used++;
+    CHECK(m_nr_buffer_binding_points_used<=m_max_allowed_buffer_binding_points) << named("You used too many buffer binding points! Try to bind less buffers to the shader");
+
+    //buffer blocks are not uniforms so we have to point the block towards the binding point instead of using uniform_int
+    GLuint ssbo_idx=glGetProgramResourceIndex(m_prog_id, GL_SHADER_STORAGE_BLOCK, block_name.c_str());
+    GLuint ubo_idx=glGetUniformBlockIndex(m_prog_id, block_name.c_str());
+    if(ssbo_idx!=GL_INVALID_INDEX){
+        glShaderStorageBlockBinding(m_prog_id, ssbo_idx, binding_point);
+    }else if(ubo_idx!=GL_INVALID_INDEX){
+        glUniformBlockBinding(m_prog_id, ubo_idx, binding_point);
+    }else{
+        uniform_int(binding_point, block_name); //we cna either use binding=x in the shader or we can set it programatically like this
+    }
+
+    return binding_point;
+}
+
 
 //for compute shaders
 GLuint Shader::program_init( const std::string &compute_shader_string){
@@ -524,6 +606,7 @@ inline std::string Shader::file_to_string (const std::string &filename){
 // Here is the explicit instanciation
 template void Shader::bind_texture(const Texture2D&, const std::string&);
 template void Shader::bind_texture(const CubeMap&, const std::string&);
+template void Shader::bind_texture(const TextureView&, const std::string&);
 
 
 
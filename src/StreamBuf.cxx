@@ -0,0 +1,185 @@
+#include "easy_gl/StreamBuf.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <cstring> //memcpy
+
+#include "easy_gl/Buf.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+StreamBuf::StreamBuf():
+    m_mapped_ptr(nullptr),
+    m_region_size_bytes(0),
+    m_alignment(16),
+    m_head(0),
+    m_cur_region_idx(0),
+    m_nr_stalls(0)
+    {
+}
+
+StreamBuf::StreamBuf(std::string name):
+    StreamBuf(){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+    m_buf.set_name(name);
+}
+
+StreamBuf::~StreamBuf(){
+    for(size_t i=0; i<m_region_fences.size(); i++){
+        if(m_region_fences[i]){
+            glDeleteSync(m_region_fences[i]);
+            m_region_fences[i]=nullptr;
+        }
+    }
+    //the persistent mapping gets released together with the buffer so no need to unmap
+}
+
+
+void StreamBuf::set_name(const std::string name){
+    m_name=name;
+    m_buf.set_name(name);
+}
+
+std::string StreamBuf::name() const{
+    return m_name;
+}
+
+void StreamBuf::allocate(const GLenum target, const GLsizeiptr region_size_bytes, const int nr_regions){
+    CHECK(!m_buf.storage_initialized()) << named("StreamBuf was already allocated. The storage is inmutable so it cannot be allocated again");
+    CHECK(region_size_bytes>0) << named("Region size should be positive but it is ") << region_size_bytes;
+    CHECK(nr_regions>=2) << named("We need at least 2 regions so that the CPU can write into one while the GPU reads the other but we got ") << nr_regions;
+
+    //offsets used for glBindBufferRange need to respect the alignment of the target
+    GLint alignment=16;
+    if(target==GL_UNIFORM_BUFFER){
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    }else if(target==GL_SHADER_STORAGE_BUFFER){
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    }
+    m_alignment=std::max(alignment, 16);
+
+    //make each region start at an aligned offset
+    m_region_size_bytes=(region_size_bytes + m_alignment-1)/m_alignment*m_alignment;
+    GLsizeiptr total_bytes=m_region_size_bytes*nr_regions;
+
+    GLbitfield flags=GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    m_buf.allocate_inmutable(target, total_bytes, NULL, flags);
+    m_mapped_ptr=(unsigned char*)m_buf.map_range(0, total_bytes, flags);
+
+    m_region_fences.resize(nr_regions, nullptr);
+    m_cur_region_idx=0;
+    m_head=0;
+}
+
+StreamBufRange StreamBuf::reserve(const GLsizeiptr bytes){
+    CHECK(m_mapped_ptr) << named("StreamBuf has no storage. Use allocate() first");
+    CHECK(bytes>0) << named("Cannot reserve a chunk of size ") << bytes;
+
+    GLsizeiptr aligned_head=(m_head + m_alignment-1)/m_alignment*m_alignment;
+    //we cannot just move to the next region here because the draws reading from the current one were not yet issued so there is nothing to fence
+    CHECK(aligned_head+bytes<=m_region_size_bytes) << named("Region overflow. Tried to reserve ") << bytes << " bytes but only " << m_region_size_bytes-aligned_head << " are left in this region. Allocate the StreamBuf with a bigger region size";
+
+    StreamBufRange range;
+    range.gpu_offset=m_cur_region_idx*m_region_size_bytes + aligned_head;
+    range.cpu_ptr=m_mapped_ptr+range.gpu_offset;
+    range.size_bytes=bytes;
+
+    m_head=aligned_head+bytes;
+
+    return range;
+}
+
+StreamBufRange StreamBuf::push(const void* data_ptr, const GLsizeiptr bytes){
+    StreamBufRange range=reserve(bytes);
+    memcpy(range.cpu_ptr, data_ptr, bytes);
+    return range;
+}
+
+void StreamBuf::advance_region(){
+    CHECK(m_mapped_ptr) << named("StreamBuf has no storage. Use allocate() first");
+
+    //the GPU will read the current region with the commands issued up until now so we fence it
+    if(m_region_fences[m_cur_region_idx]){
+        glDeleteSync(m_region_fences[m_cur_region_idx]);
+    }
+    m_region_fences[m_cur_region_idx]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    //move to the next one and make sure the GPU finished reading it from the last time we used it
+    m_cur_region_idx=(m_cur_region_idx+1)%m_region_fences.size();
+    m_head=0;
+    wait_for_region(m_cur_region_idx);
+}
+
+void StreamBuf::bind() const{
+    m_buf.bind();
+}
+
+const Buf& StreamBuf::buf() const{
+    return m_buf;
+}
+
+Buf& StreamBuf::buf(){
+    return m_buf;
+}
+
+bool StreamBuf::storage_initialized() const{
+    return m_buf.storage_initialized();
+}
+
+int StreamBuf::nr_regions() const{
+    return m_region_fences.size();
+}
+
+GLsizeiptr StreamBuf::region_size_bytes() const{
+    return m_region_size_bytes;
+}
+
+GLsizeiptr StreamBuf::region_used_bytes() const{
+    return m_head;
+}
+
+int StreamBuf::cur_region_idx() const{
+    return m_cur_region_idx;
+}
+
+int StreamBuf::nr_stalls() const{
+    return m_nr_stalls;
+}
+
+void StreamBuf::wait_for_region(const int region_idx){
+    GLsync& fence=m_region_fences[region_idx];
+    if(!fence){
+        return; //never used so the GPU is not reading from it
+    }
+
+    //first check without waiting so we can count how often we actually stall
+    GLenum status=glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if(status==GL_TIMEOUT_EXPIRED){
+        m_nr_stalls++;
+        while(status==GL_TIMEOUT_EXPIRED){
+            status=glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); //1ms
+        }
+    }
+    LOG_IF(ERROR, status==GL_WAIT_FAILED) << named("Waiting for the fence of region ") << region_idx << " failed";
+
+    glDeleteSync(fence);
+    fence=nullptr;
+}
+
+
+std::string StreamBuf::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+} //namespace gl
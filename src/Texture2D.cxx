@@ -16,6 +16,10 @@
 
 #include "easy_gl/UtilsGL.h"
 #include "easy_gl/Buf.h"
+#include "easy_gl/Shader.h"
+#include "easy_gl/Primitives.h"
+#include "easy_gl/PixelConversion.h"
+#include "easy_gl/TextureView.h"
 
 
 
@@ -30,28 +34,31 @@ Texture2D::Texture2D():
     m_tex_id(EGL_INVALID),
     m_tex_storage_initialized(false),
     m_tex_storage_inmutable(false),
+    m_storage_guard(std::make_shared<TextureStorageGuard>()),
     m_internal_format(EGL_INVALID),
     m_format(EGL_INVALID),
     m_type(EGL_INVALID),
     m_idx_mipmap_allocated(0),
     m_nr_pbos_upload(2),
     m_cur_pbo_upload_idx(0),
+    m_cur_persistent_pbo_upload_idx(0),
+    m_upload_slot_mapped(false),
+    m_upload_slot_internal_format(EGL_INVALID),
+    m_upload_slot_format(EGL_INVALID),
+    m_upload_slot_type(EGL_INVALID),
+    m_upload_slot_width(0),
+    m_upload_slot_height(0),
     m_nr_pbos_download(3),
     m_cur_pbo_download_idx(0),
     m_fbos_for_mips(16, EGL_INVALID),
+    m_finest_resident_lvl(0),
     m_cuda_transfer_enabled(false){
     glGenTextures(1,&m_tex_id);
 
     //create some pbos used for uploading to the texture
-    m_pbos_upload.resize(m_nr_pbos_upload);
-    for(int i=0; i<m_nr_pbos_upload; i++){
-        m_pbos_upload[i].set_target(GL_PIXEL_UNPACK_BUFFER);
-    }
+    set_nr_pbos_upload(m_nr_pbos_upload);
     //create some pbos used to download this texture to cpu
-    m_pbos_download.resize(m_nr_pbos_download);
-    for(int i=0; i<m_nr_pbos_download; i++){
-        m_pbos_download[i].set_target(GL_PIXEL_PACK_BUFFER);
-    }
+    set_nr_pbos_download(m_nr_pbos_download);
 
     //initializing a texture requires setting the mip map levels  https://www.khronos.org/opengl/wiki/Common_Mistakes
     bind();
@@ -82,6 +89,9 @@ Texture2D::Texture2D(std::string name):
     m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
 }
 
+Texture2D::Texture2D(Texture2D && other) = default;
+Texture2D & Texture2D::operator=(Texture2D && other) = default;
+
 Texture2D::~Texture2D(){
     // LOG(WARNING) << named("Destroying texture");
     // cudaGraphicsUnregisterResource(m_cuda_resource);
@@ -89,8 +99,17 @@ Texture2D::~Texture2D(){
         disable_cuda_transfer();
     #endif
 
+    //a moved from texture has no guard
+    if(m_storage_guard){
+        std::lock_guard<std::mutex> lock(m_storage_guard->mutex);
+        m_storage_guard->alive=false;
+    }
     glDeleteTextures(1, &m_tex_id);
 
+    delete_pbo_fences(m_pbos_upload_fences);
+    delete_pbo_fences(m_persistent_pbos_upload_fences);
+    delete_pbo_fences(m_pbos_download_fences);
+
     for(size_t i=0; i<m_fbos_for_mips.size(); i++){
         if (m_fbos_for_mips[i]!=EGL_INVALID){
             glDeleteFramebuffers(1, &m_fbos_for_mips[i]);
@@ -175,15 +194,9 @@ void Texture2D::upload_data(GLint internal_format, GLenum format, GLenum type, G
 
     // bind the texture and PBO
     GL_C( glBindTexture(GL_TEXTURE_2D, m_tex_id) );
-    Buf& pbo_upload=m_pbos_upload[m_cur_pbo_upload_idx];
+    Buf& pbo_upload=next_upload_pbo(size_bytes);
     pbo_upload.bind();
 
-
-    if(!pbo_upload.storage_initialized() || pbo_upload.width()!=width || pbo_upload.height()!=height){
-        pbo_upload.allocate_storage(size_bytes, GL_STREAM_DRAW);
-        pbo_upload.set_width(width);
-        pbo_upload.set_height(height);
-    }
     // if(!m_tex_storage_initialized || m_width!=width || m_height!=height){
         // GL_C( glTexImage2D(GL_TEXTURE_2D, 0, internal_format,width,height,0,format,type,0) ); //allocate storage texture
         // m_tex_storage_initialized=true;
@@ -205,18 +218,204 @@ void Texture2D::upload_data(GLint internal_format, GLenum format, GLenum type, G
 
     // copy pixels from PBO to texture object (this returns inmediatelly and lets the GPU perform DMA at a later time)
     GL_C( glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, 0) );
+    fence_upload_pbo();
 
 
     // it is good idea to release PBOs with ID 0 after use. Once bound with 0, all pixel operations behave normal ways.
     pbo_upload.unbind();
 
-    m_cur_pbo_upload_idx=(m_cur_pbo_upload_idx+1)%m_nr_pbos_upload;
-
     //change back to unpack alignment of 4 which would be the default in case we changed it before
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
 
+//uploads only the rects of src that changed. The rects get packed one after another into a single pbo and each one is transfered with its own glTexSubImage2D
+void Texture2D::upload_regions(const std::vector<cv::Rect>& rects, const void* src, const int src_row_stride_bytes){
+    CHECK(m_tex_storage_initialized) << named("Texture storage was not initialized. Uploading regions needs the storage to be already allocated");
+    CHECK(src) << named("The source pointer is null");
+
+    int pixel_bytes=gl_pixel_size_bytes(m_format, m_type);
+    CHECK(src_row_stride_bytes>=m_width*pixel_bytes) << named("The row stride of ") << src_row_stride_bytes << " bytes is smaller than a row of the texture which has " << m_width*pixel_bytes << " bytes";
+
+    //clip to the texture and drop the empty ones
+    cv::Rect tex_rect(0, 0, m_width, m_height);
+    std::vector<cv::Rect> clipped;
+    std::vector<size_t> offsets;
+    size_t size_bytes=0;
+    for(size_t i=0; i<rects.size(); i++){
+        cv::Rect rect=rects[i] & tex_rect;
+        if(rect.width<=0 || rect.height<=0){
+            continue;
+        }
+        clipped.push_back(rect);
+        offsets.push_back(size_bytes);
+        size_bytes+=(size_t)rect.width*rect.height*pixel_bytes;
+    }
+    if(clipped.empty()){
+        return;
+    }
+
+    Buf& pbo_upload=next_upload_pbo(size_bytes);
+
+    //pack the rows of each rect tightly
+    unsigned char* dst=(unsigned char*)pbo_upload.map_range(0, size_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    for(size_t i=0; i<clipped.size(); i++){
+        const cv::Rect& rect=clipped[i];
+        size_t row_bytes=(size_t)rect.width*pixel_bytes;
+        for(int y=0; y<rect.height; y++){
+            const unsigned char* src_row=(const unsigned char*)src + (size_t)(rect.y+y)*src_row_stride_bytes + (size_t)rect.x*pixel_bytes;
+            memcpy(dst+offsets[i]+y*row_bytes, src_row, row_bytes);
+        }
+    }
+    pbo_upload.unmap();
+
+    GL_C( glBindTexture(GL_TEXTURE_2D, m_tex_id) );
+    pbo_upload.bind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(size_t i=0; i<clipped.size(); i++){
+        const cv::Rect& rect=clipped[i];
+        GL_C( glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, m_format, m_type, (const void*)offsets[i]) );
+    }
+    fence_upload_pbo();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    pbo_upload.unbind();
+}
+
+//uploads data that is already block compressed. The storage gets allocated as inmutable with nr_levels the first time
+void Texture2D::upload_compressed(GLenum internal_format, GLsizei width, GLsizei height, const void* data_ptr, int size_bytes, const int lvl, const int nr_levels){
+    CHECK(is_internal_format_compressed(internal_format)) << named("Internal format ") << std::hex << internal_format << std::dec << " is not a compressed one";
+
+    if(!m_tex_storage_initialized){
+        //the format and type are not used by compressed textures but they need to be valid
+        allocate_storage_inmutable(internal_format, GL_RGBA, GL_UNSIGNED_BYTE, width, height, nr_levels);
+    }else{
+        CHECK(m_internal_format==(GLint)internal_format && m_width==width && m_height==height) << named("The texture already has a storage with a different format or size. Compressed textures are inmutable so create a new texture instead");
+    }
+    CHECK(lvl>=0 && lvl<mipmap_nr_levels_allocated()) << named("Mip level ") << lvl << " is not allocated";
+    int lvl_w=width_for_lvl(lvl);
+    int lvl_h=height_for_lvl(lvl);
+    CHECK(size_bytes==gl_compressed_size_bytes(internal_format, lvl_w, lvl_h)) << named("Level ") << lvl << " of " << lvl_w << "x" << lvl_h << " should have " << gl_compressed_size_bytes(internal_format, lvl_w, lvl_h) << " bytes but we got " << size_bytes;
+
+    GL_C( glBindTexture(GL_TEXTURE_2D, m_tex_id) );
+    Buf& pbo_upload=next_upload_pbo(size_bytes);
+    pbo_upload.bind();
+    pbo_upload.upload_sub_data(size_bytes, data_ptr);
+    GL_C( glCompressedTexSubImage2D(GL_TEXTURE_2D, lvl, 0, 0, lvl_w, lvl_h, internal_format, size_bytes, 0) );
+    fence_upload_pbo();
+    pbo_upload.unbind();
+}
+
+//uploads one mip level of an already allocated storage through the pbo ring. The rows are tightly packed
+void Texture2D::upload_level(const int lvl, const void* data_ptr, int size_bytes){
+    CHECK(m_tex_storage_initialized) << named("Texture storage was not initialized. Uploading a level needs the storage to be already allocated");
+    CHECK(!is_internal_format_compressed(m_internal_format)) << named("The texture is block compressed. Use upload_compressed() instead");
+    CHECK(lvl>=0 && lvl<mipmap_nr_levels_allocated()) << named("Mip level ") << lvl << " is not allocated";
+    int lvl_w=width_for_lvl(lvl);
+    int lvl_h=height_for_lvl(lvl);
+    CHECK(size_bytes==lvl_w*lvl_h*gl_pixel_size_bytes(m_format, m_type)) << named("Level ") << lvl << " of " << lvl_w << "x" << lvl_h << " should have " << lvl_w*lvl_h*gl_pixel_size_bytes(m_format, m_type) << " bytes but we got " << size_bytes;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    GL_C( glBindTexture(GL_TEXTURE_2D, m_tex_id) );
+    Buf& pbo_upload=next_upload_pbo(size_bytes);
+    pbo_upload.bind();
+    pbo_upload.upload_sub_data(size_bytes, data_ptr);
+    GL_C( glTexSubImage2D(GL_TEXTURE_2D, lvl, 0, 0, lvl_w, lvl_h, m_format, m_type, 0) );
+    fence_upload_pbo();
+    pbo_upload.unbind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+//the pbo of the upload ring that comes next. If the GPU is still reading it from the last time we went around the ring we orphan it so that writing it doesn't wait
+Buf& Texture2D::next_upload_pbo(const size_t size_bytes){
+    Buf& pbo_upload=m_pbos_upload[m_cur_pbo_upload_idx];
+    GLsync& upload_fence=m_pbos_upload_fences[m_cur_pbo_upload_idx];
+    bool pbo_busy=false;
+    if(upload_fence){
+        GLenum status=glClientWaitSync(upload_fence, 0, 0);
+        pbo_busy= status!=GL_ALREADY_SIGNALED && status!=GL_CONDITION_SATISFIED;
+        glDeleteSync(upload_fence);
+        upload_fence=nullptr;
+    }
+    if(pbo_busy || !pbo_upload.storage_initialized() || (size_t)pbo_upload.size_bytes()<size_bytes){
+        pbo_upload.allocate_storage(size_bytes, GL_STREAM_DRAW);
+    }
+    return pbo_upload;
+}
+
+//fences the pbo returned by next_upload_pbo() after the transfer from it was issued and moves the ring forward
+void Texture2D::fence_upload_pbo(){
+    m_pbos_upload_fences[m_cur_pbo_upload_idx]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_cur_pbo_upload_idx=(m_cur_pbo_upload_idx+1)%m_nr_pbos_upload;
+}
+
+//zero copy upload. Returns a pointer into a persistently mapped pbo where the caller writes width*height pixels with tightly packed rows
+void* Texture2D::map_upload_slot(GLint internal_format, GLenum format, GLenum type, GLsizei width, GLsizei height){
+    CHECK(is_internal_format_valid(internal_format)) << named("Internal format not valid");
+    CHECK(is_format_valid(format)) << named("Format not valid");
+    CHECK(is_type_valid(type)) << named("Type not valid");
+    CHECK(!m_upload_slot_mapped) << named("The previous upload slot was not commited yet. Call commit_upload_slot() first");
+
+    int idx=m_cur_persistent_pbo_upload_idx;
+    int size_bytes=width*height*gl_pixel_size_bytes(format, type);
+
+    //the GPU had the whole ring worth of uploads to read this pbo so usually the fence is already signaled. If it's not we don't wait for it but replace the pbo, the GL keeps the old storage alive until the GPU is done with it
+    GLsync& fence=m_persistent_pbos_upload_fences[idx];
+    bool pbo_busy=false;
+    if(fence){
+        GLenum status=glClientWaitSync(fence, 0, 0);
+        LOG_IF(ERROR, status==GL_WAIT_FAILED) << named("Checking the upload pbo fence failed");
+        pbo_busy= status!=GL_ALREADY_SIGNALED && status!=GL_CONDITION_SATISFIED;
+        glDeleteSync(fence);
+        fence=nullptr;
+    }
+
+    std::unique_ptr<Buf>& pbo=m_persistent_pbos_upload[idx];
+    if(!pbo || pbo_busy || pbo->size_bytes()<size_bytes){
+        //coherent so that the writes of the caller are visible to the glTexSubImage2D without any flush
+        GLbitfield flags=GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        pbo.reset(new Buf(named("persistent_pbo_upload")));
+        pbo->allocate_inmutable(GL_PIXEL_UNPACK_BUFFER, size_bytes, NULL, flags);
+        m_persistent_pbos_upload_ptrs[idx]=pbo->map_range(0, size_bytes, flags);
+        pbo->unbind(); //otherwise the normal uploads from cpu memory would read from this pbo
+    }
+
+    m_upload_slot_mapped=true;
+    m_upload_slot_internal_format=internal_format;
+    m_upload_slot_format=format;
+    m_upload_slot_type=type;
+    m_upload_slot_width=width;
+    m_upload_slot_height=height;
+
+    return m_persistent_pbos_upload_ptrs[idx];
+}
+
+//transfers the slot returned by map_upload_slot() into the texture. Returns inmediatelly and the GPU does the DMA later
+void Texture2D::commit_upload_slot(){
+    CHECK(m_upload_slot_mapped) << named("No upload slot to commit. Call map_upload_slot() first");
+
+    int idx=m_cur_persistent_pbo_upload_idx;
+    Buf& pbo_upload=*m_persistent_pbos_upload[idx];
+
+    allocate_or_resize(m_upload_slot_internal_format, m_upload_slot_format, m_upload_slot_type, m_upload_slot_width, m_upload_slot_height);
+    m_width=m_upload_slot_width;
+    m_height=m_upload_slot_height;
+    m_internal_format=m_upload_slot_internal_format;
+    m_format=m_upload_slot_format;
+    m_type=m_upload_slot_type;
+
+    //the rows in the slot are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    GL_C( glBindTexture(GL_TEXTURE_2D, m_tex_id) );
+    pbo_upload.bind();
+    GL_C( glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, m_format, m_type, 0) );
+    m_persistent_pbos_upload_fences[idx]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    pbo_upload.unbind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    m_upload_slot_mapped=false;
+    m_cur_persistent_pbo_upload_idx=(m_cur_persistent_pbo_upload_idx+1)%m_nr_pbos_upload;
+}
+
 //easy way to just get a cv mat there, does internally an upload to pbo and schedules a dma
 //by default the values will get transfered to the gpu and get normalized to [0,1] therefore an rgb texture of unsigned bytes will be read as floats from the shader with sampler2D. However sometimes we might want to use directly the integers stored there, for example when we have a semantic texture and the nr range from [0,nr_classes]. Then we set normalize to false and in the shader we acces the texture with usampler2D
 void Texture2D::upload_from_cv_mat(const cv::Mat& cv_mat, const bool flip_red_blue, const bool store_as_normalized_vals){
@@ -237,11 +436,91 @@ void Texture2D::upload_from_cv_mat(const cv::Mat& cv_mat, const bool flip_red_bl
         CHECK(m_internal_format==internal_format) << "Previously defined internal format is not the same as the one which will be used for the opencv image upload";
     }
 
+    //RGB has no native layout in the gpu so the driver pads it to RGBA on the cpu one pixel at a time, and floats in BGR order also get swizzled by it. We do both with simd while copying into the pbo
+    bool is_float= cv_mat.depth()==CV_32F;
+    if(cv_mat.channels()==3 || (cv_mat.channels()==4 && is_float && flip_red_blue)){
+        GLenum transfer_format= store_as_normalized_vals || is_float ? GL_RGBA : GL_RGBA_INTEGER;
+        upload_converted(cv_mat, internal_format, format, type, transfer_format, 4, is_float? PixelDepth::F32 : PixelDepth::U8, flip_red_blue);
+        return;
+    }
+
     //do the upload to the pbo
     int size_bytes=cv_mat.step[0] * cv_mat.rows;
     upload_data(internal_format, format, type, cv_mat.cols, cv_mat.rows, cv_mat.ptr(), size_bytes);
 }
 
+//channels and depth of the pixels we transfer for the internal formats that upload_from_cv_mat_to_format() supports
+static bool internal_format2transfer(int& nr_channels, PixelDepth& depth, const GLint internal_format){
+    switch(internal_format){
+        case GL_R8: nr_channels=1; depth=PixelDepth::U8; return true;
+        case GL_RG8: nr_channels=2; depth=PixelDepth::U8; return true;
+        case GL_RGB8: case GL_SRGB8: nr_channels=3; depth=PixelDepth::U8; return true;
+        case GL_RGBA8: case GL_SRGB8_ALPHA8: nr_channels=4; depth=PixelDepth::U8; return true;
+        case GL_R16F: nr_channels=1; depth=PixelDepth::F16; return true;
+        case GL_RG16F: nr_channels=2; depth=PixelDepth::F16; return true;
+        case GL_RGB16F: nr_channels=3; depth=PixelDepth::F16; return true;
+        case GL_RGBA16F: nr_channels=4; depth=PixelDepth::F16; return true;
+        case GL_R32F: nr_channels=1; depth=PixelDepth::F32; return true;
+        case GL_RG32F: nr_channels=2; depth=PixelDepth::F32; return true;
+        case GL_RGB32F: nr_channels=3; depth=PixelDepth::F32; return true;
+        case GL_RGBA32F: nr_channels=4; depth=PixelDepth::F32; return true;
+    }
+    return false;
+}
+
+void Texture2D::upload_from_cv_mat_to_format(const cv::Mat& cv_mat, const GLint internal_format, const bool flip_red_blue){
+    CHECK(cv_mat.data) << named("cv_mat is empty");
+    CHECK(cv_mat.depth()==CV_8U || cv_mat.depth()==CV_32F) << named("Only 8 bit and float mats can be converted");
+    int nr_channels=0;
+    PixelDepth depth=PixelDepth::U8;
+    CHECK(internal_format2transfer(nr_channels, depth, internal_format)) << named("Internal format ") << std::hex << internal_format << std::dec << " is not supported for converting uploads. Use an 8 bit, half or float one";
+    CHECK(nr_channels==cv_mat.channels()) << named("The internal format has ") << nr_channels << " channels but the mat has " << cv_mat.channels();
+
+    //the format and type that the texture remembers are the ones of the pixels it would give back when downloading
+    GLenum format=GL_RED;
+    switch(nr_channels){
+        case 1: format=GL_RED; break;
+        case 2: format=GL_RG; break;
+        case 3: format= flip_red_blue? GL_BGR : GL_RGB; break;
+        case 4: format= flip_red_blue? GL_BGRA : GL_RGBA; break;
+    }
+    GLenum type=pixel_depth_gl_type(depth);
+
+    int transfer_channels= nr_channels==3? 4 : nr_channels;
+    GLenum transfer_format= transfer_channels==4? GL_RGBA : format;
+    upload_converted(cv_mat, internal_format, format, type, transfer_format, transfer_channels, depth, flip_red_blue && nr_channels>=3);
+}
+
+void Texture2D::upload_converted(const cv::Mat& cv_mat, GLint internal_format, GLenum format, GLenum type, GLenum transfer_format, const int transfer_channels, const PixelDepth transfer_depth, const bool swap_red_blue){
+    int width=cv_mat.cols;
+    int height=cv_mat.rows;
+    if (m_internal_format!=EGL_INVALID){ //if we already have a format, it should be compatible with the one we are using for uploding
+        CHECK(m_internal_format==internal_format) << named("Previously defined internal format is not the same as the one which will be used for the opencv image upload");
+    }
+    allocate_or_resize(internal_format, format, type, width, height);
+    m_width=width;
+    m_height=height;
+    m_internal_format=internal_format;
+    m_format=format;
+    m_type=type;
+
+    size_t row_bytes=(size_t)width*transfer_channels*pixel_depth_size_bytes(transfer_depth);
+    size_t size_bytes=row_bytes*height;
+    Buf& pbo_upload=next_upload_pbo(size_bytes);
+    void* dst=pbo_upload.map_range(0, size_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    PixelDepth src_depth= cv_mat.depth()==CV_32F? PixelDepth::F32 : PixelDepth::U8;
+    convert_pixels(cv_mat.ptr(), cv_mat.step[0], cv_mat.channels(), src_depth, dst, row_bytes, transfer_channels, transfer_depth, width, height, swap_red_blue);
+    pbo_upload.unmap();
+
+    GL_C( glBindTexture(GL_TEXTURE_2D, m_tex_id) );
+    pbo_upload.bind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    GL_C( glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, transfer_format, pixel_depth_gl_type(transfer_depth), 0) );
+    fence_upload_pbo();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    pbo_upload.unbind();
+}
+
 
 // void upload_without_pbo(GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* data_ptr){
     // TODO this needs to be redone because I dont like that it takes the xoffset and y offset and so on. We should have an overloaded function that just is upload_without_pbo(data_ptr) which assumes that the texture already has a storage and it can do TexSubimage and another more complete that take also the internal_format, format and type and does teximage2d
@@ -273,6 +552,7 @@ void Texture2D::resize(const int w, const int h){
     #endif
 
 
+    storage_changed();
     glTexImage2D(GL_TEXTURE_2D, 0, m_internal_format, w, h, 0, m_format, m_type, 0); //allocate storage texture
 
     //if we have mip map levels we have to regenerate the memory for them too
@@ -310,6 +590,7 @@ void Texture2D::allocate_storage(GLenum internal_format, GLenum format, GLenum t
         }
     #endif
 
+    storage_changed();
     glTexImage2D(GL_TEXTURE_2D, 0, internal_format,width,height,0,format,type,0); //allocate storage texture
     m_tex_storage_initialized=true;
 
@@ -328,11 +609,12 @@ void Texture2D::allocate_storage(GLenum internal_format, GLenum format, GLenum t
 
 
 //allocate inmutable texture storage
-void Texture2D::allocate_storage_inmutable(GLenum internal_format, GLenum format, GLenum type, GLsizei width, GLsizei height){
+void Texture2D::allocate_storage_inmutable(GLenum internal_format, GLenum format, GLenum type, GLsizei width, GLsizei height, const int nr_levels){
     CHECK(is_internal_format_valid(internal_format)) << named("Internal format not valid");
     CHECK(is_format_valid(format)) << named("Format not valid");
     CHECK(is_type_valid(type)) << named("Type not valid");
     CHECK(!m_tex_storage_inmutable) << named("You already allocated texture as inmutable. To resize you can delete and recreate the texture or use mutable storage with allocate_tex_storage()");
+    CHECK(nr_levels>=1 && nr_levels<=mipmap_nr_lvls_for_size(width, height)) << named("A texture of ") << width << "x" << height << " can have between 1 and " << mipmap_nr_lvls_for_size(width, height) << " mip levels but we got " << nr_levels;
     m_width=width;
     m_height=height;
     m_internal_format=internal_format;
@@ -340,9 +622,92 @@ void Texture2D::allocate_storage_inmutable(GLenum internal_format, GLenum format
     m_type=type; //also not really needed but its nice to have
 
     glBindTexture(GL_TEXTURE_2D, m_tex_id);
-    glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+    storage_changed();
+    glTexStorage2D(GL_TEXTURE_2D, nr_levels, internal_format, width, height);
     m_tex_storage_initialized=true;
     m_tex_storage_inmutable=true;
+
+    m_idx_mipmap_allocated=nr_levels-1;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, nr_levels-1);
+}
+
+//allocates the full mip chain and uploads the levels that are at most max_initial_level_size so the texture can be sampled right away
+void Texture2D::begin_progressive_upload(const cv::Mat& cv_mat, const bool flip_red_blue, const bool store_as_normalized_vals, const int max_initial_level_size){
+    CHECK(cv_mat.data) << named("cv_mat is empty");
+
+    GLint internal_format=EGL_INVALID;
+    GLenum format=EGL_INVALID;
+    GLenum type=EGL_INVALID;
+    cv_type2gl_formats(internal_format, format, type, cv_mat.type(), flip_red_blue, store_as_normalized_vals);
+
+    int nr_levels=mipmap_nr_lvls_for_size(cv_mat.cols, cv_mat.rows);
+    allocate_storage_inmutable(internal_format, format, type, cv_mat.cols, cv_mat.rows, nr_levels);
+    if(nr_levels>1){
+        set_filter_mode_min(GL_LINEAR_MIPMAP_LINEAR);
+    }
+
+    //we only keep a reference to the image, the levels are downsampled from it one at a time so the cpu never holds the whole pyramid
+    m_progressive_source=cv_mat;
+
+    //nothing is resident yet so we start past the last level and upload the small ones
+    m_finest_resident_lvl=nr_levels;
+    while(upload_next_progressive_level()){
+        if(std::max(width_for_lvl(m_finest_resident_lvl), height_for_lvl(m_finest_resident_lvl))>=max_initial_level_size){
+            break;
+        }
+    }
+}
+
+//uploads the next finer level and clamps the base level to it. Returns true while there are levels left
+bool Texture2D::upload_next_progressive_level(){
+    if(progressive_upload_done()){
+        return false;
+    }
+
+    int lvl=m_finest_resident_lvl-1;
+    cv::Mat level;
+    if(lvl==0){
+        level=m_progressive_source;
+    }else{
+        Eigen::Vector2i size=calculate_mipmap_size(m_progressive_source.cols, m_progressive_source.rows, lvl);
+        cv::resize(m_progressive_source, level, cv::Size(size.x(), size.y()), 0, 0, cv::INTER_AREA);
+    }
+
+    //through the pbo ring so the transfer is done by the GPU later instead of stalling on client memory. The rows of the mat may have padding at the end so they get packed tightly
+    size_t row_bytes=(size_t)level.cols*level.elemSize();
+    size_t size_bytes=row_bytes*level.rows;
+    Buf& pbo_upload=next_upload_pbo(size_bytes);
+    unsigned char* dst=(unsigned char*)pbo_upload.map_range(0, size_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    for(int y=0; y<level.rows; y++){
+        memcpy(dst+y*row_bytes, level.ptr(y), row_bytes);
+    }
+    pbo_upload.unmap();
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    bind();
+    pbo_upload.bind();
+    GL_C( glTexSubImage2D(GL_TEXTURE_2D, lvl, 0, 0, level.cols, level.rows, m_format, m_type, 0) );
+    fence_upload_pbo();
+    pbo_upload.unbind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    level.release();
+
+    //from now on the sampling can use this level
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, lvl);
+    m_finest_resident_lvl=lvl;
+    if(lvl==0){
+        m_progressive_source.release();
+    }
+
+    return !progressive_upload_done();
+}
+
+bool Texture2D::progressive_upload_done() const{
+    return m_finest_resident_lvl==0;
+}
+
+int Texture2D::finest_resident_lvl() const{
+    return m_finest_resident_lvl;
 }
 
 void Texture2D::allocate_or_resize(GLenum internal_format, GLenum format, GLenum type, GLsizei width, GLsizei height){
@@ -441,7 +806,7 @@ void Texture2D::download_to_pbo(){
 
     //if the width is not divisible by 4 we need to change the packing alignment https://www.khronos.org/opengl/wiki/Common_Mistakes#Texture_upload_and_pixel_reads
     if( (m_format==GL_RGB || m_format==GL_BGR || m_format==GL_RED) && width()%4!=0){
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
     }
 
 
@@ -461,13 +826,18 @@ void Texture2D::download_to_pbo(){
 
     //transfer from texture to pbo
     glGetTexImage(GL_TEXTURE_2D, 0, m_format, m_type, 0);
+    GLsync& download_fence=m_pbos_download_fences[m_cur_pbo_download_idx];
+    if(download_fence){
+        glDeleteSync(download_fence); //the transfer that was in this pbo was never read and now it's overwritten
+    }
+    download_fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
 
     // it is good idea to release PBOs with ID 0 after use. Once bound with 0, all pixel operations behave normal ways.
     pbo_download.unbind();
     m_cur_pbo_download_idx=(m_cur_pbo_download_idx+1)%m_nr_pbos_download;
-    //change back to unpack alignment of 4 which would be the default in case we changed it before
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    //change back to pack alignment of 4 which would be the default in case we changed it before
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
     unbind(); //unbind also the texture
 }
 
@@ -480,6 +850,15 @@ void Texture2D::download_from_oldest_pbo(void* data_out){
     // bind the PBO and copy the dtaa from it
     Buf& pbo_download=m_pbos_download[m_cur_pbo_download_idx];
     if(pbo_download.storage_initialized()){
+        //wait explicitly instead of letting glMapBuffer stall somewhere inside the driver
+        GLsync& download_fence=m_pbos_download_fences[m_cur_pbo_download_idx];
+        if(download_fence){
+            GLenum status=glClientWaitSync(download_fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            LOG_IF(ERROR, status==GL_WAIT_FAILED) << named("Waiting for the download pbo fence failed");
+            glDeleteSync(download_fence);
+            download_fence=nullptr;
+        }
+
         pbo_download.bind();
 
         void* data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
@@ -493,10 +872,80 @@ void Texture2D::download_from_oldest_pbo(void* data_out){
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
+//same as above but never waits. Returns false if the oldest pbo has no new data or the GPU is still writing it
+bool Texture2D::try_download_from_oldest_pbo(void* data_out){
+    GLsync& download_fence=m_pbos_download_fences[m_cur_pbo_download_idx];
+    if(!download_fence){
+        return false;
+    }
+    //the flush makes sure the fence actually gets to the GPU, otherwise we could poll it forever
+    GLenum status=glClientWaitSync(download_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    LOG_IF(ERROR, status==GL_WAIT_FAILED) << named("Waiting for the download pbo fence failed");
+    if(status!=GL_ALREADY_SIGNALED && status!=GL_CONDITION_SATISFIED){
+        return false;
+    }
+
+    //the fence is signaled so this doesn't wait
+    download_from_oldest_pbo(data_out);
+    return true;
+}
+
 Buf& Texture2D::cur_pbo_download(){
     return m_pbos_download[m_cur_pbo_download_idx];
 }
 
+void Texture2D::set_nr_pbos_upload(const int nr_pbos){
+    CHECK(nr_pbos>=1) << named("We need at least one pbo for uploading but we got ") << nr_pbos;
+    CHECK(!m_upload_slot_mapped) << named("Cannot change the nr of pbos while an upload slot is mapped");
+    delete_pbo_fences(m_pbos_upload_fences);
+    m_pbos_upload.clear();
+    m_pbos_upload.resize(nr_pbos);
+    for(int i=0; i<nr_pbos; i++){
+        m_pbos_upload[i].set_target(GL_PIXEL_UNPACK_BUFFER);
+    }
+    m_pbos_upload_fences.resize(nr_pbos, nullptr);
+    m_nr_pbos_upload=nr_pbos;
+    m_cur_pbo_upload_idx=0;
+
+    delete_pbo_fences(m_persistent_pbos_upload_fences);
+    m_persistent_pbos_upload.clear();
+    m_persistent_pbos_upload.resize(nr_pbos);
+    m_persistent_pbos_upload_ptrs.clear();
+    m_persistent_pbos_upload_ptrs.resize(nr_pbos, nullptr);
+    m_persistent_pbos_upload_fences.resize(nr_pbos, nullptr);
+    m_cur_persistent_pbo_upload_idx=0;
+}
+
+void Texture2D::set_nr_pbos_download(const int nr_pbos){
+    CHECK(nr_pbos>=1) << named("We need at least one pbo for downloading but we got ") << nr_pbos;
+    delete_pbo_fences(m_pbos_download_fences);
+    m_pbos_download.clear();
+    m_pbos_download.resize(nr_pbos);
+    for(int i=0; i<nr_pbos; i++){
+        m_pbos_download[i].set_target(GL_PIXEL_PACK_BUFFER);
+    }
+    m_pbos_download_fences.resize(nr_pbos, nullptr);
+    m_nr_pbos_download=nr_pbos;
+    m_cur_pbo_download_idx=0;
+}
+
+int Texture2D::nr_pbos_upload() const{
+    return m_nr_pbos_upload;
+}
+
+int Texture2D::nr_pbos_download() const{
+    return m_nr_pbos_download;
+}
+
+void Texture2D::delete_pbo_fences(std::vector<GLsync>& fences){
+    for(size_t i=0; i<fences.size(); i++){
+        if(fences[i]){
+            glDeleteSync(fences[i]);
+        }
+    }
+    fences.clear();
+}
+
 
 
 //clears the texture to zero
@@ -608,7 +1057,10 @@ cv::Mat Texture2D::download_to_cv_mat(const int lvl, const bool denormalize){
 
     //download from gpu into the cv memory
     glGetTexImage(GL_TEXTURE_2D,lvl, m_format, m_type, cv_mat.data);
-    if(denormalize){
+    if(denormalize && cv_mat.depth()==CV_32F){
+        //go from range [0,1] to [0,255] in place with simd
+        convert_pixels(cv_mat.ptr(), cv_mat.step[0], cv_mat.channels(), PixelDepth::F32, cv_mat.ptr(), cv_mat.step[0], cv_mat.channels(), PixelDepth::F32, cv_mat.cols, cv_mat.rows, false, 255.0f);
+    }else if(denormalize){
         cv_mat*=255; //go from range [0,1] to [0,255];
     }
 
@@ -743,6 +1195,320 @@ cv::Mat Texture2D::download_to_cv_mat(const int lvl, const bool denormalize){
     }
 #endif
 
+//first pass of the reduction. Each work group reduces a tile of 32x32 texels into one value. The rest is a 1D reduction done by Primitives
+static const char* tex_reduce_comp_src = R"(
+    layout(local_size_x=16, local_size_y=16) in;
+
+    uniform sampler2D tex;
+    uniform int lvl;
+    uniform int channel;
+    uniform float scale;
+
+    layout(std430) writeonly buffer partials_buf{ float partials[]; };
+
+    shared float s_partial[256];
+
+    float op(float a, float b){
+        #if defined(OP_SUM)
+            return a+b;
+        #elif defined(OP_MIN)
+            return min(a,b);
+        #else
+            return max(a,b);
+        #endif
+    }
+
+    void main(){
+        ivec2 size=textureSize(tex, lvl);
+        ivec2 base=ivec2(gl_WorkGroupID.xy)*32 + ivec2(gl_LocalInvocationID.xy)*2;
+
+        float val=IDENTITY;
+        for(int y=0; y<2; y++){
+            for(int x=0; x<2; x++){
+                ivec2 p=base+ivec2(x,y);
+                if(p.x<size.x && p.y<size.y){
+                    val=op(val, texelFetch(tex, p, lvl)[channel]*scale);
+                }
+            }
+        }
+
+        uint tid=gl_LocalInvocationIndex;
+        s_partial[tid]=val;
+        for(uint s=128u; s>0u; s>>=1){
+            barrier();
+            if(tid<s){
+                s_partial[tid]=op(s_partial[tid], s_partial[tid+s]);
+            }
+        }
+
+        if(tid==0u){
+            partials[gl_WorkGroupID.y*gl_NumWorkGroups.x+gl_WorkGroupID.x]=s_partial[0];
+        }
+    }
+)";
+
+static std::string tex_reduce_defines(const TexReduceOp op){
+    std::string defines;
+    if(op==TexReduceOp::Min){
+        defines="#define OP_MIN\n#define IDENTITY uintBitsToFloat(0x7f800000u)\n";
+    }else if(op==TexReduceOp::Max){
+        defines="#define OP_MAX\n#define IDENTITY uintBitsToFloat(0xff800000u)\n";
+    }else{
+        defines="#define OP_SUM\n#define IDENTITY 0.0\n"; //the mean is a sum with every texel scaled by 1/nr_texels
+    }
+    return defines;
+}
+
+//the kernels belong to the texture, so they are destroyed with it while its GL context is still alive
+Shader& Texture2D::kernel(const std::string& kernel_name, const char* src, const std::string& defines){
+    std::string key=kernel_name+"\n"+defines;
+    auto it=m_kernels.find(key);
+    if(it!=m_kernels.end()){
+        return *it->second;
+    }
+
+    std::unique_ptr<Shader> shader(new Shader(named(kernel_name)));
+    shader->compile_from_source("#version 430\n" + defines + src);
+    Shader& ref=*shader;
+    m_kernels[key]=std::move(shader);
+    return ref;
+}
+
+//reduces one channel of a mip level on the gpu and writes the result as a float into out at out_offset (in bytes). Nothing comes back to the cpu so it can be used directly by other shaders, for example the max depth or the mean luminance for exposure
+void Texture2D::reduce(const TexReduceOp op, const int channel, Buf& out, const GLintptr out_offset, const int lvl){
+    CHECK(m_tex_storage_initialized) << named("Texture storage was not initialized. Cannot reduce it");
+    CHECK(channel>=0 && channel<4) << named("Channel should be between 0 and 3 but it is ") << channel;
+    CHECK(lvl>=0 && lvl<mipmap_nr_levels_allocated()) << named("Mip level ") << lvl << " is not allocated";
+    bool is_integer_format= m_format==GL_RED_INTEGER || m_format==GL_RG_INTEGER || m_format==GL_RGB_INTEGER || m_format==GL_RGBA_INTEGER;
+    CHECK(!is_integer_format) << named("Reduction is only supported for float, normalized and depth textures. Integer textures would need a usampler");
+
+    int w=width_for_lvl(lvl);
+    int h=height_for_lvl(lvl);
+    int nr_groups_x=(w+31)/32;
+    int nr_groups_y=(h+31)/32;
+    int nr_groups=nr_groups_x*nr_groups_y;
+
+    if(!m_reduce_partials){
+        m_reduce_partials.reset(new Buf(named("reduce_partials")));
+        m_reduce_partials->set_target(GL_SHADER_STORAGE_BUFFER);
+    }
+    m_reduce_partials->upload_data(nr_groups*sizeof(float), NULL, GL_DYNAMIC_COPY);
+
+    Shader& shader=kernel("tex_reduce", tex_reduce_comp_src, tex_reduce_defines(op));
+    shader.use();
+    shader.bind_texture(*this, "tex");
+    shader.bind_buffer(*m_reduce_partials, GL_SHADER_STORAGE_BUFFER, "partials_buf");
+    shader.uniform_int(lvl, "lvl");
+    shader.uniform_int(channel, "channel");
+    shader.uniform_float(op==TexReduceOp::Mean? 1.0f/((float)w*h) : 1.0f, "scale");
+    shader.dispatch(nr_groups_x*16, nr_groups_y*16, 16, 16);
+
+    ReduceOp buf_op= op==TexReduceOp::Min? ReduceOp::Min : op==TexReduceOp::Max? ReduceOp::Max : ReduceOp::Sum;
+    if(!m_reduce_primitives){
+        m_reduce_primitives.reset(new Primitives(named("reduce")));
+    }
+    m_reduce_primitives->reduce(*m_reduce_partials, nr_groups, buf_op, ReduceType::Float, out, out_offset);
+}
+
+BufDownload Texture2D::reduce_async(const TexReduceOp op, const int channel, const int lvl){
+    BufDownload download;
+    reduce_async(download, op, channel, lvl);
+    return download;
+}
+
+//same as above but reuses the readback buffer of a previous download
+void Texture2D::reduce_async(BufDownload& download, const TexReduceOp op, const int channel, const int lvl){
+    if(!m_reduce_result){
+        m_reduce_result.reset(new Buf(named("reduce_result")));
+        m_reduce_result->set_target(GL_SHADER_STORAGE_BUFFER);
+        m_reduce_result->upload_data(sizeof(float), NULL, GL_DYNAMIC_COPY);
+    }
+    reduce(op, channel, *m_reduce_result, 0, lvl);
+    m_reduce_result->download_async(download, 0, sizeof(float));
+}
+
+//conversion pass of download_into(). Every invocation writes one 32 bit word of a row of the result, which holds 4, 2 or 1 values depending on the depth
+static const char* tex_download_convert_comp_src = R"(
+    layout(local_size_x=64, local_size_y=1) in;
+
+    uniform sampler2D tex;
+    uniform int lvl;
+    uniform int out_width;
+    uniform int out_height;
+    uniform int words_per_row;
+    uniform int nr_channels;
+    uniform int channels_packed; //4 bits per channel of the result with the channel of the texture plus 2
+    uniform int flip_y;
+    uniform float scale;
+
+    layout(std430) writeonly buffer out_buf{ uint out_words[]; };
+
+    //bilinear by hand so it doesn't depend on the filtering the texture was set up with
+    vec4 fetch_pixel(int x, int y){
+        ivec2 size=textureSize(tex, lvl);
+        if(flip_y!=0){
+            y=out_height-1-y;
+        }
+        if(size.x==out_width && size.y==out_height){
+            return texelFetch(tex, ivec2(x,y), lvl);
+        }
+        vec2 pos=(vec2(x,y)+0.5)*vec2(size)/vec2(out_width,out_height) - 0.5;
+        ivec2 p0=ivec2(floor(pos));
+        vec2 f=pos-vec2(p0);
+        ivec2 max_p=size-1;
+        vec4 c00=texelFetch(tex, clamp(p0, ivec2(0), max_p), lvl);
+        vec4 c10=texelFetch(tex, clamp(p0+ivec2(1,0), ivec2(0), max_p), lvl);
+        vec4 c01=texelFetch(tex, clamp(p0+ivec2(0,1), ivec2(0), max_p), lvl);
+        vec4 c11=texelFetch(tex, clamp(p0+ivec2(1,1), ivec2(0), max_p), lvl);
+        return mix(mix(c00, c10, f.x), mix(c01, c11, f.x), f.y);
+    }
+
+    float pick(vec4 pixel, int c){
+        int src=((channels_packed>>(4*c))&15)-2;
+        if(src==-1){
+            return 1.0;
+        }else if(src<0){
+            return 0.0;
+        }
+        return pixel[src]*scale;
+    }
+
+    void main(){
+        int word=int(gl_GlobalInvocationID.x);
+        int y=int(gl_GlobalInvocationID.y);
+        if(word>=words_per_row || y>=out_height){
+            return;
+        }
+
+        int nr_values=out_width*nr_channels;
+        uint packed=0u;
+        int cur_x=-1;
+        vec4 pixel=vec4(0.0);
+        for(int e=0; e<VALUES_PER_WORD; e++){
+            int i=word*VALUES_PER_WORD+e;
+            if(i>=nr_values){
+                break;
+            }
+            int x=i/nr_channels;
+            if(x!=cur_x){
+                pixel=fetch_pixel(x, y);
+                cur_x=x;
+            }
+            float val=pick(pixel, i%nr_channels);
+            #if defined(DEPTH_U8)
+                packed|=uint(clamp(val, 0.0, 1.0)*255.0+0.5)<<(8*e);
+            #elif defined(DEPTH_F16)
+                packed|=(packHalf2x16(vec2(val, 0.0))&0xffffu)<<(16*e);
+            #else
+                packed=floatBitsToUint(val);
+            #endif
+        }
+        out_words[y*words_per_row+word]=packed;
+    }
+)";
+
+static std::string tex_download_convert_defines(const PixelDepth depth){
+    std::string defines;
+    if(depth==PixelDepth::U8){
+        defines="#define DEPTH_U8\n#define VALUES_PER_WORD 4\n";
+    }else if(depth==PixelDepth::F16){
+        defines="#define DEPTH_F16\n#define VALUES_PER_WORD 2\n";
+    }else{
+        defines="#define DEPTH_F32\n#define VALUES_PER_WORD 1\n";
+    }
+    return defines;
+}
+
+static void download_conversion_size(int& w, int& h, const Texture2D& tex, const TexDownloadConversion& conversion){
+    w= conversion.width>0? conversion.width : tex.width_for_lvl(conversion.lvl);
+    h= conversion.height>0? conversion.height : tex.height_for_lvl(conversion.lvl);
+}
+
+int Texture2D::download_row_stride_bytes(const TexDownloadConversion& conversion) const{
+    int w, h;
+    download_conversion_size(w, h, *this, conversion);
+    return round_up_to_nearest_multiple(w*conversion.nr_channels*pixel_depth_size_bytes(conversion.depth), 4);
+}
+
+void Texture2D::convert_for_download(Buf& out, const TexDownloadConversion& conversion){
+    CHECK(m_tex_storage_initialized) << named("Texture storage was not initialized. Cannot download it");
+    CHECK(conversion.lvl>=0 && conversion.lvl<mipmap_nr_levels_allocated()) << named("Mip level ") << conversion.lvl << " is not allocated";
+    CHECK(conversion.nr_channels>=1 && conversion.nr_channels<=4) << named("The result needs between 1 and 4 channels but we got ") << conversion.nr_channels;
+    CHECK(conversion.width>=0 && conversion.height>=0) << named("The size of the result cannot be negative");
+    bool is_integer_format= m_format==GL_RED_INTEGER || m_format==GL_RG_INTEGER || m_format==GL_RGB_INTEGER || m_format==GL_RGBA_INTEGER;
+    CHECK(!is_integer_format) << named("Converting downloads is only supported for float, normalized and depth textures. Integer textures would need a usampler");
+
+    int channels_packed=0;
+    for(int c=0; c<conversion.nr_channels; c++){
+        CHECK(conversion.channels[c]>=-2 && conversion.channels[c]<4) << named("Channel ") << c << " of the result maps to " << conversion.channels[c] << " but it should be between -2 and 3";
+        channels_packed|=(conversion.channels[c]+2)<<(4*c);
+    }
+
+    int w, h;
+    download_conversion_size(w, h, *this, conversion);
+    int row_stride=download_row_stride_bytes(conversion);
+    GLsizeiptr size_bytes=(GLsizeiptr)row_stride*h;
+    if(!out.storage_initialized() || out.size_bytes()<size_bytes){
+        out.set_target(GL_SHADER_STORAGE_BUFFER);
+        out.upload_data(size_bytes, NULL, GL_DYNAMIC_COPY);
+    }
+
+    Shader& shader=kernel("tex_download_convert", tex_download_convert_comp_src, tex_download_convert_defines(conversion.depth));
+    shader.use();
+    shader.bind_texture(*this, "tex");
+    shader.bind_buffer(out, GL_SHADER_STORAGE_BUFFER, "out_buf");
+    shader.uniform_int(conversion.lvl, "lvl");
+    shader.uniform_int(w, "out_width");
+    shader.uniform_int(h, "out_height");
+    shader.uniform_int(row_stride/4, "words_per_row");
+    shader.uniform_int(conversion.nr_channels, "nr_channels");
+    shader.uniform_int(channels_packed, "channels_packed");
+    shader.uniform_int(conversion.flip_y? 1 : 0, "flip_y");
+    shader.uniform_float(conversion.scale, "scale");
+    shader.dispatch(row_stride/4, h, 64, 1);
+}
+
+void Texture2D::download_into_async(BufDownload& download, const TexDownloadConversion& conversion){
+    if(!m_download_converted){
+        m_download_converted.reset(new Buf(named("download_converted")));
+    }
+    convert_for_download(*m_download_converted, conversion);
+    int w, h;
+    download_conversion_size(w, h, *this, conversion);
+    m_download_converted->download_async(download, 0, (GLsizeiptr)download_row_stride_bytes(conversion)*h);
+}
+
+void Texture2D::download_into(void* dst, const size_t row_stride_bytes, const TexDownloadConversion& conversion){
+    CHECK(dst) << named("The destination pointer is null");
+    int w, h;
+    download_conversion_size(w, h, *this, conversion);
+    size_t row_bytes=(size_t)w*conversion.nr_channels*pixel_depth_size_bytes(conversion.depth);
+    CHECK(row_stride_bytes>=row_bytes) << named("The row stride of ") << row_stride_bytes << " bytes is smaller than a row of the result which has " << row_bytes << " bytes";
+
+    download_into_async(m_download_into_readback, conversion);
+    const unsigned char* src=(const unsigned char*)m_download_into_readback.data();
+    size_t src_stride=download_row_stride_bytes(conversion);
+    if(src_stride==row_stride_bytes){
+        memcpy(dst, src, row_stride_bytes*(h-1)+row_bytes);
+    }else{
+        for(int y=0; y<h; y++){
+            memcpy((unsigned char*)dst+y*row_stride_bytes, src+y*src_stride, row_bytes);
+        }
+    }
+}
+
+TextureView Texture2D::make_view(const GLint internal_format, const int base_mip, const int nr_mips) const{
+    CHECK(m_tex_storage_initialized) << named("Texture storage was not initialized. Cannot make a view of it");
+    //glTextureView only works on storage allocated with glTexStorage because mutable storage could change under the view
+    CHECK(m_tex_storage_inmutable) << named("Views can only be made of textures with inmutable storage. Use allocate_storage_inmutable()");
+    CHECK(base_mip>=0 && nr_mips>=1 && base_mip+nr_mips<=mipmap_nr_levels_allocated()) << named("The mips ") << base_mip << " to " << base_mip+nr_mips-1 << " of the view are out of the " << mipmap_nr_levels_allocated() << " mips allocated";
+
+    TextureView view;
+    view.set_name(named("view"));
+    view.create(m_tex_id, m_internal_format, internal_format, base_mip, nr_mips, width_for_lvl(base_mip), height_for_lvl(base_mip));
+    return view;
+}
+
 void Texture2D::copy_from_tex(Texture2D& other_tex, const int level){
     //following https://stackoverflow.com/a/23994979 seems that glCopyTexSubImage2D is one of the fastest ways to copy
     //more example on the usage of of glCopyTexSubImage2D https://stackoverflow.com/a/55294964
@@ -804,6 +1570,340 @@ void Texture2D::generate_mipmap_full(){
     generate_mipmap(idx_max_lvl);
 }
 
+//downsampler of generate_mipmap_compute(). Each work group writes a tile of 32x32 texels of the first level and keeps reducing it in shared memory down to a single texel 5 levels later.
+//With 12 levels per dispatch the last work group to finish continues alone from that level with another 6 levels, which it knows thanks to an atomic counter, so the whole chain of a 4k texture is a single dispatch
+static const char* tex_mip_comp_src = R"(
+    layout(local_size_x=16, local_size_y=16) in;
+
+    uniform sampler2D src;
+    uniform int src_lvl; //relative to the base level of src because that's how texelFetch counts them. The images are bound with the absolute level
+    uniform int src_width;
+    uniform int src_height;
+    uniform int dst_width; //of the first level written
+    uniform int dst_height;
+    uniform int nr_lvls; //levels written by this dispatch
+
+    layout(IMAGE_FORMAT) uniform coherent image2D mips[MAX_LVLS];
+    layout(std430) coherent buffer counter_buf{ uint counter; };
+
+    shared vec4 s_vals[16][16];
+    shared uint s_is_last;
+
+    #if defined(CUSTOM_REDUCE)
+        //mip_reduce() comes from the source prepended by the host
+        vec4 mip_finish(vec4 acc, float count){
+            return acc;
+        }
+    #else
+        //0 average, 1 min, 2 max. The average sums and divides at the end
+        const ivec4 ops=OPS;
+        vec4 mip_reduce(vec4 a, vec4 b){
+            vec4 r;
+            for(int c=0; c<4; c++){
+                r[c]= ops[c]==1? min(a[c],b[c]) : ops[c]==2? max(a[c],b[c]) : a[c]+b[c];
+            }
+            return r;
+        }
+        vec4 mip_finish(vec4 acc, float count){
+            for(int c=0; c<4; c++){
+                if(ops[c]==0){
+                    acc[c]/=count;
+                }
+            }
+            return acc;
+        }
+    #endif
+
+    ivec2 lvl_size(int lvl){
+        return max(ivec2(dst_width, dst_height)>>lvl, ivec2(1));
+    }
+
+    //all the texels of the previous level that are under texel p, which are 2x2 for even sizes and up to 3x3 for odd ones so nothing at the borders is skipped
+    vec4 load_footprint(ivec2 p, ivec2 from_size, ivec2 to_size, int from_img){
+        p=min(p, to_size-1);
+        ivec2 p0=p*from_size/to_size;
+        ivec2 p1=min(((p+1)*from_size+to_size-1)/to_size, from_size);
+        vec4 acc=vec4(0.0);
+        float count=0.0;
+        for(int y=p0.y; y<p1.y; y++){
+            for(int x=p0.x; x<p1.x; x++){
+                vec4 val= from_img<0? texelFetch(src, ivec2(x,y), src_lvl) : imageLoad(mips[from_img], ivec2(x,y));
+                acc= count==0.0? val : mip_reduce(acc, val);
+                count+=1.0;
+            }
+        }
+        return mip_finish(acc, count);
+    }
+
+    //combines the 2x2 children of p at a level of size prev_size. A level of size 1 has only one child along that axis so it's used twice, which doesn't change any of the reductions
+    //An odd prev_size would need a third child at the border, so for min, max and custom reductions the host starts a new dispatch there and load_footprint() handles it
+    vec4 reduce_children(vec4 c00, vec4 c10, vec4 c01, vec4 c11, ivec2 p, ivec2 prev_size){
+        ivec2 has_second=clamp(prev_size-1-2*p, ivec2(0), ivec2(1));
+        vec4 top= mip_reduce(c00, has_second.x==1? c10 : c00);
+        vec4 bottom= has_second.y==1? mip_reduce(c01, has_second.x==1? c11 : c01) : top;
+        return mip_finish(mip_reduce(top, bottom), 4.0);
+    }
+
+    //writes the 6 levels starting at first for the tile of work group wg
+    void downsample_tile(ivec2 wg, int first, int from_img, ivec2 from_size){
+        ivec2 t=ivec2(gl_LocalInvocationID.xy);
+
+        //first level, 2x2 texels per invocation
+        ivec2 size=lvl_size(first);
+        vec4 quad[4];
+        for(int i=0; i<4; i++){
+            ivec2 p=wg*32+t*2+ivec2(i&1, i>>1);
+            quad[i]=load_footprint(p, from_size, size, from_img);
+            if(all(lessThan(p, size))){
+                imageStore(mips[first], p, quad[i]);
+            }
+        }
+        if(first+1>=nr_lvls){
+            return;
+        }
+
+        //second level, one texel per invocation out of its own quad
+        ivec2 prev_size=size;
+        size=lvl_size(first+1);
+        ivec2 p=wg*16+t;
+        vec4 val=reduce_children(quad[0], quad[1], quad[2], quad[3], p, prev_size);
+        if(all(lessThan(p, size))){
+            imageStore(mips[first+1], p, val);
+        }
+        s_vals[t.y][t.x]=val;
+
+        //the rest in shared memory, with a quarter of the invocations each time
+        for(int k=2; k<6; k++){
+            int lvl=first+k;
+            if(lvl>=nr_lvls){
+                break;
+            }
+            barrier();
+            int tile=32>>k;
+            prev_size=size;
+            size=lvl_size(lvl);
+            bool active=all(lessThan(t, ivec2(tile)));
+            if(active){
+                ivec2 c=t*2;
+                p=wg*tile+t;
+                val=reduce_children(s_vals[c.y][c.x], s_vals[c.y][c.x+1], s_vals[c.y+1][c.x], s_vals[c.y+1][c.x+1], p, prev_size);
+                if(all(lessThan(p, size))){
+                    imageStore(mips[lvl], p, val);
+                }
+            }
+            barrier();
+            if(active){
+                s_vals[t.y][t.x]=val;
+            }
+        }
+    }
+
+    void main(){
+        downsample_tile(ivec2(gl_WorkGroupID.xy), 0, -1, ivec2(src_width, src_height));
+
+        #if MAX_LVLS>6
+            if(nr_lvls<=6){
+                return;
+            }
+            //make the level 5 of this group visible and count it as done. Only the last group continues
+            memoryBarrierImage();
+            barrier();
+            if(gl_LocalInvocationIndex==0u){
+                uint nr_groups=gl_NumWorkGroups.x*gl_NumWorkGroups.y;
+                s_is_last= atomicAdd(counter, 1u)==nr_groups-1u? 1u : 0u;
+            }
+            barrier();
+            if(s_is_last==0u){
+                return;
+            }
+            memoryBarrierImage();
+            downsample_tile(ivec2(0), 6, 5, lvl_size(5));
+            if(gl_LocalInvocationIndex==0u){
+                counter=0u; //ready for the next dispatch
+            }
+        #endif
+    }
+)";
+
+//format qualifier of the images the downsampler writes
+static std::string image_format_qualifier(const GLint internal_format){
+    switch(internal_format){
+        case GL_RGBA32F: return "rgba32f";
+        case GL_RGBA16F: return "rgba16f";
+        case GL_RG32F: return "rg32f";
+        case GL_RG16F: return "rg16f";
+        case GL_R11F_G11F_B10F: return "r11f_g11f_b10f";
+        case GL_R32F: return "r32f";
+        case GL_R16F: return "r16f";
+        case GL_RGBA16: return "rgba16";
+        case GL_RGB10_A2: return "rgb10_a2";
+        case GL_RGBA8: return "rgba8";
+        case GL_RG16: return "rg16";
+        case GL_RG8: return "rg8";
+        case GL_R16: return "r16";
+        case GL_R8: return "r8";
+    }
+    LOG(FATAL) << "Internal format " << std::hex << internal_format << std::dec << " cannot be written by the compute mipmap generator. Use a float or normalized format with 1, 2 or 4 channels";
+    return "";
+}
+
+//levels that one dispatch can write, which are 12 if the shader can bind that many images and 6 otherwise. Queried every time since the limits belong to the current context
+static int tex_mip_max_lvls_per_dispatch(){
+    GLint max_image_units=0;
+    GLint max_compute_images=0;
+    glGetIntegerv(GL_MAX_IMAGE_UNITS, &max_image_units);
+    glGetIntegerv(GL_MAX_COMPUTE_IMAGE_UNIFORMS, &max_compute_images);
+    return std::min(max_image_units, max_compute_images)>=12? 12 : 6;
+}
+
+//texelFetch counts the levels from GL_TEXTURE_BASE_LEVEL, which the progressive upload moves, so the kernels need it to fetch the level they mean
+static int texture_base_level(const Texture2D& tex){
+    tex.bind();
+    GLint base_lvl=0;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, &base_lvl);
+    return base_lvl;
+}
+
+static std::string tex_mip_defines(const GLint internal_format, const TexMipReduction& reduction){
+    std::string defines="#define IMAGE_FORMAT " + image_format_qualifier(internal_format) + "\n";
+    defines+="#define MAX_LVLS " + std::to_string(tex_mip_max_lvls_per_dispatch()) + "\n";
+    if(!reduction.custom_glsl.empty()){
+        defines+="#define CUSTOM_REDUCE\n" + reduction.custom_glsl + "\n";
+    }else{
+        defines+="#define OPS ivec4(";
+        for(int c=0; c<4; c++){
+            defines+=std::to_string((int)reduction.ops[c]) + (c<3? "," : ")\n");
+        }
+    }
+    return defines;
+}
+
+//mutable textures get the levels they are missing, inmutable ones cannot
+void Texture2D::allocate_mip_levels(const int idx_max_lvl){
+    if(idx_max_lvl<=m_idx_mipmap_allocated){
+        return;
+    }
+    CHECK(!m_tex_storage_inmutable) << named("The texture has inmutable storage with ") << mipmap_nr_levels_allocated() << " levels so it cannot get levels up to " << idx_max_lvl;
+    glBindTexture(GL_TEXTURE_2D, m_tex_id);
+    for(int lvl=m_idx_mipmap_allocated+1; lvl<=idx_max_lvl; lvl++){
+        glTexImage2D(GL_TEXTURE_2D, lvl, m_internal_format, width_for_lvl(lvl), height_for_lvl(lvl), 0, m_format, m_type, 0);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, idx_max_lvl);
+    m_idx_mipmap_allocated=idx_max_lvl;
+}
+
+//writes the levels from dst_lvl up to idx_max_lvl. The first of them is reduced from src_lvl of src and the others from the previous level of this texture
+void Texture2D::downsample_levels(const Texture2D& src, const int src_lvl, const int dst_lvl, const int idx_max_lvl, const TexMipReduction& reduction){
+    if(!m_mip_counter){
+        m_mip_counter.reset(new Buf(named("mip_counter")));
+        m_mip_counter->set_target(GL_SHADER_STORAGE_BUFFER);
+        unsigned int zero=0;
+        m_mip_counter->upload_data(sizeof(zero), &zero, GL_DYNAMIC_COPY);
+    }
+    Shader& shader=kernel("tex_mip", tex_mip_comp_src, tex_mip_defines(m_internal_format, reduction));
+    bool is_average=reduction.custom_glsl.empty();
+    for(int c=0; c<4; c++){
+        is_average&= reduction.ops[c]==TexMipOp::Average;
+    }
+
+    const Texture2D* cur_src=&src;
+    int cur_src_lvl=src_lvl;
+    int lvl=dst_lvl;
+    while(lvl<=idx_max_lvl){
+        //the last work group can only do the second half of the levels alone if they fit in its tile
+        int nr_lvls=std::min(idx_max_lvl-lvl+1, tex_mip_max_lvls_per_dispatch());
+        if(nr_lvls>6 && (width_for_lvl(lvl+6)>32 || height_for_lvl(lvl+6)>32)){
+            nr_lvls=6;
+        }
+        //inside a dispatch every texel only combines its 2x2 children, which skips the last row or column of an odd level. The average can live with that like glGenerateMipmap does,
+        //but min, max and custom reductions have to be conservative so the level after an odd one starts a new dispatch where it's reduced with the full 3x3 footprint
+        if(!is_average){
+            for(int i=1; i<nr_lvls; i++){
+                int prev_w=width_for_lvl(lvl+i-1);
+                int prev_h=height_for_lvl(lvl+i-1);
+                if( (prev_w>1 && prev_w%2==1) || (prev_h>1 && prev_h%2==1) ){
+                    nr_lvls=i;
+                    break;
+                }
+            }
+        }
+
+        int src_base_lvl=texture_base_level(*cur_src);
+        CHECK(cur_src_lvl>=src_base_lvl) << named("Cannot reduce level ") << cur_src_lvl << " of " << cur_src->name() << " because its base level is " << src_base_lvl << " so the level cannot be fetched";
+
+        shader.use();
+        shader.bind_texture(*cur_src, "src");
+        for(int i=0; i<nr_lvls; i++){
+            shader.bind_image(*this, GL_READ_WRITE, "mips[" + std::to_string(i) + "]", lvl+i);
+        }
+        shader.bind_buffer(*m_mip_counter, GL_SHADER_STORAGE_BUFFER, "counter_buf");
+        shader.uniform_int(cur_src_lvl-src_base_lvl, "src_lvl");
+        shader.uniform_int(cur_src->width_for_lvl(cur_src_lvl), "src_width");
+        shader.uniform_int(cur_src->height_for_lvl(cur_src_lvl), "src_height");
+        shader.uniform_int(width_for_lvl(lvl), "dst_width");
+        shader.uniform_int(height_for_lvl(lvl), "dst_height");
+        shader.uniform_int(nr_lvls, "nr_lvls");
+        int nr_groups_x=(width_for_lvl(lvl)+31)/32;
+        int nr_groups_y=(height_for_lvl(lvl)+31)/32;
+        shader.dispatch(nr_groups_x*16, nr_groups_y*16, 16, 16);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        lvl+=nr_lvls;
+        cur_src=this;
+        cur_src_lvl=lvl-1;
+    }
+}
+
+//same as generate_mipmap() but with a compute shader that writes up to 12 levels in a single dispatch, and with a reduction per channel instead of only the average
+void Texture2D::generate_mipmap_compute(const int idx_max_lvl, const TexMipReduction& reduction){
+    CHECK(m_tex_storage_initialized) << named("Texture storage was not initialized. Cannot generate mipmaps");
+    CHECK(idx_max_lvl>=0 && idx_max_lvl<mipmap_nr_lvls()) << named("Mip level ") << idx_max_lvl << " does not exist for a texture of " << m_width << "x" << m_height;
+    bool is_integer_format= m_format==GL_RED_INTEGER || m_format==GL_RG_INTEGER || m_format==GL_RGB_INTEGER || m_format==GL_RGBA_INTEGER;
+    CHECK(!is_integer_format) << named("Compute mipmaps are only supported for float and normalized textures. Integer textures would need a usampler");
+    CHECK(is_internal_format_valid_for_image_bind(m_internal_format)) << named("The internal format cannot be bound as an image. Check the list of valid formats at https://www.khronos.org/opengl/wiki/Image_Load_Store");
+    if(idx_max_lvl==0){
+        return;
+    }
+
+    allocate_mip_levels(idx_max_lvl);
+    downsample_levels(*this, 0, 1, idx_max_lvl, reduction);
+}
+
+void Texture2D::generate_mipmap_compute_full(const TexMipReduction& reduction){
+    generate_mipmap_compute(mipmap_highest_idx(), reduction);
+}
+
+//builds a hierarchical depth pyramid for occlusion culling out of a depth texture, for example the one of a GBuffer
+void Texture2D::generate_hiz_from_depth(const Texture2D& depth, const TexMipOp op){
+    CHECK(depth.storage_initialized()) << named("The depth texture has no storage initialized");
+    CHECK(&depth!=this) << named("The hierarchical depth has to be another texture than the depth");
+
+    //power of two so every level is exactly half of the previous one
+    int w=1;
+    while(w*2<=depth.width()){
+        w*=2;
+    }
+    int h=1;
+    while(h*2<=depth.height()){
+        h*=2;
+    }
+    int idx_max_lvl=mipmap_nr_lvls_for_size(w, h)-1;
+
+    if(!m_tex_storage_initialized || m_width!=w || m_height!=h || m_internal_format!=GL_R32F){
+        allocate_storage(GL_R32F, GL_RED, GL_FLOAT, w, h);
+        //the max or min of 4 texels is not the interpolation of them
+        set_filter_mode_min(GL_NEAREST_MIPMAP_NEAREST);
+        set_filter_mode_mag(GL_NEAREST);
+    }
+    allocate_mip_levels(idx_max_lvl);
+
+    TexMipReduction reduction;
+    for(int c=0; c<4; c++){
+        reduction.ops[c]=op;
+    }
+    downsample_levels(depth, 0, 0, idx_max_lvl, reduction);
+}
+
 
 void Texture2D::bind() const{
     glBindTexture(GL_TEXTURE_2D, m_tex_id);
@@ -817,10 +1917,23 @@ int Texture2D::tex_id() const{
     return m_tex_id;
 }
 
+std::shared_ptr<TextureStorageGuard> Texture2D::storage_guard() const{
+    return m_storage_guard;
+}
+
+void Texture2D::storage_changed(){
+    std::lock_guard<std::mutex> lock(m_storage_guard->mutex);
+    m_storage_guard->generation++;
+}
+
 bool Texture2D::storage_initialized () const{
     return m_tex_storage_initialized;
 }
 
+bool Texture2D::storage_inmutable() const{
+    return m_tex_storage_inmutable;
+}
+
 GLint Texture2D::internal_format() const{
     CHECK(m_internal_format!=EGL_INVALID) << named("The texture has not been initialzied and doesn't yet have a internal format");
     return m_internal_format;
@@ -895,6 +2008,7 @@ int Texture2D::mipmap_highest_idx() const { return floor(log2(  std::max(m_width
 //return maximum number of mip map lvls, effectivelly it is mipmap_highest_idx+1
 int Texture2D::mipmap_nr_lvls() const{ return mipmap_highest_idx()+1; }
 int Texture2D::mipmap_nr_levels_allocated() const{ return m_idx_mipmap_allocated+1;}
+int Texture2D::mipmap_nr_lvls_for_size(const int width, const int height){ return floor(log2( std::max(width, height) ))+1; }
 
 
 
@@ -0,0 +1,422 @@
+#include "easy_gl/TextureContainer.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring> //memcpy, memcmp
+
+//mmap
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "easy_gl/UtilsGL.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+//both containers are little endian, like the machines we run on
+static uint32_t read_u32(const unsigned char* ptr){
+    uint32_t val;
+    memcpy(&val, ptr, sizeof(val));
+    return val;
+}
+static uint64_t read_u64(const unsigned char* ptr){
+    uint64_t val;
+    memcpy(&val, ptr, sizeof(val));
+    return val;
+}
+
+static void set_formats(GLenum& internal_format, GLenum& format, GLenum& type, const GLenum internal_format_val, const GLenum format_val, const GLenum type_val){
+    internal_format=internal_format_val;
+    format=format_val;
+    type=type_val;
+}
+
+//https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html uses the VkFormat enum. Only the ones that we can upload to a Texture2D are here
+static bool vk_format2gl_formats(GLenum& internal_format, GLenum& format, GLenum& type, const uint32_t vk_format){
+    format=EGL_INVALID;
+    type=EGL_INVALID;
+    switch(vk_format){
+        case 9: set_formats(internal_format, format, type, GL_R8, GL_RED, GL_UNSIGNED_BYTE); return true; //R8_UNORM
+        case 16: set_formats(internal_format, format, type, GL_RG8, GL_RG, GL_UNSIGNED_BYTE); return true; //R8G8_UNORM
+        case 23: set_formats(internal_format, format, type, GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE); return true; //R8G8B8_UNORM
+        case 29: set_formats(internal_format, format, type, GL_SRGB8, GL_RGB, GL_UNSIGNED_BYTE); return true; //R8G8B8_SRGB
+        case 30: set_formats(internal_format, format, type, GL_RGB8, GL_BGR, GL_UNSIGNED_BYTE); return true; //B8G8R8_UNORM
+        case 37: set_formats(internal_format, format, type, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE); return true; //R8G8B8A8_UNORM
+        case 43: set_formats(internal_format, format, type, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE); return true; //R8G8B8A8_SRGB
+        case 44: set_formats(internal_format, format, type, GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE); return true; //B8G8R8A8_UNORM
+        case 50: set_formats(internal_format, format, type, GL_SRGB8_ALPHA8, GL_BGRA, GL_UNSIGNED_BYTE); return true; //B8G8R8A8_SRGB
+        case 76: set_formats(internal_format, format, type, GL_R16F, GL_RED, GL_HALF_FLOAT); return true; //R16_SFLOAT
+        case 83: set_formats(internal_format, format, type, GL_RG16F, GL_RG, GL_HALF_FLOAT); return true; //R16G16_SFLOAT
+        case 97: set_formats(internal_format, format, type, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT); return true; //R16G16B16A16_SFLOAT
+        case 100: set_formats(internal_format, format, type, GL_R32F, GL_RED, GL_FLOAT); return true; //R32_SFLOAT
+        case 103: set_formats(internal_format, format, type, GL_RG32F, GL_RG, GL_FLOAT); return true; //R32G32_SFLOAT
+        case 106: set_formats(internal_format, format, type, GL_RGB32F, GL_RGB, GL_FLOAT); return true; //R32G32B32_SFLOAT
+        case 109: set_formats(internal_format, format, type, GL_RGBA32F, GL_RGBA, GL_FLOAT); return true; //R32G32B32A32_SFLOAT
+        case 131: internal_format=GL_COMPRESSED_RGB_S3TC_DXT1_EXT; return true; //BC1_RGB_UNORM_BLOCK
+        case 132: internal_format=GL_COMPRESSED_SRGB_S3TC_DXT1_EXT; return true; //BC1_RGB_SRGB_BLOCK
+        case 133: internal_format=GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; return true; //BC1_RGBA_UNORM_BLOCK
+        case 134: internal_format=GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; return true; //BC1_RGBA_SRGB_BLOCK
+        case 135: internal_format=GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; return true; //BC2_UNORM_BLOCK
+        case 136: internal_format=GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT; return true; //BC2_SRGB_BLOCK
+        case 137: internal_format=GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; return true; //BC3_UNORM_BLOCK
+        case 138: internal_format=GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; return true; //BC3_SRGB_BLOCK
+        case 139: internal_format=GL_COMPRESSED_RED_RGTC1; return true; //BC4_UNORM_BLOCK
+        case 140: internal_format=GL_COMPRESSED_SIGNED_RED_RGTC1; return true; //BC4_SNORM_BLOCK
+        case 141: internal_format=GL_COMPRESSED_RG_RGTC2; return true; //BC5_UNORM_BLOCK
+        case 142: internal_format=GL_COMPRESSED_SIGNED_RG_RGTC2; return true; //BC5_SNORM_BLOCK
+        case 143: internal_format=GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT; return true; //BC6H_UFLOAT_BLOCK
+        case 144: internal_format=GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT; return true; //BC6H_SFLOAT_BLOCK
+        case 145: internal_format=GL_COMPRESSED_RGBA_BPTC_UNORM; return true; //BC7_UNORM_BLOCK
+        case 146: internal_format=GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; return true; //BC7_SRGB_BLOCK
+    }
+    return false;
+}
+
+//the DXGI_FORMAT enum of the DX10 extension of DDS
+static bool dxgi_format2gl_formats(GLenum& internal_format, GLenum& format, GLenum& type, const uint32_t dxgi_format){
+    format=EGL_INVALID;
+    type=EGL_INVALID;
+    switch(dxgi_format){
+        case 2: set_formats(internal_format, format, type, GL_RGBA32F, GL_RGBA, GL_FLOAT); return true; //R32G32B32A32_FLOAT
+        case 6: set_formats(internal_format, format, type, GL_RGB32F, GL_RGB, GL_FLOAT); return true; //R32G32B32_FLOAT
+        case 10: set_formats(internal_format, format, type, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT); return true; //R16G16B16A16_FLOAT
+        case 16: set_formats(internal_format, format, type, GL_RG32F, GL_RG, GL_FLOAT); return true; //R32G32_FLOAT
+        case 28: set_formats(internal_format, format, type, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE); return true; //R8G8B8A8_UNORM
+        case 29: set_formats(internal_format, format, type, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE); return true; //R8G8B8A8_UNORM_SRGB
+        case 34: set_formats(internal_format, format, type, GL_RG16F, GL_RG, GL_HALF_FLOAT); return true; //R16G16_FLOAT
+        case 41: set_formats(internal_format, format, type, GL_R32F, GL_RED, GL_FLOAT); return true; //R32_FLOAT
+        case 49: set_formats(internal_format, format, type, GL_RG8, GL_RG, GL_UNSIGNED_BYTE); return true; //R8G8_UNORM
+        case 54: set_formats(internal_format, format, type, GL_R16F, GL_RED, GL_HALF_FLOAT); return true; //R16_FLOAT
+        case 61: set_formats(internal_format, format, type, GL_R8, GL_RED, GL_UNSIGNED_BYTE); return true; //R8_UNORM
+        case 87: set_formats(internal_format, format, type, GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE); return true; //B8G8R8A8_UNORM
+        case 91: set_formats(internal_format, format, type, GL_SRGB8_ALPHA8, GL_BGRA, GL_UNSIGNED_BYTE); return true; //B8G8R8A8_UNORM_SRGB
+        case 71: internal_format=GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; return true; //BC1_UNORM
+        case 72: internal_format=GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; return true; //BC1_UNORM_SRGB
+        case 74: internal_format=GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; return true; //BC2_UNORM
+        case 75: internal_format=GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT; return true; //BC2_UNORM_SRGB
+        case 77: internal_format=GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; return true; //BC3_UNORM
+        case 78: internal_format=GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; return true; //BC3_UNORM_SRGB
+        case 80: internal_format=GL_COMPRESSED_RED_RGTC1; return true; //BC4_UNORM
+        case 81: internal_format=GL_COMPRESSED_SIGNED_RED_RGTC1; return true; //BC4_SNORM
+        case 83: internal_format=GL_COMPRESSED_RG_RGTC2; return true; //BC5_UNORM
+        case 84: internal_format=GL_COMPRESSED_SIGNED_RG_RGTC2; return true; //BC5_SNORM
+        case 95: internal_format=GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT; return true; //BC6H_UF16
+        case 96: internal_format=GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT; return true; //BC6H_SF16
+        case 98: internal_format=GL_COMPRESSED_RGBA_BPTC_UNORM; return true; //BC7_UNORM
+        case 99: internal_format=GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; return true; //BC7_UNORM_SRGB
+    }
+    return false;
+}
+
+static uint32_t fourcc(const char* code){
+    return (uint32_t)code[0] | ((uint32_t)code[1]<<8) | ((uint32_t)code[2]<<16) | ((uint32_t)code[3]<<24);
+}
+
+
+TextureContainer::TextureContainer():
+    m_mapped_ptr(nullptr),
+    m_mapped_size_bytes(0),
+    m_type(TextureContainerType::KTX2),
+    m_internal_format(EGL_INVALID),
+    m_format(EGL_INVALID),
+    m_gl_type(EGL_INVALID)
+    {
+}
+
+TextureContainer::TextureContainer(std::string name):
+    TextureContainer(){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+}
+
+TextureContainer::~TextureContainer(){
+    close();
+}
+
+void TextureContainer::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string TextureContainer::name() const{
+    return m_name;
+}
+
+void TextureContainer::open(const std::string& path){
+    close();
+    m_path=path;
+
+    int fd=::open(path.c_str(), O_RDONLY);
+    CHECK(fd>=0) << named("Could not open texture file ") << path;
+    struct stat file_stat;
+    CHECK(fstat(fd, &file_stat)==0) << named("Could not stat texture file ") << path;
+    size_t file_size=file_stat.st_size;
+    CHECK(file_size>=12) << named("File ") << path << " is too small to be a texture";
+
+    void* ptr=mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); //the mapping keeps its own reference to the file
+    CHECK(ptr!=MAP_FAILED) << named("Could not mmap texture file ") << path;
+    //every level is read once from start to end when uploading
+    madvise(ptr, file_size, MADV_SEQUENTIAL);
+    m_mapped_ptr=(unsigned char*)ptr;
+    m_mapped_size_bytes=file_size;
+
+    static const unsigned char ktx2_magic[12]={0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+    if(memcmp(m_mapped_ptr, ktx2_magic, sizeof(ktx2_magic))==0){
+        m_type=TextureContainerType::KTX2;
+        parse_ktx2();
+    }else if(memcmp(m_mapped_ptr, "DDS ", 4)==0){
+        m_type=TextureContainerType::DDS;
+        parse_dds();
+    }else{
+        LOG(FATAL) << named("File ") << path << " is neither KTX2 nor DDS";
+    }
+    check_levels();
+}
+
+void TextureContainer::close(){
+    if(m_mapped_ptr){
+        munmap(m_mapped_ptr, m_mapped_size_bytes);
+        m_mapped_ptr=nullptr;
+        m_mapped_size_bytes=0;
+    }
+    m_levels.clear();
+    m_internal_format=EGL_INVALID;
+    m_format=EGL_INVALID;
+    m_gl_type=EGL_INVALID;
+}
+
+bool TextureContainer::is_open() const{
+    return m_mapped_ptr!=nullptr;
+}
+
+//the header is followed by an index of where each level is. Level 0 is the biggest one
+void TextureContainer::parse_ktx2(){
+    const size_t header_size=80; //identifier, header and the index of the dfd, kvd and sgd
+    CHECK(m_mapped_size_bytes>=header_size) << named("KTX2 file ") << m_path << " is truncated";
+    const unsigned char* header=m_mapped_ptr+12;
+    uint32_t vk_format=read_u32(header+0);
+    uint32_t pixel_width=read_u32(header+8);
+    uint32_t pixel_height=read_u32(header+12);
+    uint32_t pixel_depth=read_u32(header+16);
+    uint32_t layer_count=read_u32(header+20);
+    uint32_t face_count=read_u32(header+24);
+    uint32_t level_count=read_u32(header+28);
+    uint32_t supercompression=read_u32(header+32);
+
+    CHECK(pixel_height>0 && pixel_depth==0) << named("KTX2 file ") << m_path << " is not a 2D texture";
+    CHECK(layer_count==0 && face_count==1) << named("KTX2 file ") << m_path << " is an array or a cube map which are not supported";
+    CHECK(supercompression==0) << named("KTX2 file ") << m_path << " uses supercompression scheme " << supercompression << " which is not supported";
+    CHECK(vk_format2gl_formats(m_internal_format, m_format, m_gl_type, vk_format)) << named("KTX2 file ") << m_path << " has VkFormat " << vk_format << " which is not supported";
+
+    //a level count of 0 asks the loader to generate the mips, we just upload the base level
+    int nr_levels=std::max(1u, level_count);
+    CHECK(m_mapped_size_bytes>=header_size+nr_levels*24) << named("KTX2 file ") << m_path << " is truncated";
+    const unsigned char* level_index=m_mapped_ptr+header_size;
+    for(int lvl=0; lvl<nr_levels; lvl++){
+        TextureContainerLevel level;
+        level.width=std::max(1u, pixel_width>>lvl);
+        level.height=std::max(1u, pixel_height>>lvl);
+        level.offset=read_u64(level_index+lvl*24);
+        level.size_bytes=read_u64(level_index+lvl*24+8);
+        m_levels.push_back(level);
+    }
+}
+
+//DDS_HEADER and optionally DDS_HEADER_DXT10, followed by all the levels one after another starting from the biggest
+void TextureContainer::parse_dds(){
+    const size_t header_size=4+124;
+    CHECK(m_mapped_size_bytes>=header_size) << named("DDS file ") << m_path << " is truncated";
+    const unsigned char* header=m_mapped_ptr+4;
+    uint32_t flags=read_u32(header+4);
+    uint32_t height=read_u32(header+8);
+    uint32_t width=read_u32(header+12);
+    uint32_t pitch=read_u32(header+16);
+    uint32_t mipmap_count=read_u32(header+24);
+    const unsigned char* pixel_format=header+72;
+    uint32_t pf_flags=read_u32(pixel_format+4);
+    uint32_t pf_fourcc=read_u32(pixel_format+8);
+    uint32_t pf_bit_count=read_u32(pixel_format+12);
+    uint32_t pf_r_mask=read_u32(pixel_format+16);
+    uint32_t pf_a_mask=read_u32(pixel_format+28);
+    uint32_t caps2=read_u32(header+108);
+
+    const uint32_t ddsd_pitch=0x8;
+    const uint32_t ddsd_mipmapcount=0x20000;
+    const uint32_t ddsd_depth=0x800000;
+    const uint32_t ddpf_alphapixels=0x1;
+    const uint32_t ddpf_fourcc=0x4;
+    const uint32_t ddpf_rgb=0x40;
+    const uint32_t ddpf_luminance=0x20000;
+    const uint32_t ddscaps2_cubemap=0x200;
+    CHECK(!(flags&ddsd_depth) && !(caps2&ddscaps2_cubemap)) << named("DDS file ") << m_path << " is a volume or a cube map which are not supported";
+
+    size_t data_offset=header_size;
+    bool valid_format=false;
+    if( (pf_flags&ddpf_fourcc) && pf_fourcc==fourcc("DX10") ){
+        data_offset+=20;
+        CHECK(m_mapped_size_bytes>=data_offset) << named("DDS file ") << m_path << " is truncated";
+        const unsigned char* header_dx10=header+124;
+        uint32_t dxgi_format=read_u32(header_dx10+0);
+        uint32_t resource_dimension=read_u32(header_dx10+4);
+        uint32_t misc_flag=read_u32(header_dx10+8);
+        uint32_t array_size=read_u32(header_dx10+12);
+        CHECK(resource_dimension==3 && array_size==1 && !(misc_flag&0x4)) << named("DDS file ") << m_path << " is not a single 2D texture";
+        valid_format=dxgi_format2gl_formats(m_internal_format, m_format, m_gl_type, dxgi_format);
+        CHECK(valid_format) << named("DDS file ") << m_path << " has DXGI format " << dxgi_format << " which is not supported";
+    }else if(pf_flags&ddpf_fourcc){
+        m_format=EGL_INVALID;
+        m_gl_type=EGL_INVALID;
+        valid_format=true;
+        if(pf_fourcc==fourcc("DXT1")){
+            m_internal_format=GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+        }else if(pf_fourcc==fourcc("DXT3")){
+            m_internal_format=GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+        }else if(pf_fourcc==fourcc("DXT5")){
+            m_internal_format=GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        }else if(pf_fourcc==fourcc("ATI1") || pf_fourcc==fourcc("BC4U")){
+            m_internal_format=GL_COMPRESSED_RED_RGTC1;
+        }else if(pf_fourcc==fourcc("ATI2") || pf_fourcc==fourcc("BC5U")){
+            m_internal_format=GL_COMPRESSED_RG_RGTC2;
+        }else{
+            valid_format=false;
+        }
+    }else if( (pf_flags&ddpf_rgb) && pf_bit_count==32 ){
+        bool bgra= pf_r_mask==0x00ff0000;
+        GLenum internal_format= (pf_flags&ddpf_alphapixels) && pf_a_mask ? GL_RGBA8 : GL_RGB8; //the alpha of the X8 formats is ignored by the sampler
+        set_formats(m_internal_format, m_format, m_gl_type, internal_format, bgra? GL_BGRA : GL_RGBA, GL_UNSIGNED_BYTE);
+        valid_format=true;
+    }else if( (pf_flags&ddpf_rgb) && pf_bit_count==24 ){
+        bool bgr= pf_r_mask==0x00ff0000;
+        set_formats(m_internal_format, m_format, m_gl_type, GL_RGB8, bgr? GL_BGR : GL_RGB, GL_UNSIGNED_BYTE);
+        valid_format=true;
+    }else if( (pf_flags&ddpf_luminance) && pf_bit_count==8 ){
+        set_formats(m_internal_format, m_format, m_gl_type, GL_R8, GL_RED, GL_UNSIGNED_BYTE);
+        valid_format=true;
+    }
+    CHECK(valid_format) << named("DDS file ") << m_path << " has a pixel format which is not supported";
+
+    //the levels have tightly packed rows so a pitch with padding can't be uploaded as it is
+    if(!is_internal_format_compressed(m_internal_format) && (flags&ddsd_pitch)){
+        CHECK(pitch==width*gl_pixel_size_bytes(m_format, m_gl_type)) << named("DDS file ") << m_path << " has rows with padding which is not supported";
+    }
+
+    int nr_levels= (flags&ddsd_mipmapcount)? std::max(1u, mipmap_count) : 1;
+    size_t offset=data_offset;
+    for(int lvl=0; lvl<nr_levels; lvl++){
+        TextureContainerLevel level;
+        level.width=std::max(1u, width>>lvl);
+        level.height=std::max(1u, height>>lvl);
+        level.offset=offset;
+        if(is_internal_format_compressed(m_internal_format)){
+            level.size_bytes=gl_compressed_size_bytes(m_internal_format, level.width, level.height);
+        }else{
+            level.size_bytes=(size_t)level.width*level.height*gl_pixel_size_bytes(m_format, m_gl_type);
+        }
+        offset+=level.size_bytes;
+        m_levels.push_back(level);
+    }
+}
+
+void TextureContainer::check_levels(){
+    CHECK(!m_levels.empty()) << named("File ") << m_path << " has no levels";
+    int max_nr_levels=Texture2D::mipmap_nr_lvls_for_size(width(), height());
+    CHECK(nr_levels()<=max_nr_levels) << named("File ") << m_path << " has " << nr_levels() << " levels but a texture of " << width() << "x" << height() << " can have at most " << max_nr_levels;
+    for(int lvl=0; lvl<nr_levels(); lvl++){
+        const TextureContainerLevel& level=m_levels[lvl];
+        size_t expected_size_bytes;
+        if(is_compressed()){
+            expected_size_bytes=gl_compressed_size_bytes(m_internal_format, level.width, level.height);
+        }else{
+            expected_size_bytes=(size_t)level.width*level.height*gl_pixel_size_bytes(m_format, m_gl_type);
+        }
+        CHECK(level.size_bytes==expected_size_bytes) << named("Level ") << lvl << " of " << m_path << " has " << level.size_bytes << " bytes but a level of " << level.width << "x" << level.height << " should have " << expected_size_bytes;
+        CHECK(level.offset<=m_mapped_size_bytes && level.size_bytes<=m_mapped_size_bytes-level.offset) << named("Level ") << lvl << " of " << m_path << " goes past the end of the file";
+    }
+}
+
+void TextureContainer::upload(Texture2D& tex) const{
+    CHECK(is_open()) << named("No file is open");
+    CHECK(!tex.storage_initialized()) << named("The texture already has storage. The levels of the file need a new texture with inmutable storage");
+
+    if(is_compressed()){
+        for(int lvl=0; lvl<nr_levels(); lvl++){
+            tex.upload_compressed(m_internal_format, width(), height(), level_data(lvl), m_levels[lvl].size_bytes, lvl, nr_levels());
+        }
+    }else{
+        tex.allocate_storage_inmutable(m_internal_format, m_format, m_gl_type, width(), height(), nr_levels());
+        for(int lvl=0; lvl<nr_levels(); lvl++){
+            tex.upload_level(lvl, level_data(lvl), m_levels[lvl].size_bytes);
+        }
+    }
+    //the file brings the whole chain so it can be sampled with mipmapping right away
+    if(nr_levels()>1){
+        tex.set_filter_mode_min(GL_LINEAR_MIPMAP_LINEAR);
+    }
+}
+
+void TextureContainer::load(const std::string& path, Texture2D& tex){
+    TextureContainer container;
+    container.open(path);
+    container.upload(tex);
+}
+
+TextureContainerType TextureContainer::type() const{
+    return m_type;
+}
+
+int TextureContainer::width() const{
+    CHECK(!m_levels.empty()) << named("No file is open");
+    return m_levels[0].width;
+}
+
+int TextureContainer::height() const{
+    CHECK(!m_levels.empty()) << named("No file is open");
+    return m_levels[0].height;
+}
+
+int TextureContainer::nr_levels() const{
+    return m_levels.size();
+}
+
+const TextureContainerLevel& TextureContainer::level(const int lvl) const{
+    CHECK(lvl>=0 && lvl<nr_levels()) << named("Level ") << lvl << " is out of range. The file has " << nr_levels() << " levels";
+    return m_levels[lvl];
+}
+
+const unsigned char* TextureContainer::level_data(const int lvl) const{
+    return m_mapped_ptr+level(lvl).offset;
+}
+
+bool TextureContainer::is_compressed() const{
+    return is_internal_format_compressed(m_internal_format);
+}
+
+GLenum TextureContainer::internal_format() const{
+    return m_internal_format;
+}
+
+GLenum TextureContainer::format() const{
+    return m_format;
+}
+
+GLenum TextureContainer::gl_type() const{
+    return m_gl_type;
+}
+
+std::string TextureContainer::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+} //namespace gl
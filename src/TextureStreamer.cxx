@@ -0,0 +1,290 @@
+#include "easy_gl/TextureStreamer.h"
+
+#include <cstring> //memcpy
+#include <chrono>
+
+#include "easy_gl/Texture2D.h"
+#include "easy_gl/UtilsGL.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+namespace gl{
+
+TextureStreamUpload::TextureStreamUpload(){
+}
+
+//true once the worker issued the transfer and the GPU finished it
+bool TextureStreamUpload::ready(){
+    CHECK(m_state) << "The upload handle is not valid";
+    if(m_state->signaled){
+        return true;
+    }
+    GLsync fence=m_state->fence.load();
+    if(!fence){
+        return false; //the worker didn't get to it yet
+    }
+    //no need for GL_SYNC_FLUSH_COMMANDS_BIT, the worker flushes after creating the fence
+    GLenum status=glClientWaitSync(fence, 0, 0);
+    LOG_IF(ERROR, status==GL_WAIT_FAILED) << "Waiting for the texture upload fence failed";
+    if(status==GL_ALREADY_SIGNALED || status==GL_CONDITION_SATISFIED){
+        glDeleteSync(fence);
+        m_state->fence.store(nullptr);
+        m_state->signaled=true;
+    }
+    return m_state->signaled;
+}
+
+void TextureStreamUpload::wait(){
+    CHECK(m_state) << "The upload handle is not valid";
+    if(m_state->signaled){
+        return;
+    }
+    while(!m_state->fence.load()){
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    GLsync fence=m_state->fence.load();
+    GLenum status=glClientWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+    LOG_IF(ERROR, status==GL_WAIT_FAILED) << "Waiting for the texture upload fence failed";
+    glDeleteSync(fence);
+    m_state->fence.store(nullptr);
+    m_state->signaled=true;
+}
+
+bool TextureStreamUpload::valid() const{
+    return m_state!=nullptr;
+}
+
+bool TextureStreamUpload::cancelled() const{
+    CHECK(m_state) << "The upload handle is not valid";
+    return m_state->cancelled.load();
+}
+
+TextureStreamUpload::State::~State(){
+    //fences are shared between the contexts so it doesn't matter which thread drops the last reference, as long as it has one of them current
+    GLsync f=fence.load();
+    if(f){
+        glDeleteSync(f);
+    }
+}
+
+
+
+TextureStreamer::TextureStreamer(std::function<void()> make_context_current, std::function<void()> release_context, const int nr_pbos):
+    m_make_context_current(make_context_current),
+    m_release_context(release_context),
+    m_stop(false),
+    m_nr_pbos(nr_pbos),
+    m_cur_pbo_idx(0){
+    CHECK(m_make_context_current) << named("We need a function that makes the shared context current on the worker thread");
+    CHECK(nr_pbos>=1) << named("We need at least one pbo but we got ") << nr_pbos;
+    m_pbos.resize(nr_pbos);
+    m_pbos_ptrs.resize(nr_pbos, nullptr);
+    m_pbos_fences.resize(nr_pbos, nullptr);
+
+    m_worker=std::thread(&TextureStreamer::worker_loop, this);
+}
+
+TextureStreamer::TextureStreamer(std::string name, std::function<void()> make_context_current, std::function<void()> release_context, const int nr_pbos):
+    TextureStreamer(make_context_current, release_context, nr_pbos){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+}
+
+TextureStreamer::~TextureStreamer(){
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop=true;
+    }
+    m_cond.notify_one();
+    if(m_worker.joinable()){
+        m_worker.join();
+    }
+}
+
+void TextureStreamer::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string TextureStreamer::name() const{
+    return m_name;
+}
+
+//schedules the upload of the mat into the texture. Has to be called from the render thread
+TextureStreamUpload TextureStreamer::upload(Texture2D& tex, const cv::Mat& cv_mat, const bool flip_red_blue, const bool store_as_normalized_vals){
+    CHECK(!cv_mat.empty()) << named("The mat is empty");
+
+    GLint internal_format;
+    GLenum format;
+    GLenum type;
+    cv_type2gl_formats(internal_format, format, type, cv_mat.type(), flip_red_blue, store_as_normalized_vals);
+
+    //the storage gets allocated here and the worker waits on a fence before writing into it
+    GLsync storage_fence=nullptr;
+    bool storage_changes= !tex.storage_initialized() || tex.width()!=cv_mat.cols || tex.height()!=cv_mat.rows || tex.internal_format()!=internal_format;
+    if(storage_changes){
+        tex.allocate_storage(internal_format, format, type, cv_mat.cols, cv_mat.rows);
+        storage_fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush(); //otherwise the worker could wait forever on a fence that never gets to the GPU
+    }
+
+    Job job;
+    job.tex_id=tex.tex_id();
+    job.storage_guard=tex.storage_guard();
+    job.storage_generation=job.storage_guard->generation; //only the render thread changes it so no need to lock for reading it here
+    job.format=format;
+    job.type=type;
+    job.cv_mat=cv_mat;
+    job.storage_fence=storage_fence;
+    job.state=std::make_shared<TextureStreamUpload::State>();
+
+    TextureStreamUpload upload;
+    upload.m_state=job.state;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_cond.notify_one();
+
+    return upload;
+}
+
+int TextureStreamer::nr_pending(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_jobs.size();
+}
+
+std::string TextureStreamer::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name+": "+msg;
+}
+
+void TextureStreamer::worker_loop(){
+    m_make_context_current();
+    //the rows in the pbos are tightly packed. This is state of the worker context so we set it only once
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    while(true){
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]{ return m_stop || !m_jobs.empty(); });
+            if(m_jobs.empty()){
+                break; //stopping and nothing left to do
+            }
+            job=std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        process(job);
+    }
+
+    //the gl objects of the worker have to be deleted while its context is still current
+    glFinish();
+    for(size_t i=0; i<m_pbos_fences.size(); i++){
+        if(m_pbos_fences[i]){
+            glDeleteSync(m_pbos_fences[i]);
+            m_pbos_fences[i]=nullptr;
+        }
+    }
+    m_pbos.clear();
+    if(m_release_context){
+        m_release_context();
+    }
+}
+
+//true if the texture still has the storage that was allocated for this job. Has to be called with the mutex of the guard locked
+static bool is_storage_of_job_valid(const TextureStorageGuard& guard, const int storage_generation){
+    return guard.alive && guard.generation==storage_generation;
+}
+
+void TextureStreamer::process(Job& job){
+    //the storage fence has to be deleted even if the job gets cancelled
+    if(job.storage_fence){
+        glWaitSync(job.storage_fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(job.storage_fence);
+        job.storage_fence=nullptr;
+    }
+
+    //don't bother copying the pixels if the texture is already gone. It's checked again right before writing into it
+    bool is_valid;
+    {
+        std::lock_guard<std::mutex> lock(job.storage_guard->mutex);
+        is_valid=is_storage_of_job_valid(*job.storage_guard, job.storage_generation);
+    }
+    if(!is_valid){
+        cancel(job);
+        return;
+    }
+
+    int idx=m_cur_pbo_idx;
+    int width=job.cv_mat.cols;
+    int height=job.cv_mat.rows;
+    size_t row_bytes=job.cv_mat.cols*job.cv_mat.elemSize();
+    size_t size_bytes=row_bytes*job.cv_mat.rows;
+
+    //the GPU had the whole ring worth of uploads to read this pbo so usually this doesn't wait
+    if(m_pbos_fences[idx]){
+        glClientWaitSync(m_pbos_fences[idx], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(m_pbos_fences[idx]);
+        m_pbos_fences[idx]=nullptr;
+    }
+    std::unique_ptr<Buf>& pbo=m_pbos[idx];
+    if(!pbo || (size_t)pbo->size_bytes()<size_bytes){
+        GLbitfield flags=GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        pbo.reset(new Buf(named("streamer_pbo")));
+        pbo->allocate_inmutable(GL_PIXEL_UNPACK_BUFFER, size_bytes, NULL, flags);
+        m_pbos_ptrs[idx]=pbo->map_range(0, size_bytes, flags);
+    }
+
+    //this is the expensive part that we want away from the render thread
+    unsigned char* dst=(unsigned char*)m_pbos_ptrs[idx];
+    if(job.cv_mat.isContinuous()){
+        memcpy(dst, job.cv_mat.data, size_bytes);
+    }else{
+        for(int y=0; y<job.cv_mat.rows; y++){
+            memcpy(dst+y*row_bytes, job.cv_mat.ptr(y), row_bytes);
+        }
+    }
+    job.cv_mat.release(); //the caller can reuse the pixels as soon as the upload is ready but we don't need to hold them any longer
+
+    {
+        //while we hold the lock the render thread cannot destroy the texture or reallocate its storage
+        std::lock_guard<std::mutex> lock(job.storage_guard->mutex);
+        if(!is_storage_of_job_valid(*job.storage_guard, job.storage_generation)){
+            cancel(job);
+            return;
+        }
+
+        //binding the texture again in this context is what makes the new storage visible here
+        glBindTexture(GL_TEXTURE_2D, job.tex_id);
+        GLint tex_width=0;
+        GLint tex_height=0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &tex_width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &tex_height);
+        CHECK(tex_width==width && tex_height==height) << named("Level 0 of texture ") << job.tex_id << " is " << tex_width << "x" << tex_height << " but the upload is " << width << "x" << height;
+        pbo->bind();
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, job.format, job.type, 0);
+        pbo->unbind();
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+    }
+
+    m_pbos_fences[idx]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GLsync done_fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush(); //so the render thread doesn't poll a fence that never gets to the GPU
+    job.state->fence.store(done_fence);
+
+    m_cur_pbo_idx=(m_cur_pbo_idx+1)%m_nr_pbos;
+}
+
+//the handle still needs a fence so that ready() and wait() return
+void TextureStreamer::cancel(Job& job){
+    job.cv_mat.release();
+    job.state->cancelled.store(true);
+    GLsync done_fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    job.state->fence.store(done_fence);
+}
+
+} //namespace gl
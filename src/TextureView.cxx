@@ -0,0 +1,210 @@
+#include "easy_gl/TextureView.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+#include "easy_gl/UtilsGL.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+//compatibility classes of glTextureView from table 8.22 of the GL 4.5 spec. Uncompressed formats are compatible if they have the same bits per texel, compressed ones have their own classes. 0 for the formats which can only be viewed as themselves, like depth
+static int view_class(const GLenum internal_format){
+    switch(internal_format){
+        case GL_RGBA32F: case GL_RGBA32UI: case GL_RGBA32I:
+            return 128;
+        case GL_RGB32F: case GL_RGB32UI: case GL_RGB32I:
+            return 96;
+        case GL_RGBA16F: case GL_RG32F: case GL_RGBA16UI: case GL_RG32UI: case GL_RGBA16I: case GL_RG32I: case GL_RGBA16: case GL_RGBA16_SNORM:
+            return 64;
+        case GL_RGB16: case GL_RGB16_SNORM: case GL_RGB16F: case GL_RGB16UI: case GL_RGB16I:
+            return 48;
+        case GL_RG16F: case GL_R11F_G11F_B10F: case GL_R32F: case GL_RGB10_A2UI: case GL_RGBA8UI: case GL_RG16UI: case GL_R32UI: case GL_RGBA8I: case GL_RG16I: case GL_R32I:
+        case GL_RGB10_A2: case GL_RGBA8: case GL_RG16: case GL_RGBA8_SNORM: case GL_RG16_SNORM: case GL_SRGB8_ALPHA8: case GL_RGB9_E5:
+            return 32;
+        case GL_RGB8: case GL_RGB8_SNORM: case GL_SRGB8: case GL_RGB8UI: case GL_RGB8I:
+            return 24;
+        case GL_R16F: case GL_RG8UI: case GL_R16UI: case GL_RG8I: case GL_R16I: case GL_RG8: case GL_R16: case GL_RG8_SNORM: case GL_R16_SNORM:
+            return 16;
+        case GL_R8UI: case GL_R8I: case GL_R8: case GL_R8_SNORM:
+            return 8;
+        //the compressed classes get ids that can't be confused with bits per texel
+        case GL_COMPRESSED_RED_RGTC1: case GL_COMPRESSED_SIGNED_RED_RGTC1:
+            return 1001;
+        case GL_COMPRESSED_RG_RGTC2: case GL_COMPRESSED_SIGNED_RG_RGTC2:
+            return 1002;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM: case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            return 1003;
+        case GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT: case GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT:
+            return 1004;
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+            return 1005;
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+            return 1006;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+            return 1007;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            return 1008;
+    }
+    return 0;
+}
+
+static bool is_integer_format(const GLenum internal_format){
+    switch(internal_format){
+        case GL_R8UI: case GL_R8I: case GL_R16UI: case GL_R16I: case GL_R32UI: case GL_R32I:
+        case GL_RG8UI: case GL_RG8I: case GL_RG16UI: case GL_RG16I: case GL_RG32UI: case GL_RG32I:
+        case GL_RGB8UI: case GL_RGB8I: case GL_RGB16UI: case GL_RGB16I: case GL_RGB32UI: case GL_RGB32I:
+        case GL_RGBA8UI: case GL_RGBA8I: case GL_RGBA16UI: case GL_RGBA16I: case GL_RGBA32UI: case GL_RGBA32I: case GL_RGB10_A2UI:
+            return true;
+    }
+    return false;
+}
+
+
+TextureView::TextureView():
+    m_tex_id(EGL_INVALID),
+    m_internal_format(EGL_INVALID),
+    m_width(0),
+    m_height(0),
+    m_base_mip(0),
+    m_nr_mips(0)
+    {
+}
+
+TextureView::~TextureView(){
+    destroy();
+}
+
+TextureView::TextureView(TextureView && other):
+    m_name(std::move(other.m_name)),
+    m_tex_id(other.m_tex_id),
+    m_internal_format(other.m_internal_format),
+    m_width(other.m_width),
+    m_height(other.m_height),
+    m_base_mip(other.m_base_mip),
+    m_nr_mips(other.m_nr_mips){
+    other.m_tex_id=EGL_INVALID;
+}
+
+TextureView & TextureView::operator=(TextureView && other){
+    if(this!=&other){
+        destroy();
+        m_name=std::move(other.m_name);
+        m_tex_id=other.m_tex_id;
+        m_internal_format=other.m_internal_format;
+        m_width=other.m_width;
+        m_height=other.m_height;
+        m_base_mip=other.m_base_mip;
+        m_nr_mips=other.m_nr_mips;
+        other.m_tex_id=EGL_INVALID;
+    }
+    return *this;
+}
+
+
+void TextureView::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string TextureView::name() const{
+    return m_name;
+}
+
+void TextureView::set_wrap_mode(const GLenum wrap_mode){
+    CHECK(storage_initialized()) << named("The view was not created");
+    glBindTexture(GL_TEXTURE_2D, m_tex_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_mode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_mode);
+}
+
+void TextureView::set_filter_mode_min_mag(const GLenum filter_mode){
+    CHECK(storage_initialized()) << named("The view was not created");
+    glBindTexture(GL_TEXTURE_2D, m_tex_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter_mode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter_mode);
+}
+
+void TextureView::bind() const{
+    glBindTexture(GL_TEXTURE_2D, m_tex_id);
+}
+
+int TextureView::tex_id() const{
+    return m_tex_id;
+}
+
+bool TextureView::storage_initialized() const{
+    return m_tex_id!=EGL_INVALID;
+}
+
+GLint TextureView::internal_format() const{
+    return m_internal_format;
+}
+
+int TextureView::width() const{
+    return m_width;
+}
+
+int TextureView::height() const{
+    return m_height;
+}
+
+int TextureView::base_mip() const{
+    return m_base_mip;
+}
+
+int TextureView::nr_mips() const{
+    return m_nr_mips;
+}
+
+bool TextureView::formats_compatible(const GLenum internal_format, const GLenum view_internal_format){
+    if(internal_format==view_internal_format){
+        return true;
+    }
+    int orig_class=view_class(internal_format);
+    return orig_class!=0 && orig_class==view_class(view_internal_format);
+}
+
+void TextureView::create(const GLuint orig_tex_id, const GLenum orig_internal_format, const GLenum internal_format, const int base_mip, const int nr_mips, const int width, const int height){
+    CHECK(formats_compatible(orig_internal_format, internal_format)) << named("Internal format ") << std::hex << internal_format << " is not in the same compatibility class as the one of the texture " << orig_internal_format << std::dec << " so it cannot be a view of it";
+    destroy();
+
+    //the name has to be new and never bound, glCreateTextures would already give it a target
+    glGenTextures(1, &m_tex_id);
+    GL_C( glTextureView(m_tex_id, GL_TEXTURE_2D, orig_tex_id, internal_format, base_mip, nr_mips, 0, 1) );
+    m_internal_format=internal_format;
+    m_width=width;
+    m_height=height;
+    m_base_mip=base_mip;
+    m_nr_mips=nr_mips;
+
+    //integer formats can't be filtered so they start with nearest
+    bool is_integer=is_integer_format(internal_format);
+    glBindTexture(GL_TEXTURE_2D, m_tex_id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, is_integer? GL_NEAREST : (nr_mips>1? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, is_integer? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void TextureView::destroy(){
+    if(m_tex_id!=EGL_INVALID){
+        glDeleteTextures(1, &m_tex_id);
+        m_tex_id=EGL_INVALID;
+    }
+}
+
+
+std::string TextureView::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+} //namespace gl
@@ -0,0 +1,220 @@
+#include "easy_gl/TransientTexturePool.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <tuple>
+#include <memory>
+#include <algorithm>
+
+#include "easy_gl/Texture2D.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+TransientTexturePool::TransientTexturePool():
+    m_assigned(false),
+    m_frame(0),
+    m_max_unused_frames(2)
+    {
+}
+
+TransientTexturePool::TransientTexturePool(std::string name):
+    TransientTexturePool(){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+}
+
+TransientTexturePool::~TransientTexturePool(){
+}
+
+
+void TransientTexturePool::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string TransientTexturePool::name() const{
+    return m_name;
+}
+
+void TransientTexturePool::set_max_unused_frames(const int nr_frames){
+    CHECK(nr_frames>=0) << named("Max unused frames cannot be negative");
+    m_max_unused_frames=nr_frames;
+}
+
+void TransientTexturePool::begin_frame(){
+    m_frame++;
+    m_declarations.clear();
+    m_assigned=false;
+
+    //the textures of a size that is not used anymore, for example after the window was resized, go away after a few frames
+    int nr_evicted=0;
+    for(size_t i=0; i<m_textures.size(); ){
+        if(m_frame-m_textures[i].last_used_frame>m_max_unused_frames){
+            m_textures.erase(m_textures.begin()+i);
+            nr_evicted++;
+        }else{
+            i++;
+        }
+    }
+
+    m_stats=TransientTexturePoolStats();
+    m_stats.nr_evicted=nr_evicted;
+}
+
+int TransientTexturePool::declare(const TransientTextureDesc& desc, const int first_pass, const int last_pass){
+    CHECK(!m_assigned) << named("Textures were already assigned for this frame by calling get(). Declare all of them before getting any");
+    CHECK(desc.width>0 && desc.height>0) << named("Cannot declare a texture of size ") << desc.width << "x" << desc.height;
+    CHECK(desc.nr_mips>=1 && desc.nr_mips<=Texture2D::mipmap_nr_lvls_for_size(desc.width, desc.height)) << named("A texture of ") << desc.width << "x" << desc.height << " can have between 1 and " << Texture2D::mipmap_nr_lvls_for_size(desc.width, desc.height) << " mips but we got " << desc.nr_mips;
+    CHECK(first_pass>=0 && first_pass<=last_pass) << named("The lifetime should be a range of passes with first_pass<=last_pass but we got ") << first_pass << " to " << last_pass;
+
+    Declaration declaration;
+    declaration.key=std::make_tuple(desc.internal_format, desc.format, desc.type, desc.width, desc.height, desc.nr_mips);
+    declaration.first_pass=first_pass;
+    declaration.last_pass=last_pass;
+    declaration.texture_idx=-1;
+    m_declarations.push_back(declaration);
+    return m_declarations.size()-1;
+}
+
+int TransientTexturePool::declare(const GLint internal_format, const GLenum format, const GLenum type, const int width, const int height, const int first_pass, const int last_pass, const int nr_mips){
+    TransientTextureDesc desc;
+    desc.internal_format=internal_format;
+    desc.format=format;
+    desc.type=type;
+    desc.width=width;
+    desc.height=height;
+    desc.nr_mips=nr_mips;
+    return declare(desc, first_pass, last_pass);
+}
+
+Texture2D& TransientTexturePool::get(const int handle){
+    CHECK(handle>=0 && handle<(int)m_declarations.size()) << named("Handle ") << handle << " was not declared in this frame";
+    if(!m_assigned){
+        assign();
+    }
+    return *m_textures[m_declarations[handle].texture_idx].tex;
+}
+
+//Greedy interval partitioning: going through the declarations in the order they start, each one takes a texture with the same key that is free by then, and a new one is only created if all of them are busy.
+//This gives the minimum number of textures per key, which is the maximum number of declarations alive at the same time
+void TransientTexturePool::assign(){
+    for(size_t i=0; i<m_textures.size(); i++){
+        m_textures[i].busy_until_pass=-1;
+    }
+
+    std::vector<int> order(m_declarations.size());
+    for(size_t i=0; i<order.size(); i++){
+        order[i]=i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const int a, const int b){
+        return m_declarations[a].first_pass < m_declarations[b].first_pass;
+    });
+
+    for(size_t i=0; i<order.size(); i++){
+        Declaration& declaration=m_declarations[order[i]];
+
+        //from the free ones take the one that got free the latest, so the ones not touched yet this frame stay untouched and can be evicted if they are not needed anymore
+        int best_idx=-1;
+        for(size_t t=0; t<m_textures.size(); t++){
+            const PooledTexture& pooled=m_textures[t];
+            if(pooled.key!=declaration.key || pooled.busy_until_pass>=declaration.first_pass){
+                continue;
+            }
+            if(best_idx==-1 || pooled.busy_until_pass>m_textures[best_idx].busy_until_pass){
+                best_idx=t;
+            }
+        }
+        if(best_idx==-1){
+            best_idx=create_texture(declaration.key);
+        }
+
+        PooledTexture& pooled=m_textures[best_idx];
+        pooled.busy_until_pass=declaration.last_pass;
+        pooled.last_used_frame=m_frame;
+        declaration.texture_idx=best_idx;
+        m_stats.declared_bytes+=pooled.bytes;
+    }
+
+    //the textures of a key that got a declaration this frame are the peak of that key
+    m_stats.nr_declared=m_declarations.size();
+    m_stats.nr_textures=0;
+    for(size_t i=0; i<m_textures.size(); i++){
+        if(m_textures[i].busy_until_pass<0){
+            continue;
+        }
+        TransientTextureKeyStats& key_stats=key_stats_for(m_textures[i].key);
+        key_stats.peak_alive++;
+        key_stats.used_bytes+=m_textures[i].bytes;
+        m_stats.nr_textures++;
+        m_stats.used_bytes+=m_textures[i].bytes;
+    }
+    for(size_t i=0; i<m_declarations.size(); i++){
+        TransientTextureKeyStats& key_stats=key_stats_for(m_declarations[i].key);
+        key_stats.nr_declared++;
+        key_stats.declared_bytes+=m_textures[m_declarations[i].texture_idx].bytes;
+    }
+    m_assigned=true;
+}
+
+TransientTextureKeyStats& TransientTexturePool::key_stats_for(const TexKey& key){
+    for(size_t i=0; i<m_stats.keys.size(); i++){
+        const TransientTextureDesc& desc=m_stats.keys[i].desc;
+        if(std::make_tuple(desc.internal_format, desc.format, desc.type, desc.width, desc.height, desc.nr_mips)==key){
+            return m_stats.keys[i];
+        }
+    }
+    TransientTextureKeyStats key_stats;
+    std::tie(key_stats.desc.internal_format, key_stats.desc.format, key_stats.desc.type, key_stats.desc.width, key_stats.desc.height, key_stats.desc.nr_mips)=key;
+    m_stats.keys.push_back(key_stats);
+    return m_stats.keys.back();
+}
+
+int TransientTexturePool::create_texture(const TexKey& key){
+    PooledTexture pooled;
+    pooled.tex.reset(new Texture2D(named("transient_" + std::to_string(m_textures.size()))));
+    //inmutable storage so that nobody can resize it while it's shared
+    pooled.tex->allocate_storage_inmutable(std::get<0>(key), std::get<1>(key), std::get<2>(key), std::get<3>(key), std::get<4>(key), std::get<5>(key));
+    pooled.key=key;
+    pooled.bytes=pooled.tex->num_bytes_texture();
+    //the whole mip chain adds roughly a third on top of the base level
+    if(std::get<5>(key)>1){
+        pooled.bytes=pooled.bytes*4/3;
+    }
+    pooled.busy_until_pass=-1;
+    pooled.last_used_frame=m_frame;
+    m_textures.push_back(std::move(pooled));
+    m_stats.nr_created++;
+    return m_textures.size()-1;
+}
+
+void TransientTexturePool::clear(){
+    //the handles of this frame point into the textures so they go away too
+    m_textures.clear();
+    m_declarations.clear();
+    m_assigned=false;
+}
+
+TransientTexturePoolStats TransientTexturePool::stats() const{
+    TransientTexturePoolStats stats=m_stats;
+    stats.allocated_bytes=0;
+    for(size_t i=0; i<m_textures.size(); i++){
+        stats.allocated_bytes+=m_textures[i].bytes;
+    }
+    return stats;
+}
+
+
+std::string TransientTexturePool::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+} //namespace gl
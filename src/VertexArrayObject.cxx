@@ -7,6 +7,7 @@
 
 #include "easy_gl/Shader.h"
 #include "easy_gl/Buf.h"
+#include "easy_gl/VertexPacking.h"
 
 #include "easy_gl/UtilsGL.h"
 
@@ -60,6 +61,52 @@ void VertexArrayObject::vertex_attribute(const gl::Shader& prog, const std::stri
     glEnableVertexAttribArray(attribute_location);
 }
 
+//same as above but the attribute starts at the offset of the range, for example for buffers shared through a BufArena
+void VertexArrayObject::vertex_attribute(const gl::Shader& prog, const std::string& attrib_name, const gl::BufRange& range, const int size) const{
+    CHECK(range.buf) << named("The range for attribute ") << attrib_name << " does not point to any buffer";
+    CHECK(range.buf->storage_initialized()) << "Cannot set this vertex atribute to the buffer " << range.buf->name() << " because the buffer has no storage yet. Use buffer.upload_data first";
+
+    this->bind();
+    range.buf->bind();
+    GLint attribute_location=prog.get_attrib_location(attrib_name);
+    if(attribute_location==-1){
+        LOG_IF(WARNING,attribute_location==-1) << named("Attribute location for name ") << attrib_name << " is invalid. Are you sure you are using the attribute in the shader? Maybe you are also binding too many stuff.";
+        return;
+    }
+
+    glVertexAttribPointer(attribute_location, size, GL_FLOAT, GL_FALSE, 0, (const void*)range.offset);
+    glEnableVertexAttribArray(attribute_location);
+}
+
+//fully specified attribute, for buffers with interleaved or non float data. Also used by the TypedBuf overloads which already know the layout at compile time
+void VertexArrayObject::vertex_attribute(const gl::Shader& prog, const std::string& attrib_name, const gl::Buf& buf, const int nr_components, const GLenum gl_type, const bool normalized, const bool is_integer, const GLsizei stride, const GLintptr offset) const{
+    CHECK(buf.storage_initialized()) << "Cannot set this vertex atribute to the buffer " << buf.name() << " because the buffer has no storage yet. Use buffer.upload_data first";
+
+    this->bind();
+    buf.bind();
+    GLint attribute_location=prog.get_attrib_location(attrib_name);
+    if(attribute_location==-1){
+        LOG_IF(WARNING,attribute_location==-1) << named("Attribute location for name ") << attrib_name << " is invalid. Are you sure you are using the attribute in the shader? Maybe you are also binding too many stuff.";
+        return;
+    }
+
+    if(gl_type==GL_DOUBLE){
+        glVertexAttribLPointer(attribute_location, nr_components, gl_type, stride, (const void*)offset);
+    }else if(is_integer){
+        glVertexAttribIPointer(attribute_location, nr_components, gl_type, stride, (const void*)offset);
+    }else{
+        glVertexAttribPointer(attribute_location, nr_components, gl_type, normalized? GL_TRUE : GL_FALSE, stride, (const void*)offset);
+    }
+    glEnableVertexAttribArray(attribute_location);
+}
+
+//for buffers filled with the packers from VertexPacking.h. Snorm_2_10_10_10 always uses 4 components since the whole vertex is packed in one uint32
+void VertexArrayObject::vertex_attribute(const gl::Shader& prog, const std::string& attrib_name, const gl::Buf& buf, const int nr_components, const VertexFormat format) const{
+    CHECK(format!=VertexFormat::Snorm_2_10_10_10 || nr_components==4) << named("Attribute ") << attrib_name << " uses Snorm_2_10_10_10 which needs 4 components but we got " << nr_components << ". The shader can still declare it as a vec3";
+
+    vertex_attribute(prog, attrib_name, buf, nr_components, vertex_format_gl_type(format), vertex_format_is_normalized(format), vertex_format_is_integer(format), 0, 0);
+}
+
 void VertexArrayObject::indices(const gl::Buf& buf) const{
     GL_C( this->bind() );
     GL_C( buf.bind() );
@@ -0,0 +1,216 @@
+#include "easy_gl/VertexPacking.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring> //memcpy
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define EGL_PACKING_X86 1
+#elif defined(__aarch64__)
+    #include <arm_neon.h>
+    #define EGL_PACKING_NEON 1
+#endif
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+namespace gl{
+
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXf;
+typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXi;
+
+GLenum vertex_format_gl_type(const VertexFormat format){
+    switch(format){
+        case VertexFormat::Float: return GL_FLOAT;
+        case VertexFormat::Half: return GL_HALF_FLOAT;
+        case VertexFormat::Snorm_2_10_10_10: return GL_INT_2_10_10_10_REV;
+        case VertexFormat::Unorm8: return GL_UNSIGNED_BYTE;
+        case VertexFormat::Unorm16: return GL_UNSIGNED_SHORT;
+        case VertexFormat::Int: return GL_INT;
+        case VertexFormat::UInt: return GL_UNSIGNED_INT;
+    }
+    LOG(FATAL) << "Unknown vertex format";
+    return GL_FLOAT;
+}
+
+bool vertex_format_is_normalized(const VertexFormat format){
+    return format==VertexFormat::Snorm_2_10_10_10 || format==VertexFormat::Unorm8 || format==VertexFormat::Unorm16;
+}
+
+bool vertex_format_is_integer(const VertexFormat format){
+    return format==VertexFormat::Int || format==VertexFormat::UInt;
+}
+
+
+//round to nearest even, handles denormals, inf and nan
+uint16_t float_to_half(const float val){
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    uint32_t sign=(bits>>16) & 0x8000;
+    int32_t exponent=((bits>>23) & 0xff) - 127 + 15;
+    uint32_t mantissa=bits & 0x7fffff;
+
+    if( ((bits>>23) & 0xff)==0xff ){ //inf or nan
+        return sign | 0x7c00 | (mantissa? 0x200 : 0);
+    }
+    if(exponent>=31){ //too big, goes to inf
+        return sign | 0x7c00;
+    }
+    if(exponent<=0){ //denormal or zero
+        if(exponent<-10){
+            return sign;
+        }
+        mantissa|=0x800000;
+        uint32_t shift=14-exponent;
+        uint32_t half_mantissa=mantissa>>shift;
+        uint32_t remainder=mantissa & ((1u<<shift)-1);
+        uint32_t halfway=1u<<(shift-1);
+        if(remainder>halfway || (remainder==halfway && (half_mantissa & 1))){
+            half_mantissa++;
+        }
+        return sign | half_mantissa;
+    }
+    uint32_t half=sign | (exponent<<10) | (mantissa>>13);
+    uint32_t remainder=mantissa & 0x1fff;
+    if(remainder>0x1000 || (remainder==0x1000 && (half & 1))){
+        half++; //can carry into the exponent which correctly rounds up to the next power of two or to inf
+    }
+    return half;
+}
+
+float half_to_float(const uint16_t val){
+    uint32_t sign=(uint32_t)(val & 0x8000)<<16;
+    uint32_t exponent=(val>>10) & 0x1f;
+    uint32_t mantissa=val & 0x3ff;
+    uint32_t bits;
+    if(exponent==0){
+        if(mantissa==0){
+            bits=sign;
+        }else{
+            //denormal, normalize it
+            exponent=127-15+1;
+            while(!(mantissa & 0x400)){
+                mantissa<<=1;
+                exponent--;
+            }
+            mantissa&=0x3ff;
+            bits=sign | (exponent<<23) | (mantissa<<13);
+        }
+    }else if(exponent==31){
+        bits=sign | 0x7f800000 | (mantissa<<13);
+    }else{
+        bits=sign | ((exponent-15+127)<<23) | (mantissa<<13);
+    }
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+
+#ifdef EGL_PACKING_X86
+//compiled for f16c even if the rest of the library isn't, we only call it after checking the cpu supports it
+__attribute__((target("avx,f16c")))
+static size_t float_to_half_f16c(const float* src, uint16_t* dst, const size_t nr_values){
+    size_t i=0;
+    for(; i+8<=nr_values; i+=8){
+        __m256 floats=_mm256_loadu_ps(src+i);
+        __m128i halfs=_mm256_cvtps_ph(floats, _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst+i), halfs);
+    }
+    return i;
+}
+#endif
+
+//converts as many values as possible with simd and returns how many it did so the rest can be done with the scalar code
+static size_t float_to_half_simd(const float* src, uint16_t* dst, const size_t nr_values){
+    #if defined(EGL_PACKING_X86)
+        static const bool has_f16c=__builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+        if(has_f16c){
+            return float_to_half_f16c(src, dst, nr_values);
+        }
+        return 0;
+    #elif defined(EGL_PACKING_NEON)
+        size_t i=0;
+        for(; i+4<=nr_values; i+=4){
+            float16x4_t halfs=vcvt_f16_f32(vld1q_f32(src+i));
+            vst1_u16(dst+i, vreinterpret_u16_f16(halfs));
+        }
+        return i;
+    #else
+        return 0;
+    #endif
+}
+
+std::vector<uint16_t> pack_half(const Eigen::MatrixXf& mat){
+    RowMatrixXf rows=mat;
+    size_t nr_values=rows.size();
+    std::vector<uint16_t> packed(nr_values);
+
+    size_t nr_done=float_to_half_simd(rows.data(), packed.data(), nr_values);
+    for(size_t i=nr_done; i<nr_values; i++){
+        packed[i]=float_to_half(rows.data()[i]);
+    }
+    return packed;
+}
+
+std::vector<uint32_t> pack_snorm_2_10_10_10(const Eigen::MatrixXf& mat){
+    CHECK(mat.cols()==3 || mat.cols()==4) << "Packing to 2_10_10_10 needs 3 or 4 columns but the matrix has " << mat.cols();
+
+    //snorm conversion from the GL spec, f = round(clamp(c,-1,1) * (2^(b-1)-1))
+    auto to_snorm=[](const float val, const float max_val, const uint32_t mask){
+        float clamped=std::min(std::max(val, -1.0f), 1.0f);
+        int32_t quantized=(int32_t)std::lround(clamped*max_val);
+        return (uint32_t)quantized & mask;
+    };
+
+    std::vector<uint32_t> packed(mat.rows());
+    for(int i=0; i<mat.rows(); i++){
+        float w= mat.cols()==4? mat(i,3) : 0.0f;
+        packed[i]=  to_snorm(mat(i,0), 511.0f, 0x3ff)
+                 | (to_snorm(mat(i,1), 511.0f, 0x3ff) << 10)
+                 | (to_snorm(mat(i,2), 511.0f, 0x3ff) << 20)
+                 | (to_snorm(w, 1.0f, 0x3) << 30);
+    }
+    return packed;
+}
+
+//the loops go over contiguous memory without branches so the compiler vectorizes them at -O3
+std::vector<uint8_t> pack_unorm8(const Eigen::MatrixXf& mat){
+    RowMatrixXf rows=mat;
+    size_t nr_values=rows.size();
+    const float* src=rows.data();
+    std::vector<uint8_t> packed(nr_values);
+    for(size_t i=0; i<nr_values; i++){
+        float clamped=std::min(std::max(src[i], 0.0f), 1.0f);
+        packed[i]=(uint8_t)(clamped*255.0f+0.5f);
+    }
+    return packed;
+}
+
+std::vector<uint16_t> pack_unorm16(const Eigen::MatrixXf& mat){
+    RowMatrixXf rows=mat;
+    size_t nr_values=rows.size();
+    const float* src=rows.data();
+    std::vector<uint16_t> packed(nr_values);
+    for(size_t i=0; i<nr_values; i++){
+        float clamped=std::min(std::max(src[i], 0.0f), 1.0f);
+        packed[i]=(uint16_t)(clamped*65535.0f+0.5f);
+    }
+    return packed;
+}
+
+std::vector<int32_t> pack_int(const Eigen::MatrixXi& mat){
+    RowMatrixXi rows=mat;
+    return std::vector<int32_t>(rows.data(), rows.data()+rows.size());
+}
+
+
+} //namespace gl
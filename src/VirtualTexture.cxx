@@ -0,0 +1,697 @@
+#include "easy_gl/VirtualTexture.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstring> //memcpy, memcmp
+
+//mmap
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "easy_gl/UtilsGL.h"
+
+//loguru
+#define LOGURU_REPLACE_GLOG 1
+#include <loguru.hpp>
+
+
+//use the maximum value of an int as invalid . We don't use negative because we sometimes compare with unsigned int
+#define EGL_INVALID 2147483647
+
+namespace gl{
+
+//the shader computes the index of a page with 32 bit uints so the full pyramid has to fit in them
+static const int max_nr_levels=15;
+
+//RGBA8 texel of the page table. The shader reads it as r=slot x, g=slot y, b=level of the tile in the slot
+static uint32_t pack_page_entry(const int slot_x, const int slot_y, const int lvl){
+    return (uint32_t)slot_x | ((uint32_t)slot_y<<8) | ((uint32_t)lvl<<16) | (255u<<24);
+}
+
+static void grow_rect(cv::Rect& rect, const int x, const int y, const int w, const int h){
+    if(rect.width<=0 || rect.height<=0){
+        rect=cv::Rect(x, y, w, h);
+        return;
+    }
+    int x0=std::min(rect.x, x);
+    int y0=std::min(rect.y, y);
+    int x1=std::max(rect.x+rect.width, x+w);
+    int y1=std::max(rect.y+rect.height, y+h);
+    rect=cv::Rect(x0, y0, x1-x0, y1-y0);
+}
+
+//declarations and sampling function for the fragment shader. The page of every fragment is looked up in the page table which gives the slot of the atlas with the closest resident tile.
+//A rotating 1 in 16 pixels also write the page they would like into the feedback list, at most once per page and frame thanks to the stamps
+static const char* vt_glsl_src = R"(
+    uniform sampler2D vt_page_table;
+    uniform sampler2D vt_atlas;
+    uniform vec2 vt_image_scale; //size of the image divided by the size of the virtual texture, which is padded to a power of two nr of tiles
+    uniform float vt_virtual_size;
+    uniform float vt_tile_size;
+    uniform float vt_border;
+    uniform float vt_slot_size;
+    uniform float vt_atlas_size;
+    uniform int vt_nr_levels;
+    uniform int vt_frame;
+    uniform int vt_feedback_capacity;
+
+    layout(std430) buffer vt_feedback_buf{
+        uint vt_feedback_count;
+        uint vt_feedback_pad0;
+        uint vt_feedback_pad1;
+        uint vt_feedback_pad2;
+        uint vt_feedback_list[];
+    };
+    layout(std430) buffer vt_stamps_buf{ uint vt_stamps[]; };
+
+    vec4 vt_sample(vec2 uv){
+        vec2 vuv=clamp(uv, 0.0, 1.0)*vt_image_scale;
+        vec2 texel=vuv*vt_virtual_size;
+        vec2 dx=dFdx(texel);
+        vec2 dy=dFdy(texel);
+        float lod=0.5*log2(max(max(dot(dx,dx), dot(dy,dy)), 1e-8));
+        int lvl=clamp(int(floor(lod)), 0, vt_nr_levels-1);
+        int nr_pages=1<<(vt_nr_levels-1-lvl);
+        ivec2 page=clamp(ivec2(vuv*float(nr_pages)), ivec2(0), ivec2(nr_pages-1));
+
+        ivec2 frag=ivec2(gl_FragCoord.xy) & 3;
+        if(frag.x+frag.y*4 == (vt_frame & 15)){
+            uint first_page=((1u<<(2*vt_nr_levels)) - (1u<<(2*(vt_nr_levels-lvl))))/3u;
+            uint id=first_page + uint(page.y*nr_pages + page.x);
+            if(atomicExchange(vt_stamps[id], uint(vt_frame))!=uint(vt_frame)){
+                uint idx=atomicAdd(vt_feedback_count, 1u);
+                if(idx<uint(vt_feedback_capacity)){
+                    vt_feedback_list[idx]=id;
+                }
+            }
+        }
+
+        uvec3 entry=uvec3(texelFetch(vt_page_table, page, lvl).xyz*255.0+0.5);
+        float tile_size_virtual=vt_tile_size*exp2(float(entry.z)); //how many texels of level 0 the resident tile covers
+        vec2 in_tile=fract(texel/tile_size_virtual);
+        vec2 atlas_texel=vec2(entry.xy)*vt_slot_size + vt_border + in_tile*vt_tile_size;
+        return textureLod(vt_atlas, atlas_texel/vt_atlas_size, 0.0);
+    }
+)";
+
+
+VirtualTexture::VirtualTexture():
+    m_mapped_ptr(nullptr),
+    m_mapped_size_bytes(0),
+    m_tile_bytes(0),
+    m_slot_size(0),
+    m_feedback_in_flight(false),
+    m_feedback_capacity(4096),
+    m_frame(1),
+    m_atlas_slots_per_side(0),
+    m_stop_loader(false),
+    m_max_uploads_per_frame(16),
+    m_max_pending_loads(64)
+    {
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+VirtualTexture::VirtualTexture(std::string name):
+    VirtualTexture(){
+    m_name=name; //we delegate the constructor to the main one but we cannot have in this intializer list more than that call.
+}
+
+VirtualTexture::~VirtualTexture(){
+    close();
+}
+
+void VirtualTexture::set_name(const std::string name){
+    m_name=name;
+}
+
+std::string VirtualTexture::name() const{
+    return m_name;
+}
+
+//writes the tile pyramid of an 8 bit image with 1, 3 or 4 channels
+void VirtualTexture::build_tile_file(const cv::Mat& cv_mat, const std::string& path, const int tile_size, const int border){
+    CHECK(!cv_mat.empty()) << "The mat is empty";
+    CHECK(cv_mat.depth()==CV_8U) << "Only 8 bit images can be turned into a virtual texture";
+    CHECK(tile_size>0 && border>=1 && border<tile_size) << "The tile size is " << tile_size << " and the border " << border << ". The border needs to be at least 1 and smaller than the tile";
+
+    cv::Mat rgba;
+    if(cv_mat.channels()==1){
+        cv::cvtColor(cv_mat, rgba, cv::COLOR_GRAY2RGBA);
+    }else if(cv_mat.channels()==3){
+        cv::cvtColor(cv_mat, rgba, cv::COLOR_BGR2RGBA);
+    }else if(cv_mat.channels()==4){
+        cv::cvtColor(cv_mat, rgba, cv::COLOR_BGRA2RGBA);
+    }else{
+        LOG(FATAL) << "Virtual textures need 1, 3 or 4 channels but the mat has " << cv_mat.channels();
+    }
+
+    //levels until the whole image fits in one tile
+    int nr_levels=1;
+    while( ((int64_t)tile_size<<(nr_levels-1)) < std::max(rgba.cols, rgba.rows) ){
+        nr_levels++;
+    }
+    CHECK(nr_levels<=max_nr_levels) << "The image needs " << nr_levels << " levels but we support at most " << max_nr_levels << ". Use a bigger tile size";
+
+    VirtualTextureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EGL_VIRTUAL_TEXTURE_MAGIC, sizeof(EGL_VIRTUAL_TEXTURE_MAGIC));
+    header.version=EGL_VIRTUAL_TEXTURE_VERSION;
+    header.width=rgba.cols;
+    header.height=rgba.rows;
+    header.tile_size=tile_size;
+    header.border=border;
+    header.nr_levels=nr_levels;
+    header.data_offset=EGL_VIRTUAL_TEXTURE_ALIGNMENT;
+
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    CHECK(file.is_open()) << "Could not open file for writing " << path;
+    static const char zeros[EGL_VIRTUAL_TEXTURE_ALIGNMENT]={0};
+    file.write((const char*)&header, sizeof(header));
+    file.write(zeros, header.data_offset-sizeof(header));
+
+    int slot_size=tile_size+2*border;
+    cv::Mat level=rgba;
+    for(int lvl=0; lvl<nr_levels; lvl++){
+        if(lvl>0){
+            cv::Mat smaller;
+            cv::resize(level, smaller, cv::Size((level.cols+1)/2, (level.rows+1)/2), 0, 0, cv::INTER_AREA);
+            level=smaller;
+        }
+        int tiles_x=(level.cols+tile_size-1)/tile_size;
+        int tiles_y=(level.rows+tile_size-1)/tile_size;
+
+        //pad so that every tile including its border can be cut out of the padded image
+        cv::Mat padded;
+        cv::copyMakeBorder(level, padded, border, border+tiles_y*tile_size-level.rows, border, border+tiles_x*tile_size-level.cols, cv::BORDER_REPLICATE);
+        for(int y=0; y<tiles_y; y++){
+            for(int x=0; x<tiles_x; x++){
+                cv::Mat tile=padded(cv::Rect(x*tile_size, y*tile_size, slot_size, slot_size)).clone();
+                file.write((const char*)tile.data, (size_t)slot_size*slot_size*4);
+            }
+        }
+    }
+    CHECK(file.good()) << "Something went wrong while writing " << path;
+}
+
+//mmaps the tile file and allocates an atlas of atlas_slots_per_side^2 tiles
+void VirtualTexture::open(const std::string& path, const int atlas_slots_per_side){
+    close();
+    CHECK(atlas_slots_per_side>=2 && atlas_slots_per_side<=256) << named("The atlas needs between 2 and 256 slots per side so the slot fits in one byte of the page table but we got ") << atlas_slots_per_side;
+
+    int fd=::open(path.c_str(), O_RDONLY);
+    CHECK(fd>=0) << named("Could not open tile file ") << path;
+    struct stat file_stat;
+    CHECK(fstat(fd, &file_stat)==0) << named("Could not stat tile file ") << path;
+    size_t file_size=file_stat.st_size;
+    CHECK(file_size>=sizeof(VirtualTextureFileHeader)) << named("File ") << path << " is too small to be a tile file";
+
+    void* ptr=mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); //the mapping keeps its own reference to the file
+    CHECK(ptr!=MAP_FAILED) << named("Could not mmap tile file ") << path;
+    //the tiles are read in whatever order the camera needs them so read ahead would only waste io
+    madvise(ptr, file_size, MADV_RANDOM);
+    m_mapped_ptr=(unsigned char*)ptr;
+    m_mapped_size_bytes=file_size;
+
+    //validate everything before trusting any offset
+    memcpy(&m_header, m_mapped_ptr, sizeof(VirtualTextureFileHeader));
+    CHECK(memcmp(m_header.magic, EGL_VIRTUAL_TEXTURE_MAGIC, sizeof(EGL_VIRTUAL_TEXTURE_MAGIC))==0) << named("File ") << path << " is not a tile file";
+    CHECK(m_header.version==EGL_VIRTUAL_TEXTURE_VERSION) << named("Tile file ") << path << " has version " << m_header.version << " but we can only read version " << EGL_VIRTUAL_TEXTURE_VERSION;
+    CHECK(m_header.nr_levels>=1 && (int)m_header.nr_levels<=max_nr_levels) << named("Tile file has ") << m_header.nr_levels << " levels";
+    CHECK(m_header.tile_size>0 && m_header.border>=1 && m_header.border<m_header.tile_size) << named("Tile file has a tile size of ") << m_header.tile_size << " and a border of " << m_header.border;
+
+    int nr_levels=m_header.nr_levels;
+    m_slot_size=m_header.tile_size+2*m_header.border;
+    m_tile_bytes=(size_t)m_slot_size*m_slot_size*4;
+    m_level_tiles_x.resize(nr_levels);
+    m_level_tiles_y.resize(nr_levels);
+    m_level_first_file_tile.resize(nr_levels);
+    uint64_t nr_file_tiles=0;
+    int level_w=m_header.width;
+    int level_h=m_header.height;
+    for(int lvl=0; lvl<nr_levels; lvl++){
+        if(lvl>0){
+            level_w=(level_w+1)/2;
+            level_h=(level_h+1)/2;
+        }
+        m_level_tiles_x[lvl]=(level_w+m_header.tile_size-1)/m_header.tile_size;
+        m_level_tiles_y[lvl]=(level_h+m_header.tile_size-1)/m_header.tile_size;
+        m_level_first_file_tile[lvl]=nr_file_tiles;
+        nr_file_tiles+=(uint64_t)m_level_tiles_x[lvl]*m_level_tiles_y[lvl];
+    }
+    CHECK(m_level_tiles_x[nr_levels-1]==1 && m_level_tiles_y[nr_levels-1]==1) << named("The coarsest level of the tile file should be a single tile");
+    CHECK(m_header.data_offset + nr_file_tiles*m_tile_bytes <= m_mapped_size_bytes) << named("Tile file ") << path << " is truncated";
+
+    //atlas
+    m_atlas_slots_per_side=atlas_slots_per_side;
+    int atlas_size=atlas_slots_per_side*m_slot_size;
+    m_atlas.reset(new Texture2D(named("vt_atlas")));
+    m_atlas->allocate_storage(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, atlas_size, atlas_size);
+    m_atlas->set_filter_mode_min_mag(GL_LINEAR);
+
+    //page table with one mip per level. It's normalized RGBA8 instead of an integer format so that Texture2D can allocate the mips
+    int nr_pages_finest=nr_pages(0);
+    m_page_table.reset(new Texture2D(named("vt_page_table")));
+    m_page_table->allocate_storage(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, nr_pages_finest, nr_pages_finest);
+    m_page_table->generate_mipmap(nr_levels-1);
+    m_page_table->set_filter_mode_min(GL_NEAREST_MIPMAP_NEAREST);
+    m_page_table->set_filter_mode_mag(GL_NEAREST);
+
+    //everything starts pointing at the coarsest tile which lives in slot 0
+    uint32_t root_entry=pack_page_entry(0, 0, nr_levels-1);
+    m_page_entries.resize(nr_levels);
+    m_page_dirty.resize(nr_levels);
+    for(int lvl=0; lvl<nr_levels; lvl++){
+        m_page_entries[lvl].assign((size_t)nr_pages(lvl)*nr_pages(lvl), root_entry);
+        m_page_dirty[lvl]=cv::Rect(0, 0, nr_pages(lvl), nr_pages(lvl));
+    }
+
+    //feedback
+    std::vector<uint32_t> zeros(4+m_feedback_capacity, 0);
+    m_feedback.reset(new Buf(named("vt_feedback")));
+    m_feedback->set_target(GL_SHADER_STORAGE_BUFFER);
+    m_feedback->upload_data(zeros.size()*sizeof(uint32_t), zeros.data(), GL_DYNAMIC_COPY);
+    zeros.assign(level_first_page(nr_levels), 0);
+    m_feedback_stamps.reset(new Buf(named("vt_feedback_stamps")));
+    m_feedback_stamps->set_target(GL_SHADER_STORAGE_BUFFER);
+    m_feedback_stamps->upload_data(zeros.size()*sizeof(uint32_t), zeros.data(), GL_DYNAMIC_COPY);
+    m_feedback_in_flight=false;
+    m_frame=1; //the stamps start at 0 so the first frame has to be different
+
+    //slots
+    int nr_slots=atlas_slots_per_side*atlas_slots_per_side;
+    m_slot_tile.assign(nr_slots, EGL_INVALID);
+    m_slot_last_frame.assign(nr_slots, 0);
+    m_slot_lru_it.resize(nr_slots);
+    m_lru.clear();
+    m_free_slots.clear();
+    for(int i=nr_slots-1; i>=1; i--){
+        m_free_slots.push_back(i);
+    }
+    uint32_t root_id=tile_id(nr_levels-1, 0, 0);
+    m_slot_tile[0]=root_id;
+    m_tile_slot[root_id]=0;
+    write_slot(0, tile_pixels_in_file(nr_levels-1, 0, 0));
+    upload_page_table();
+
+    m_stats=VirtualTextureStats();
+    m_stats.nr_resident_tiles=1;
+
+    m_stop_loader=false;
+    m_loader=std::thread(&VirtualTexture::loader_loop, this);
+}
+
+void VirtualTexture::close(){
+    stop_loader();
+    m_load_requests.clear();
+    m_loaded.clear();
+    m_pending.clear();
+    m_tile_slot.clear();
+    m_lru.clear();
+    m_free_slots.clear();
+    m_slot_tile.clear();
+    m_slot_last_frame.clear();
+    m_slot_lru_it.clear();
+    m_page_entries.clear();
+    m_page_dirty.clear();
+    m_page_table.reset();
+    m_atlas.reset();
+    m_feedback.reset();
+    m_feedback_stamps.reset();
+    m_feedback_in_flight=false;
+
+    if(m_mapped_ptr){
+        munmap(m_mapped_ptr, m_mapped_size_bytes);
+        m_mapped_ptr=nullptr;
+        m_mapped_size_bytes=0;
+    }
+}
+
+bool VirtualTexture::is_open() const{
+    return m_mapped_ptr!=nullptr;
+}
+
+//call once per frame before drawing
+void VirtualTexture::update(){
+    CHECK(is_open()) << named("The virtual texture is not open");
+
+    //feedback of some previous frame
+    if(m_feedback_in_flight && m_feedback_download.ready()){
+        const uint32_t* feedback=(const uint32_t*)m_feedback_download.data();
+        int nr_requests=feedback[0];
+        if(nr_requests>m_feedback_capacity){
+            m_stats.nr_feedback_overflows++;
+            nr_requests=m_feedback_capacity;
+        }
+        m_stats.nr_feedback_requests=nr_requests;
+        process_feedback(feedback+4, nr_requests);
+        m_feedback_in_flight=false;
+    }
+
+    //tiles that the loader finished
+    std::vector<LoadedTile> loaded;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while(!m_loaded.empty() && (int)loaded.size()<m_max_uploads_per_frame){
+            loaded.push_back(std::move(m_loaded.front()));
+            m_loaded.pop_front();
+        }
+    }
+    for(size_t i=0; i<loaded.size(); i++){
+        m_pending.erase(loaded[i].id);
+        if(m_tile_slot.find(loaded[i].id)!=m_tile_slot.end()){
+            continue;
+        }
+        //if every slot was used in the last frame we drop the tile, it will be requested again if it's still needed
+        if(upload_tile(loaded[i].id, loaded[i].pixels.data())){
+            m_stats.nr_loaded++;
+        }
+    }
+
+    upload_page_table();
+
+    m_stats.nr_resident_tiles=m_tile_slot.size();
+    m_stats.nr_pending_loads=m_pending.size();
+}
+
+//binds the page table, the atlas, the feedback buffers and the uniforms used by vt_sample()
+void VirtualTexture::bind(Shader& shader){
+    CHECK(is_open()) << named("The virtual texture is not open");
+    float virtual_size=(float)m_header.tile_size*nr_pages(0);
+
+    shader.use();
+    shader.bind_texture(*m_page_table, "vt_page_table");
+    shader.bind_texture(*m_atlas, "vt_atlas");
+    shader.bind_buffer(*m_feedback, GL_SHADER_STORAGE_BUFFER, "vt_feedback_buf");
+    shader.bind_buffer(*m_feedback_stamps, GL_SHADER_STORAGE_BUFFER, "vt_stamps_buf");
+    shader.uniform_v2_float(Eigen::Vector2f(m_header.width/virtual_size, m_header.height/virtual_size), "vt_image_scale");
+    shader.uniform_float(virtual_size, "vt_virtual_size");
+    shader.uniform_float(m_header.tile_size, "vt_tile_size");
+    shader.uniform_float(m_header.border, "vt_border");
+    shader.uniform_float(m_slot_size, "vt_slot_size");
+    shader.uniform_float(m_atlas->width(), "vt_atlas_size");
+    shader.uniform_int(m_header.nr_levels, "vt_nr_levels");
+    shader.uniform_int(m_frame, "vt_frame");
+    shader.uniform_int(m_feedback_capacity, "vt_feedback_capacity");
+}
+
+//call once per frame after the draws that sample the texture
+void VirtualTexture::end_frame(){
+    CHECK(is_open()) << named("The virtual texture is not open");
+
+    //the copy into the readback buffer has to see the writes of the fragment shaders
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    //only one readback at a time. While it's in flight the feedback of the following frames is dropped
+    if(!m_feedback_in_flight){
+        m_feedback->download_async(m_feedback_download, 0, (4+m_feedback_capacity)*sizeof(uint32_t));
+        m_feedback_in_flight=true;
+    }
+    uint32_t zero=0;
+    m_feedback->upload_sub_data(0, sizeof(zero), &zero);
+
+    m_frame++;
+    if(m_frame==0){
+        m_frame=1; //0 is what the stamps are initialized with
+    }
+}
+
+std::string VirtualTexture::glsl_code(){
+    return vt_glsl_src;
+}
+
+void VirtualTexture::set_max_uploads_per_frame(const int nr_tiles){
+    CHECK(nr_tiles>=1) << named("We need to upload at least one tile per frame");
+    m_max_uploads_per_frame=nr_tiles;
+}
+
+void VirtualTexture::set_max_pending_loads(const int nr_tiles){
+    CHECK(nr_tiles>=1) << named("We need at least one pending load");
+    m_max_pending_loads=nr_tiles;
+}
+
+int VirtualTexture::width() const{
+    return m_header.width;
+}
+
+int VirtualTexture::height() const{
+    return m_header.height;
+}
+
+int VirtualTexture::nr_levels() const{
+    return m_header.nr_levels;
+}
+
+Texture2D& VirtualTexture::page_table(){
+    CHECK(m_page_table) << named("The virtual texture is not open");
+    return *m_page_table;
+}
+
+Texture2D& VirtualTexture::atlas(){
+    CHECK(m_atlas) << named("The virtual texture is not open");
+    return *m_atlas;
+}
+
+VirtualTextureStats VirtualTexture::stats() const{
+    return m_stats;
+}
+
+std::string VirtualTexture::named(const std::string msg) const{
+    return m_name.empty()? msg : m_name + ": " + msg;
+}
+
+
+int VirtualTexture::nr_pages(const int lvl) const{
+    return 1<<(m_header.nr_levels-1-lvl);
+}
+
+//a full pyramid has 4^(nr_levels-1-l) pages in level l so the ones before it sum up to this
+uint64_t VirtualTexture::level_first_page(const int lvl) const{
+    int nr_levels=m_header.nr_levels;
+    return ( (1ull<<(2*nr_levels)) - (1ull<<(2*(nr_levels-lvl))) )/3;
+}
+
+uint32_t VirtualTexture::tile_id(const int lvl, const int x, const int y) const{
+    return level_first_page(lvl) + (uint64_t)y*nr_pages(lvl) + x;
+}
+
+void VirtualTexture::tile_coords(const uint32_t id, int& lvl, int& x, int& y) const{
+    lvl=0;
+    while(lvl+1<(int)m_header.nr_levels && id>=level_first_page(lvl+1)){
+        lvl++;
+    }
+    uint32_t idx_in_level=id-level_first_page(lvl);
+    x=idx_in_level%nr_pages(lvl);
+    y=idx_in_level/nr_pages(lvl);
+}
+
+bool VirtualTexture::tile_in_file(const int lvl, const int x, const int y) const{
+    return x<m_level_tiles_x[lvl] && y<m_level_tiles_y[lvl];
+}
+
+const unsigned char* VirtualTexture::tile_pixels_in_file(const int lvl, const int x, const int y) const{
+    uint64_t file_tile=m_level_first_file_tile[lvl] + (uint64_t)y*m_level_tiles_x[lvl] + x;
+    return m_mapped_ptr + m_header.data_offset + file_tile*m_tile_bytes;
+}
+
+//marks the resident tiles as used and queues the missing ones together with their missing ancestors, coarse levels first so the image sharpens progressively
+void VirtualTexture::process_feedback(const uint32_t* ids, const int nr_ids){
+    uint32_t nr_total_pages=level_first_page(m_header.nr_levels);
+    std::unordered_set<uint32_t> wanted;
+    for(int i=0; i<nr_ids; i++){
+        uint32_t id=ids[i];
+        if(id>=nr_total_pages){
+            continue;
+        }
+        int lvl, x, y;
+        tile_coords(id, lvl, x, y);
+        if(!tile_in_file(lvl, x, y)){
+            continue; //padding of the virtual texture outside of the image
+        }
+        while(true){
+            uint32_t cur_id=tile_id(lvl, x, y);
+            auto it=m_tile_slot.find(cur_id);
+            if(it!=m_tile_slot.end()){
+                touch_slot(it->second);
+                break;
+            }
+            if(!m_pending.count(cur_id)){
+                wanted.insert(cur_id);
+            }
+            lvl++;
+            x/=2;
+            y/=2;
+        }
+    }
+
+    //the coarser levels have the higher ids
+    std::vector<uint32_t> sorted(wanted.begin(), wanted.end());
+    std::sort(sorted.begin(), sorted.end(), std::greater<uint32_t>());
+
+    //the requests that the loader didn't start yet are replaced by the new ones because the camera may have moved away from them
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(size_t i=0; i<m_load_requests.size(); i++){
+            m_pending.erase(m_load_requests[i]);
+        }
+        m_load_requests.clear();
+        for(size_t i=0; i<sorted.size() && (int)m_pending.size()<m_max_pending_loads; i++){
+            m_load_requests.push_back(sorted[i]);
+            m_pending.insert(sorted[i]);
+        }
+    }
+    m_cond.notify_one();
+}
+
+bool VirtualTexture::upload_tile(const uint32_t id, const unsigned char* pixels){
+    int slot=acquire_slot();
+    if(slot<0){
+        return false;
+    }
+    m_slot_tile[slot]=id;
+    m_tile_slot[id]=slot;
+    m_lru.push_front(slot);
+    m_slot_lru_it[slot]=m_lru.begin();
+    m_slot_last_frame[slot]=m_frame;
+    write_slot(slot, pixels);
+
+    int lvl, x, y;
+    tile_coords(id, lvl, x, y);
+    update_page_entries(lvl, x, y);
+    return true;
+}
+
+void VirtualTexture::write_slot(const int slot, const unsigned char* pixels){
+    int slot_x=slot%m_atlas_slots_per_side;
+    int slot_y=slot/m_atlas_slots_per_side;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_atlas->bind();
+    GL_C( glTexSubImage2D(GL_TEXTURE_2D, 0, slot_x*m_slot_size, slot_y*m_slot_size, m_slot_size, m_slot_size, GL_RGBA, GL_UNSIGNED_BYTE, pixels) );
+}
+
+//a free slot or the least recently used one. Returns -1 if all of them were used in the last frame since evicting them would only make them load again
+int VirtualTexture::acquire_slot(){
+    if(!m_free_slots.empty()){
+        int slot=m_free_slots.back();
+        m_free_slots.pop_back();
+        return slot;
+    }
+    if(m_lru.empty()){
+        return -1;
+    }
+    int slot=m_lru.back();
+    if(m_slot_last_frame[slot]+1>=m_frame){
+        return -1;
+    }
+
+    uint32_t evicted_id=m_slot_tile[slot];
+    m_lru.pop_back();
+    m_tile_slot.erase(evicted_id);
+    m_slot_tile[slot]=EGL_INVALID;
+    m_stats.nr_evicted++;
+
+    //the pages of the evicted tile now fall back to its ancestors
+    int lvl, x, y;
+    tile_coords(evicted_id, lvl, x, y);
+    update_page_entries(lvl, x, y);
+    return slot;
+}
+
+void VirtualTexture::touch_slot(const int slot){
+    if(slot==0){
+        return; //the coarsest tile is not in the lru
+    }
+    m_lru.splice(m_lru.begin(), m_lru, m_slot_lru_it[slot]);
+    m_slot_last_frame[slot]=m_frame;
+}
+
+//recomputes the page table entries covered by a tile after it became resident or got evicted. Going from the tile down to level 0 every page either has its own tile or copies the entry of its parent which was already updated
+void VirtualTexture::update_page_entries(const int lvl, const int x, const int y){
+    int nr_levels=m_header.nr_levels;
+    for(int k=lvl; k>=0; k--){
+        int shift=lvl-k;
+        int x0=x<<shift;
+        int y0=y<<shift;
+        int size=1<<shift;
+        int pages=nr_pages(k);
+        std::vector<uint32_t>& entries=m_page_entries[k];
+        for(int py=y0; py<y0+size; py++){
+            for(int px=x0; px<x0+size; px++){
+                auto it=m_tile_slot.find(tile_id(k, px, py));
+                uint32_t entry;
+                if(it!=m_tile_slot.end()){
+                    entry=pack_page_entry(it->second%m_atlas_slots_per_side, it->second/m_atlas_slots_per_side, k);
+                }else{
+                    CHECK(k+1<nr_levels) << named("The coarsest tile should always be resident");
+                    entry=m_page_entries[k+1][(size_t)(py/2)*nr_pages(k+1) + px/2];
+                }
+                entries[(size_t)py*pages+px]=entry;
+            }
+        }
+        grow_rect(m_page_dirty[k], x0, y0, size, size);
+    }
+}
+
+//uploads the region of every level that changed. The rows of the region are taken straight from the cpu page table with GL_UNPACK_ROW_LENGTH
+void VirtualTexture::upload_page_table(){
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    m_page_table->bind();
+    for(size_t lvl=0; lvl<m_page_dirty.size(); lvl++){
+        cv::Rect& dirty=m_page_dirty[lvl];
+        if(dirty.width<=0 || dirty.height<=0){
+            continue;
+        }
+        int pages=nr_pages(lvl);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, pages);
+        const uint32_t* first=m_page_entries[lvl].data() + (size_t)dirty.y*pages + dirty.x;
+        GL_C( glTexSubImage2D(GL_TEXTURE_2D, lvl, dirty.x, dirty.y, dirty.width, dirty.height, GL_RGBA, GL_UNSIGNED_BYTE, first) );
+        dirty=cv::Rect();
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+//copies the requested tiles out of the mapped file. This is where the disk reads happen since the pages of the file are only loaded when touched
+void VirtualTexture::loader_loop(){
+    while(true){
+        uint32_t id;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]{ return m_stop_loader || !m_load_requests.empty(); });
+            if(m_stop_loader){
+                break;
+            }
+            id=m_load_requests.front();
+            m_load_requests.pop_front();
+        }
+
+        int lvl, x, y;
+        tile_coords(id, lvl, x, y);
+        const unsigned char* src=tile_pixels_in_file(lvl, x, y);
+        LoadedTile tile;
+        tile.id=id;
+        tile.pixels.assign(src, src+m_tile_bytes);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_loaded.push_back(std::move(tile));
+    }
+}
+
+void VirtualTexture::stop_loader(){
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop_loader=true;
+    }
+    m_cond.notify_one();
+    if(m_loader.joinable()){
+        m_loader.join();
+    }
+}
+
+
+} //namespace gl
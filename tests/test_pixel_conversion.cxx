@@ -0,0 +1,77 @@
+//Checks that the simd paths of gl::convert_pixels round like the scalar ones. It doesn't need a GL context
+//Every row has 9 values with the same float, the first 8 go through the simd loop (when the cpu has it) and the last one through the scalar tail, so both have to agree
+//Returns non zero if any value differs
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <random>
+
+#include "easy_gl/PixelConversion.h"
+
+
+//what the scalar loop computes for a float that becomes U8
+static unsigned char f32_to_u8_reference(const float val){
+    float v=std::min(std::max(val*255.0f, 0.0f), 255.0f);
+    return (unsigned char)(v+0.5f);
+}
+
+int main(){
+    std::vector<float> vals;
+
+    //values that land exactly on .5 after the multiplication by 255, which is where rounding half up and rounding half to even differ
+    int nr_halves=0;
+    for(int k=0; k<255; k++){
+        float target=k+0.5f;
+        float x=target/255.0f;
+        //the division rounds so look at the neighbouring floats for one that multiplies back exactly
+        for(int step=0; step<8 && x*255.0f!=target; step++){
+            x= x*255.0f<target? std::nextafter(x, 1.0f) : std::nextafter(x, 0.0f);
+        }
+        if(x*255.0f==target){
+            vals.push_back(x);
+            nr_halves++;
+        }
+    }
+    if(nr_halves<100){
+        std::cerr << "Only found " << nr_halves << " values that land on .5, the test would not cover the rounding" << std::endl;
+        return 1;
+    }
+
+    //and some ordinary ones including out of range values that get clamped
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> dist(-0.2f, 1.2f);
+    for(int i=0; i<1000; i++){
+        vals.push_back(dist(gen));
+    }
+
+    const int width=9;
+    const int height=vals.size();
+    std::vector<float> src(width*height);
+    for(int y=0; y<height; y++){
+        std::fill(src.begin()+y*width, src.begin()+(y+1)*width, vals[y]);
+    }
+    std::vector<unsigned char> dst(width*height, 0);
+    gl::convert_pixels(src.data(), width*sizeof(float), 1, gl::PixelDepth::F32, dst.data(), width, 1, gl::PixelDepth::U8, width, height, false);
+
+    int nr_wrong=0;
+    for(int y=0; y<height; y++){
+        unsigned char expected=f32_to_u8_reference(vals[y]);
+        for(int x=0; x<width; x++){
+            if(dst[y*width+x]!=expected){
+                if(nr_wrong<10){
+                    std::cerr << "Value " << vals[y] << " (" << vals[y]*255.0f << " after scaling) at position " << x << " became " << (int)dst[y*width+x] << " but the scalar path gives " << (int)expected << std::endl;
+                }
+                nr_wrong++;
+            }
+        }
+    }
+
+    if(nr_wrong>0){
+        std::cerr << nr_wrong << " values differ between the simd and the scalar conversion" << std::endl;
+        return 1;
+    }
+    std::cout << "f32 to u8: " << vals.size() << " values, " << nr_halves << " of them on .5, simd and scalar agree" << std::endl;
+    return 0;
+}